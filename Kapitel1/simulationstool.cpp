@@ -3,11 +3,128 @@
 #include <vector>
 #include <sstream>
 #include <tuple>
+#include <cstdint>
+#include <algorithm>
 #include "simulationstool.h"
 using namespace std;
 
+/*
+The building space packed into 2 bits per cell, so 32 cells fit into one 64 bit word.
+There are only four states (EMPTY and the three buildings) so 2 bits are enough and
+counting/searching a row works on whole words instead of single cells.
+Every row starts at a new word, the unused cells at the end of a row stay EMPTY (0).
+*/
+class BitBoard
+{
+private:
+    static const int CELLS_PER_WORD = 32;
+    // 0b0101...01, the low bit of every cell
+    static const uint64_t LOW_BITS = 0x5555555555555555ULL;
+
+    size_t height = 0;
+    size_t width = 0;
+    size_t wordsPerRow = 0;
+    vector<uint64_t> words;
+
+    // The 2 bit code of a building, counted from EMPTY so an empty cell is always 0
+    static uint64_t toCode(BUILDING building)
+    {
+        static_assert(SOLARPANEL > EMPTY && HYDROELECTRICPOWERPLANTS > SOLARPANEL, "the buildings must follow EMPTY");
+        static_assert(HYDROELECTRICPOWERPLANTS - EMPTY <= 3, "every building needs to fit into 2 bits");
+        return (uint64_t)(building - EMPTY);
+    }
+
+    static BUILDING fromCode(uint64_t code)
+    {
+        return static_cast<BUILDING>(EMPTY + (int)code);
+    }
+
+    // Gives back a word with the low bit of every cell set, that contains the given building
+    static uint64_t matchMask(uint64_t word, BUILDING building)
+    {
+        // A cell matches when both of its bits are equal to the code, so the difference is 0 there
+        uint64_t difference = word ^ (LOW_BITS * toCode(building));
+        // The padding cells are EMPTY too, they need to be masked out by the caller
+        return ~(difference | (difference >> 1)) & LOW_BITS;
+    }
+
+public:
+    void resize(size_t h, size_t w)
+    {
+        this->height = h;
+        this->width = w;
+        this->wordsPerRow = (w + CELLS_PER_WORD - 1) / CELLS_PER_WORD;
+        // EMPTY has the code 0, so zeroing the words is all we need to do
+        this->words.assign(h * this->wordsPerRow, 0);
+    }
+
+    size_t getHeight() { return this->height; }
+    size_t getWidth() { return this->width; }
+
+    bool inBounds(int x, int y)
+    {
+        return x >= 0 && y >= 0 && (size_t)x < this->height && (size_t)y < this->width;
+    }
+
+    BUILDING get(size_t x, size_t y)
+    {
+        uint64_t word = this->words[x * this->wordsPerRow + y / CELLS_PER_WORD];
+        return fromCode((word >> (2 * (y % CELLS_PER_WORD))) & 3);
+    }
+
+    void set(size_t x, size_t y, BUILDING building)
+    {
+        uint64_t &word = this->words[x * this->wordsPerRow + y / CELLS_PER_WORD];
+        int shift = 2 * (y % CELLS_PER_WORD);
+        word = (word & ~(3ULL << shift)) | (toCode(building) << shift);
+    }
+
+    // Counts how often the building is in row x, one popcount per 32 cells
+    size_t countRow(size_t x, BUILDING building)
+    {
+        size_t count = 0;
+        const uint64_t *row = &this->words[x * this->wordsPerRow];
+        for (size_t i = 0; i < this->wordsPerRow; i++)
+        {
+            count += __builtin_popcountll(matchMask(row[i], building));
+        }
+        // The padding at the end of the row counts as EMPTY, so remove it again
+        if (building == EMPTY)
+            count -= this->wordsPerRow * CELLS_PER_WORD - this->width;
+        return count;
+    }
+
+    size_t count(BUILDING building)
+    {
+        size_t count = 0;
+        for (size_t x = 0; x < this->height; x++)
+        {
+            count += this->countRow(x, building);
+        }
+        return count;
+    }
+
+    // Writes row x as "0 1 2 ..." into line
+    void formatRow(size_t x, string &line)
+    {
+        line.clear();
+        const uint64_t *row = &this->words[x * this->wordsPerRow];
+        for (size_t i = 0; i < this->wordsPerRow; i++)
+        {
+            uint64_t word = row[i];
+            size_t cells = min((size_t)CELLS_PER_WORD, this->width - i * CELLS_PER_WORD);
+            for (size_t j = 0; j < cells; j++)
+            {
+                line += to_string(fromCode(word & 3));
+                line += ' ';
+                word >>= 2;
+            }
+        }
+    }
+};
+
 // Global variable buildings
-vector<vector<BUILDING>> buildings;
+BitBoard buildings;
 
 // https://stackoverflow.com/questions/4654636/how-to-determine-if-a-string-is-a-number-with-c
 bool is_number(const std::string &s)
@@ -20,40 +137,45 @@ bool is_number(const std::string &s)
 
 void printArray()
 {
-    for (int i = 0; i < buildings.size(); i++)
+    string line;
+    for (size_t i = 0; i < buildings.getHeight(); i++)
     {
-        for (int j = 0; j < buildings[i].size(); j++)
-        {
-            cout << buildings[i][j] << " ";
-        }
-        cout << endl;
+        buildings.formatRow(i, line);
+        cout << line << '\n';
+    }
+
+    // Print how many buildings of each type there are
+    for (int i = SOLARPANEL; i <= HYDROELECTRICPOWERPLANTS; i++)
+    {
+        cout << buildingTypes[i] << ": " << buildings.count(static_cast<BUILDING>(i)) << endl;
     }
 }
 
 void placeBuilding(int x, int y, BUILDING building)
 {
     // Check if x or y are out of bounds
-    if (x > buildings.size() - 1 || x < 0 || y > buildings[0].size() - 1 || y < 0)
+    if (!buildings.inBounds(x, y))
     {
         cout << "Invalid x or y" << endl;
         return;
     }
 
     // Check if the building is already at this location
-    if (buildings[x][y] == building)
+    BUILDING current = buildings.get(x, y);
+    if (current == building)
     {
         cout << "The building " << building << " is already at " << x << " " << y << endl;
         return;
     }
 
     // Check if there is already a building
-    if (building != EMPTY && buildings[x][y] != EMPTY)
+    if (building != EMPTY && current != EMPTY)
     {
         cout << "There is already a building at " << x << " " << y << endl;
         return;
     }
 
-    buildings[x][y] = building;
+    buildings.set(x, y, building);
     cout << "Successfully placed building " << buildingTypes[building] << endl;
     return;
 }
@@ -262,23 +384,8 @@ int main()
     int h = dimArray[0];
     int w = dimArray[1];
 
-    // Create a 2D array with the given h/w
-    // vector<vector<BUILDING>> buildings;
-    buildings.resize(h);
-
-    for (int i = 0; i < h; i++)
-    {
-        buildings[i].resize(w);
-    }
-
-    // Fill the array with the default value
-    for (int i = 0; i < buildings.size(); i++)
-    {
-        for (int j = 0; j < buildings[0].size(); j++)
-        {
-            buildings[i][j] = BUILDING::EMPTY;
-        }
-    }
+    // Create the building space with the given h/w, every cell starts as EMPTY
+    buildings.resize(h, w);
 
     // Just show the menu forever
     while (true)
@@ -0,0 +1,491 @@
+#include <vector>
+#include <map>
+#include <string>
+#include <mutex>
+#include <cstdint>
+#include <memory>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include "simulationstool.h"
+#include "parallel.h"
+
+#ifndef CLUSTERS_H
+#define CLUSTERS_H
+
+struct ClusterSettings
+{
+    // 4 = only left, right, up and down are connected, 8 = diagonals too
+    int connectivity = 4;
+    // If true only buildings of the same type form a cluster
+    bool perType = false;
+};
+
+// One group of connected buildings
+struct Cluster
+{
+    // One of the cells of the cluster, the one the cluster is identified by
+    int x = 0;
+    int y = 0;
+    long long size = 0;
+    // How many buildings of each type are in the cluster, the index is the BuildingId
+    std::vector<long long> buildingCounts;
+    Cents cost = 0;
+    std::map<std::string, long long> materials;
+};
+
+/*
+Finds the connected groups of buildings with a union-find over all cells.
+The full labeling works tile by tile in parallel (every tile only links its own cells), afterwards
+the borders between the tiles are joined and every cell gets the root of its cluster.
+After that it stays up to date with every change: a new building only has to be joined with its
+neighbours. A removed building can split its cluster, so only that cluster is labeled again.
+
+The union-find is kept per tile of the grid, like GridSnapshot: tiles without a building share one
+empty tile, so a big site only pays for the tiles that have buildings. A cell is identified by its
+tile and its place in the tile, both in 64 bits, so there is no limit on the number of cells.
+*/
+class ClusterIndex : public GridListener
+{
+private:
+    static constexpr uint64_t NO_CLUSTER = UINT64_MAX;
+    // A cell is (tile index << TILE_SHIFT) | (place in the tile)
+    static constexpr int TILE_SHIFT = 12;
+    static constexpr uint64_t TILE_MASK = (1 << TILE_SHIFT) - 1;
+    static_assert(GridTile::SIZE * GridTile::SIZE == (1 << TILE_SHIFT), "a cell index must fit into the tile bits");
+
+    struct ClusterTile
+    {
+        // Our own copy of the grid, a batch of changes is already published when we get told about its first change
+        BuildingId cells[GridTile::SIZE * GridTile::SIZE] = {};
+        uint64_t parent[GridTile::SIZE * GridTile::SIZE];
+
+        ClusterTile() { std::fill(this->parent, this->parent + GridTile::SIZE * GridTile::SIZE, NO_CLUSTER); }
+    };
+
+    ClusterSettings settings;
+    int height = 0;
+    int width = 0;
+    int tileColumns = 0;
+    CountedVector<std::shared_ptr<ClusterTile>, MEMORY_STATISTICS> tiles;
+    // The statistics of every cluster, only stored at its root
+    std::unordered_map<uint64_t, std::vector<long long>> counts;
+    std::vector<Building> buildingTypes;
+    int typeCount = 0;
+    std::mutex lock;
+
+    static const std::shared_ptr<ClusterTile> &getEmptyTile()
+    {
+        static const std::shared_ptr<ClusterTile> emptyTile = makeCounted<ClusterTile, MEMORY_STATISTICS>();
+        return emptyTile;
+    }
+
+    uint64_t getCell(int x, int y) const
+    {
+        uint64_t tile = (uint64_t)(x / GridTile::SIZE) * this->tileColumns + y / GridTile::SIZE;
+        return (tile << TILE_SHIFT) | ((x % GridTile::SIZE) * GridTile::SIZE + y % GridTile::SIZE);
+    }
+
+    int getX(uint64_t cell) const { return (int)((cell >> TILE_SHIFT) / this->tileColumns) * GridTile::SIZE + (int)(cell & TILE_MASK) / GridTile::SIZE; }
+    int getY(uint64_t cell) const { return (int)((cell >> TILE_SHIFT) % this->tileColumns) * GridTile::SIZE + (int)(cell & TILE_MASK) % GridTile::SIZE; }
+
+    // The position in reading order, the full labeling makes the first cell of a cluster in this order its root
+    uint64_t getReadingOrder(uint64_t cell) const { return (uint64_t)this->getX(cell) * this->width + this->getY(cell); }
+
+    BuildingId getId(uint64_t cell) const { return this->tiles[cell >> TILE_SHIFT]->cells[cell & TILE_MASK]; }
+    uint64_t getParent(uint64_t cell) const { return this->tiles[cell >> TILE_SHIFT]->parent[cell & TILE_MASK]; }
+
+    // The tile of the cell to write into, an empty tile that is still shared gets its own copy first
+    ClusterTile &getWritableTile(uint64_t cell)
+    {
+        std::shared_ptr<ClusterTile> &tile = this->tiles[cell >> TILE_SHIFT];
+        if (tile == getEmptyTile())
+            tile = makeCounted<ClusterTile, MEMORY_STATISTICS>();
+        return *tile;
+    }
+
+    void setId(uint64_t cell, BuildingId id) { this->getWritableTile(cell).cells[cell & TILE_MASK] = id; }
+    void setParent(uint64_t cell, uint64_t parent) { this->getWritableTile(cell).parent[cell & TILE_MASK] = parent; }
+
+    uint64_t find(uint64_t cell)
+    {
+        // Path halving, every step makes the path shorter for the next time
+        while (this->getParent(cell) != cell)
+        {
+            this->setParent(cell, this->getParent(this->getParent(cell)));
+            cell = this->getParent(cell);
+        }
+        return cell;
+    }
+
+    // Like find but without changing anything, so it can be called from many threads at once
+    uint64_t findReadOnly(uint64_t cell) const
+    {
+        while (this->getParent(cell) != cell)
+            cell = this->getParent(cell);
+        return cell;
+    }
+
+    bool connected(BuildingId first, BuildingId second) const
+    {
+        return first != 0 && second != 0 && (!this->settings.perType || first == second);
+    }
+
+    // Joins the clusters of both cells, gives back the new root
+    uint64_t join(uint64_t first, uint64_t second)
+    {
+        first = this->find(first);
+        second = this->find(second);
+        if (first == second)
+            return first;
+        // The bigger cluster stays the root, so the statistics of the smaller one are merged into it
+        if (this->counts[first][0] < this->counts[second][0])
+            std::swap(first, second);
+        std::vector<long long> &rootCounts = this->counts[first];
+        std::vector<long long> &otherCounts = this->counts[second];
+        for (int i = 0; i <= this->typeCount; i++)
+            rootCounts[i] += otherCounts[i];
+        this->counts.erase(second);
+        this->setParent(second, first);
+        return first;
+    }
+
+    // Only links the cells to the left and above (and the diagonals above), so every pair is linked once
+    template <typename F>
+    void forEachEarlierNeighbour(int x, int y, F function)
+    {
+        if (y > 0)
+            function(x, y - 1);
+        if (x > 0)
+            function(x - 1, y);
+        if (this->settings.connectivity == 8 && x > 0)
+        {
+            if (y > 0)
+                function(x - 1, y - 1);
+            if (y + 1 < this->width)
+                function(x - 1, y + 1);
+        }
+    }
+
+    template <typename F>
+    void forEachNeighbour(int x, int y, F function)
+    {
+        for (int ox = -1; ox <= 1; ox++)
+        {
+            for (int oy = -1; oy <= 1; oy++)
+            {
+                if ((ox == 0 && oy == 0) || (this->settings.connectivity == 4 && ox != 0 && oy != 0))
+                    continue;
+                int nx = x + ox, ny = y + oy;
+                if (nx >= 0 && nx < this->height && ny >= 0 && ny < this->width)
+                    function(nx, ny);
+            }
+        }
+    }
+
+    // Links the cell with its earlier neighbours without touching any statistics, only used by the full labeling
+    void linkEarlier(int x, int y, int minX, int minY, int maxY)
+    {
+        uint64_t cell = this->getCell(x, y);
+        BuildingId id = this->getId(cell);
+        this->forEachEarlierNeighbour(x, y, [&](int nx, int ny)
+                                      {
+            if (nx < minX || ny < minY || ny > maxY)
+                return;
+            uint64_t neighbour = this->getCell(nx, ny);
+            if (!this->connected(id, this->getId(neighbour)))
+                return;
+            uint64_t a = this->find(cell), b = this->find(neighbour);
+            // The cell that comes first in reading order becomes the root, this way no statistics are needed yet
+            if (a == b)
+                return;
+            if (this->getReadingOrder(a) < this->getReadingOrder(b))
+                this->setParent(b, a);
+            else
+                this->setParent(a, b); });
+    }
+
+    void relabelAll(const GridSnapshot &snapshot)
+    {
+        this->height = snapshot.height;
+        this->width = snapshot.width;
+        this->tileColumns = snapshot.getTileColumnCount();
+        size_t tileCount = (size_t)snapshot.getTileRowCount() * this->tileColumns;
+        this->tiles.assign(tileCount, getEmptyTile());
+        this->counts.clear();
+
+        // Step 1: every tile labels its own cells, the tiles don't share any cells so they run in parallel
+        parallelFor(tileCount, [&](size_t begin, size_t end)
+                    {
+            for (size_t tileIndex = begin; tileIndex < end; tileIndex++)
+            {
+                int tileX = tileIndex / this->tileColumns, tileY = tileIndex % this->tileColumns;
+                const GridTile &tile = snapshot.getTile(tileX, tileY);
+                int x0 = tileX * GridTile::SIZE, y0 = tileY * GridTile::SIZE;
+                int x1 = std::min(x0 + GridTile::SIZE, this->height), y1 = std::min(y0 + GridTile::SIZE, this->width);
+                // Only the cells with a building are visited, found with the occupancy bits of the tile
+                for (int pass = 0; pass < 2; pass++)
+                {
+                    for (int x = x0; x < x1; x++)
+                    {
+                        uint64_t word = tile.occupied[x - x0];
+                        while (word != 0)
+                        {
+                            int y = y0 + countTrailingZeros(word);
+                            word &= word - 1;
+                            uint64_t cell = this->getCell(x, y);
+                            if (pass == 0)
+                            {
+                                this->setId(cell, tile.get(x - x0, y - y0));
+                                this->setParent(cell, cell);
+                            }
+                            else
+                            {
+                                this->linkEarlier(x, y, x0, y0, y1 - 1);
+                            }
+                        }
+                    }
+                }
+            } });
+
+        // Step 2: join the clusters across the borders of the tiles, these are only the first row and column of every tile
+        for (int x = 0; x < this->height; x++)
+        {
+            for (int y = 0; y < this->width; y += (x % GridTile::SIZE == 0) ? 1 : GridTile::SIZE)
+            {
+                if (this->getId(this->getCell(x, y)) != 0)
+                    this->linkEarlier(x, y, 0, 0, this->width - 1);
+                // The diagonal up and to the right crosses the border of the tile on the right
+                if (this->settings.connectivity == 8 && y % GridTile::SIZE == 0 && y > 0 && this->getId(this->getCell(x, y - 1)) != 0)
+                    this->linkEarlier(x, y - 1, 0, 0, this->width - 1);
+            }
+        }
+
+        // Step 3: point every cell directly to its root and count the buildings of every cluster.
+        // The roots go into new tiles, the old ones are still read by the other threads
+        CountedVector<std::shared_ptr<ClusterTile>, MEMORY_STATISTICS> rootTiles(tileCount, getEmptyTile());
+        parallelFor(tileCount, [&](size_t begin, size_t end)
+                    {
+            for (size_t tileIndex = begin; tileIndex < end; tileIndex++)
+            {
+                const ClusterTile &tile = *this->tiles[tileIndex];
+                if (&tile == getEmptyTile().get())
+                    continue;
+                std::shared_ptr<ClusterTile> roots = makeCounted<ClusterTile, MEMORY_STATISTICS>();
+                std::copy(tile.cells, tile.cells + GridTile::SIZE * GridTile::SIZE, roots->cells);
+                for (int place = 0; place < GridTile::SIZE * GridTile::SIZE; place++)
+                {
+                    if (tile.parent[place] != NO_CLUSTER)
+                        roots->parent[place] = this->findReadOnly(((uint64_t)tileIndex << TILE_SHIFT) | place);
+                }
+                rootTiles[tileIndex] = roots;
+            } });
+        this->tiles.swap(rootTiles);
+        rootTiles.clear();
+        snapshot.forEachBuilding([&](int x, int y, BuildingId id)
+                                 {
+            std::vector<long long> &clusterCounts = this->counts[this->getParent(this->getCell(x, y))];
+            if (clusterCounts.empty())
+                clusterCounts.assign(this->typeCount + 1, 0);
+            clusterCounts[0]++;
+            clusterCounts[id]++; });
+    }
+
+    void add(int x, int y, BuildingId id)
+    {
+        uint64_t cell = this->getCell(x, y);
+        this->setId(cell, id);
+        this->setParent(cell, cell);
+        std::vector<long long> &cellCounts = this->counts[cell];
+        cellCounts.assign(this->typeCount + 1, 0);
+        cellCounts[0] = 1;
+        cellCounts[id] = 1;
+        this->forEachNeighbour(x, y, [&](int nx, int ny)
+                               {
+            uint64_t neighbour = this->getCell(nx, ny);
+            if (this->connected(id, this->getId(neighbour)))
+                this->join(cell, neighbour); });
+    }
+
+    // Labels the cluster the removed cell belonged to again, it can fall apart into up to 8 pieces
+    void remove(int x, int y)
+    {
+        uint64_t cell = this->getCell(x, y);
+        uint64_t oldRoot = this->find(cell);
+        this->counts.erase(oldRoot);
+        this->setId(cell, 0);
+
+        // Collect the remaining cells of the old cluster with a flood fill from the neighbours
+        std::vector<uint64_t> members;
+        std::unordered_set<uint64_t> seen;
+        this->forEachNeighbour(x, y, [&](int nx, int ny)
+                               {
+            uint64_t neighbour = this->getCell(nx, ny);
+            if (this->getId(neighbour) == 0 || seen.count(neighbour) || this->find(neighbour) != oldRoot)
+                return;
+            seen.insert(neighbour);
+            // The members vector doubles as the stack of the flood fill
+            size_t next = members.size();
+            members.push_back(neighbour);
+            for (; next < members.size(); next++)
+            {
+                uint64_t current = members[next];
+                this->forEachNeighbour(this->getX(current), this->getY(current), [&](int mx, int my)
+                                       {
+                    uint64_t member = this->getCell(mx, my);
+                    if (!this->connected(this->getId(current), this->getId(member)) || seen.count(member))
+                        return;
+                    seen.insert(member);
+                    members.push_back(member); });
+            }
+        });
+        this->setParent(cell, NO_CLUSTER);
+
+        // Every member starts alone again and is joined with its neighbours, this splits the cluster correctly
+        for (uint64_t member : members)
+        {
+            this->setParent(member, member);
+            std::vector<long long> &memberCounts = this->counts[member];
+            memberCounts.assign(this->typeCount + 1, 0);
+            memberCounts[0] = 1;
+            memberCounts[this->getId(member)] = 1;
+        }
+        for (uint64_t member : members)
+        {
+            this->forEachNeighbour(this->getX(member), this->getY(member), [&](int nx, int ny)
+                                   {
+                uint64_t neighbour = this->getCell(nx, ny);
+                if (this->getParent(neighbour) != NO_CLUSTER && this->connected(this->getId(member), this->getId(neighbour)))
+                    this->join(member, neighbour); });
+        }
+    }
+
+    Cluster describe(uint64_t root, const std::vector<long long> &clusterCounts)
+    {
+        Cluster cluster;
+        cluster.x = this->getX(root);
+        cluster.y = this->getY(root);
+        cluster.size = clusterCounts[0];
+        cluster.buildingCounts = clusterCounts;
+        cluster.buildingCounts[0] = 0;
+        for (int id = 1; id <= this->typeCount; id++)
+        {
+            if (clusterCounts[id] == 0)
+                continue;
+            Building &buildingType = this->buildingTypes[id - 1];
+            cluster.cost += clusterCounts[id] * buildingType.getTotalPrice();
+            for (Material &material : buildingType.getNecessaryMaterials())
+                cluster.materials[material.getName()] += clusterCounts[id];
+        }
+        return cluster;
+    }
+
+public:
+    ClusterIndex(ClusterSettings settings = ClusterSettings()) : settings(settings) {}
+
+    // Labels the current grid and keeps the clusters up to date from now on
+    void attach(CapycitySim &simulation)
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->buildingTypes = simulation.getBuildingTypes();
+        this->typeCount = this->buildingTypes.size();
+        std::shared_ptr<const GridSnapshot> snapshot = simulation.addListener(*this);
+        this->relabelAll(*snapshot);
+    }
+
+    void detach(CapycitySim &simulation) { simulation.removeListener(*this); }
+
+    // Changing the settings labels everything again
+    void setSettings(ClusterSettings settings, CapycitySim &simulation)
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->settings = settings;
+        this->relabelAll(*simulation.getSnapshot());
+    }
+
+    // Only takes the settings, for an index that is not attached yet
+    void setSettings(ClusterSettings settings) { this->settings = settings; }
+
+    ClusterSettings getSettings() { return this->settings; }
+
+    void onCellChanged(int x, int y, BuildingId oldId, BuildingId newId) override
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        if (oldId != 0)
+            this->remove(x, y);
+        if (newId != 0)
+            this->add(x, y, newId);
+    }
+
+    long long getClusterCount()
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return this->counts.size();
+    }
+
+    // All clusters, the biggest first
+    std::vector<Cluster> getClusters()
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        std::vector<Cluster> clusters;
+        clusters.reserve(this->counts.size());
+        for (auto &entry : this->counts)
+        {
+            clusters.push_back(this->describe(entry.first, entry.second));
+        }
+        std::sort(clusters.begin(), clusters.end(), [](const Cluster &first, const Cluster &second)
+                  { return first.size != second.size ? first.size > second.size : (first.x != second.x ? first.x < second.x : first.y < second.y); });
+        return clusters;
+    }
+
+    // Identifies the cluster of the building at x/y without collecting its statistics, -1 if the cell is empty
+    long long getClusterIdAt(int x, int y)
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        uint64_t cell = this->getCell(x, y);
+        if (this->getParent(cell) == NO_CLUSTER)
+            return -1;
+        return this->find(cell);
+    }
+
+    // The cluster the building at x/y belongs to, the size is 0 if the cell is empty
+    Cluster getClusterAt(int x, int y)
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        uint64_t cell = this->getCell(x, y);
+        if (this->getParent(cell) == NO_CLUSTER)
+            return Cluster();
+        uint64_t root = this->find(cell);
+        return this->describe(root, this->counts[root]);
+    }
+};
+
+// Prints the biggest clusters with what they are made of
+void printClusters(OutputSink &output, std::vector<Cluster> &clusters, CapycitySim &simulation, size_t limit = 10)
+{
+    output << "[*] " << (long long)clusters.size() << " clusters\n";
+    for (size_t i = 0; i < clusters.size() && i < limit; i++)
+    {
+        Cluster &cluster = clusters[i];
+        // Coordinates are shown 1 indexed as XxY, like everywhere else
+        output << " " << (long long)(i + 1) << ": " << cluster.size << " buildings at " << (cluster.y + 1) << "x" << (cluster.x + 1) << " (";
+        bool first = true;
+        for (size_t id = 1; id < cluster.buildingCounts.size(); id++)
+        {
+            if (cluster.buildingCounts[id] == 0)
+                continue;
+            output << (first ? "" : " ") << cluster.buildingCounts[id] << "x " << simulation.getBuildingFromId(id).getLabel();
+            first = false;
+        }
+        output << "), ";
+        output.writeCents(cluster.cost);
+        output << "$";
+        for (auto &material : cluster.materials)
+        {
+            output << ", " << material.second << "x " << material.first;
+        }
+        output << "\n";
+    }
+}
+
+#endif
@@ -0,0 +1,199 @@
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "simulationstool.h"
+#include "parallel.h"
+
+#ifndef CONCURRENT_H
+#define CONCURRENT_H
+
+/*
+Lets many threads place buildings on a site at once, for generators that fill a site in parallel.
+The snapshots of the site can't change, so the threads work on their own copy of every tile they
+touch. A tile is copied from the site the first time a thread needs it, and the thread that installs
+its copy first wins. Placing a building is one compare-and-swap from empty to the building on the cell,
+so two threads that want the same cell can't both get it and no thread ever waits for a lock.
+Every thread counts into its own shard of the statistics, the shards are only added up when they are read.
+Nothing is visible on the site until commit(), which goes through setBuildings so the rules,
+listeners and the journal see every building like any other change.
+*/
+class ConcurrentPlacement
+{
+private:
+    struct AtomicTile
+    {
+        std::atomic<BuildingId> cells[GridTile::SIZE * GridTile::SIZE];
+    };
+
+    // A whole cache line per shard, so the threads don't slow each other down by writing next to each other
+    struct alignas(64) Shard
+    {
+        std::atomic<long long> placed{0};
+        std::atomic<long long> conflicts{0};
+        // How many buildings of every type this shard placed, the index is the BuildingId
+        std::unique_ptr<std::atomic<long long>[]> buildingCounts;
+    };
+
+    CapycitySim &site;
+    // The snapshot the tiles are copied from
+    std::shared_ptr<const GridSnapshot> base;
+    int tileColumns;
+    std::unique_ptr<std::atomic<AtomicTile *>[]> tiles;
+    size_t tileCount;
+    size_t buildingTypeCount;
+    std::vector<Shard> shards;
+
+    // Every thread gets the next number the first time it places something here
+    static size_t getThreadIndex()
+    {
+        static std::atomic<size_t> nextThread{0};
+        thread_local size_t index = nextThread.fetch_add(1, std::memory_order_relaxed);
+        return index;
+    }
+
+    Shard &getShard() { return this->shards[getThreadIndex() % this->shards.size()]; }
+
+    AtomicTile &getTile(int tileX, int tileY)
+    {
+        std::atomic<AtomicTile *> &slot = this->tiles[(size_t)tileX * this->tileColumns + tileY];
+        AtomicTile *tile = slot.load(std::memory_order_acquire);
+        if (tile != nullptr)
+            return *tile;
+
+        AtomicTile *copy = new AtomicTile;
+        const GridTile &original = this->base->getTile(tileX, tileY);
+        for (int i = 0; i < GridTile::SIZE * GridTile::SIZE; i++)
+            copy->cells[i].store(original.cells[i], std::memory_order_relaxed);
+        // Another thread may have copied the same tile in the meantime, then its copy is used
+        if (slot.compare_exchange_strong(tile, copy, std::memory_order_acq_rel, std::memory_order_acquire))
+            return *copy;
+        delete copy;
+        return *tile;
+    }
+
+    void clearTiles()
+    {
+        for (size_t i = 0; i < this->tileCount; i++)
+        {
+            delete this->tiles[i].load(std::memory_order_relaxed);
+            this->tiles[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+public:
+    ConcurrentPlacement(CapycitySim &site) : site(site)
+    {
+        this->base = site.getSnapshot();
+        this->tileColumns = this->base->getTileColumnCount();
+        this->tileCount = (size_t)this->base->getTileRowCount() * this->tileColumns;
+        this->tiles.reset(new std::atomic<AtomicTile *>[this->tileCount]);
+        for (size_t i = 0; i < this->tileCount; i++)
+            this->tiles[i].store(nullptr, std::memory_order_relaxed);
+        this->buildingTypeCount = site.getBuildingTypes().size();
+        this->shards = std::vector<Shard>(getThreadCount());
+        for (Shard &shard : this->shards)
+        {
+            shard.buildingCounts.reset(new std::atomic<long long>[this->buildingTypeCount + 1]);
+            for (size_t id = 0; id <= this->buildingTypeCount; id++)
+                shard.buildingCounts[id].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    ConcurrentPlacement(const ConcurrentPlacement &) = delete;
+    ConcurrentPlacement &operator=(const ConcurrentPlacement &) = delete;
+
+    ~ConcurrentPlacement() { this->clearTiles(); }
+
+    /*
+    Puts the building at x/y if the cell is empty, can be called from any number of threads at once.
+    Gives back false if the cell is taken (that counts as a conflict) or x, y or the id are invalid.
+    */
+    bool place(int x, int y, BuildingId id)
+    {
+        if (x < 0 || x >= this->base->height || y < 0 || y >= this->base->width || id == 0 || id > this->buildingTypeCount)
+            return false;
+        AtomicTile &tile = this->getTile(x / GridTile::SIZE, y / GridTile::SIZE);
+        BuildingId expected = 0;
+        Shard &shard = this->getShard();
+        if (!tile.cells[(x % GridTile::SIZE) * GridTile::SIZE + y % GridTile::SIZE].compare_exchange_strong(expected, id, std::memory_order_acq_rel))
+        {
+            shard.conflicts.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        shard.placed.fetch_add(1, std::memory_order_relaxed);
+        shard.buildingCounts[id].fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // What is at x/y including the buildings that were placed here, 0 outside of the site
+    BuildingId get(int x, int y)
+    {
+        if (x < 0 || x >= this->base->height || y < 0 || y >= this->base->width)
+            return 0;
+        AtomicTile *tile = this->tiles[(size_t)(x / GridTile::SIZE) * this->tileColumns + y / GridTile::SIZE].load(std::memory_order_acquire);
+        if (tile == nullptr)
+            return this->base->get(x, y);
+        return tile->cells[(x % GridTile::SIZE) * GridTile::SIZE + y % GridTile::SIZE].load(std::memory_order_acquire);
+    }
+
+    // The statistics of all threads together, exact once no thread is placing anymore
+    long long getPlacedCount()
+    {
+        long long placed = 0;
+        for (Shard &shard : this->shards)
+            placed += shard.placed.load(std::memory_order_relaxed);
+        return placed;
+    }
+
+    long long getConflictCount()
+    {
+        long long conflicts = 0;
+        for (Shard &shard : this->shards)
+            conflicts += shard.conflicts.load(std::memory_order_relaxed);
+        return conflicts;
+    }
+
+    // How many buildings with that id were placed here, the ones that were on the site before are not counted
+    long long getPlacedCount(BuildingId id)
+    {
+        long long count = 0;
+        if (id > this->buildingTypeCount)
+            return 0;
+        for (Shard &shard : this->shards)
+            count += shard.buildingCounts[id].load(std::memory_order_relaxed);
+        return count;
+    }
+
+    /*
+    Puts every placed building on the site and gives back how many made it.
+    No thread may place while this runs. Buildings that break the rules of the site or whose cell was
+    filled on the site in the meantime are reported on the output like for setBuildings.
+    Afterwards placing starts again from the new state of the site, the statistics are kept.
+    */
+    int commit(OutputSink &output)
+    {
+        std::vector<Placement> placements;
+        for (int tileX = 0; tileX < this->base->getTileRowCount(); tileX++)
+        {
+            for (int tileY = 0; tileY < this->tileColumns; tileY++)
+            {
+                AtomicTile *tile = this->tiles[(size_t)tileX * this->tileColumns + tileY].load(std::memory_order_acquire);
+                if (tile == nullptr)
+                    continue;
+                const GridTile &original = this->base->getTile(tileX, tileY);
+                for (int i = 0; i < GridTile::SIZE * GridTile::SIZE; i++)
+                {
+                    BuildingId id = tile->cells[i].load(std::memory_order_relaxed);
+                    if (id != original.cells[i])
+                        placements.push_back(Placement{tileX * GridTile::SIZE + i / GridTile::SIZE, tileY * GridTile::SIZE + i % GridTile::SIZE, id});
+                }
+            }
+        }
+        this->clearTiles();
+        int placed = placements.empty() ? 0 : this->site.setBuildings(placements, output);
+        this->base = this->site.getSnapshot();
+        return placed;
+    }
+};
+
+#endif
@@ -0,0 +1,63 @@
+#include <vector>
+#include <algorithm>
+#include "simulationstool.h"
+
+#ifndef DIFF_H
+#define DIFF_H
+
+// Everything that is different between two layouts of the same size
+struct LayoutDiff
+{
+    // Every changed cell, row by row
+    std::vector<CellChange> changes;
+    // Buildings on cells that were empty before
+    long long added = 0;
+    // Buildings that are gone and left an empty cell
+    long long removed = 0;
+    // Cells that have a different building now
+    long long changed = 0;
+    // What the buildings cost afterwards minus what they cost before
+    Cents costDelta = 0;
+};
+
+/*
+Compares two snapshots of the same size. Shared tiles and tiles with the same cells are skipped,
+so this is fast for two versions of the same site and also for a site and a snapshot file with few
+changes. The cost delta comes from the building counts of both snapshots and doesn't need the cells.
+*/
+LayoutDiff diffLayouts(const GridSnapshot &before, const GridSnapshot &after, std::vector<Building> &buildingTypes)
+{
+    LayoutDiff diff;
+    before.forEachDifference(after, [&](int x, int y, BuildingId oldId, BuildingId newId)
+                             {
+        diff.changes.push_back(CellChange{x, y, oldId, newId});
+        if (oldId == 0)
+            diff.added++;
+        else if (newId == 0)
+            diff.removed++;
+        else
+            diff.changed++; });
+    // The snapshots are compared tile by tile, but a change set reads better row by row
+    std::sort(diff.changes.begin(), diff.changes.end(), [](const CellChange &first, const CellChange &second)
+              { return first.x != second.x ? first.x < second.x : first.y < second.y; });
+    for (size_t id = 1; id <= buildingTypes.size(); id++)
+        diff.costDelta += (after.buildingCounts[id] - before.buildingCounts[id]) * buildingTypes[id - 1].getTotalPrice();
+    return diff;
+}
+
+// Prints the totals and the first changes, the coordinates the way the user types them (XxY, 1 indexed)
+void printDiff(OutputSink &output, const LayoutDiff &diff, CapycitySim &simulation, size_t limit = 20)
+{
+    output << "[*] " << diff.added << " added, " << diff.removed << " removed, " << diff.changed << " changed, the cost changes by " << (diff.costDelta >= 0 ? "+" : "");
+    output.writeCents(diff.costDelta);
+    output << "$\n";
+    for (size_t i = 0; i < diff.changes.size() && i < limit; i++)
+    {
+        const CellChange &change = diff.changes[i];
+        output << " " << (change.y + 1) << "x" << (change.x + 1) << ": " << simulation.getBuildingFromId(change.oldId).getLabel() << " -> " << simulation.getBuildingFromId(change.newId).getLabel() << "\n";
+    }
+    if (diff.changes.size() > limit)
+        output << " ... and " << (long long)(diff.changes.size() - limit) << " more\n";
+}
+
+#endif
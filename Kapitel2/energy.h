@@ -0,0 +1,410 @@
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <mutex>
+#include <map>
+#include <algorithm>
+#include "simulationstool.h"
+#include "parallel.h"
+
+#ifndef ENERGY_H
+#define ENERGY_H
+
+// The weather of every hour of the simulated time span
+struct WeatherProfile
+{
+    // Solar irradiance in W/m^2
+    std::vector<float> solarIrradiance;
+    // Wind speed at hub height in m/s
+    std::vector<float> windSpeed;
+    // River flow as a share of the flow the hydro plants are built for, 1 = design flow
+    std::vector<float> waterFlow;
+
+    size_t getHourCount() const { return this->solarIrradiance.size(); }
+
+    // A made up but plausible year: day/night and summer/winter for the sun, some gusty wind and a spring flood
+    static WeatherProfile createDefault(int hours = 8760)
+    {
+        const double pi = 3.14159265358979323846;
+        WeatherProfile profile;
+        uint32_t random = 12345;
+        for (int hour = 0; hour < hours; hour++)
+        {
+            double dayOfYear = hour / 24.0;
+            double season = std::sin(2 * pi * (dayOfYear - 80) / 365.0);
+            double daylight = std::sin(2 * pi * ((hour % 24) - 6) / 24.0);
+            profile.solarIrradiance.push_back(std::max(0.0, daylight) * (650 + 350 * season));
+
+            // Simple LCG, so the profile is the same on every run
+            random = random * 1664525u + 1013904223u;
+            double gust = (random >> 8) / (double)(1u << 24);
+            profile.windSpeed.push_back(7 - 2 * season + 6 * (gust - 0.5));
+
+            double flood = std::exp(-std::pow((dayOfYear - 110) / 30.0, 2));
+            profile.waterFlow.push_back(0.55 + 0.25 * season + 0.5 * flood);
+        }
+        return profile;
+    }
+
+    // Loads a profile from a csv file with one "irradiance,windspeed,flow" line per hour, lines starting with # are skipped
+    static bool load(const std::string &path, WeatherProfile &profile)
+    {
+        std::ifstream file(path);
+        if (!file)
+            return false;
+        profile = WeatherProfile();
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::stringstream lineStream(line);
+            std::string part;
+            float values[3];
+            int valueCount = 0;
+            while (valueCount < 3 && std::getline(lineStream, part, ','))
+            {
+                values[valueCount++] = std::strtof(part.c_str(), nullptr);
+            }
+            if (valueCount != 3)
+                return false;
+            profile.solarIrradiance.push_back(values[0]);
+            profile.windSpeed.push_back(values[1]);
+            profile.waterFlow.push_back(values[2]);
+        }
+        return profile.getHourCount() > 0;
+    }
+};
+
+/*
+All the placed power plants, one array per parameter (structure of arrays), so the step
+functions can run over many buildings at once with SIMD instructions.
+efficiency is a per building factor (1 = no losses) for things like shading or wake effects.
+*/
+struct SolarFleet
+{
+    std::vector<int> x, y;
+    std::vector<float> ratedPower, efficiency;
+
+    size_t size() const { return this->ratedPower.size(); }
+};
+
+struct WindFleet
+{
+    std::vector<int> x, y;
+    // Wind speeds in m/s where the turbine starts, reaches its rated power and shuts down
+    std::vector<float> ratedPower, cutInSpeed, ratedSpeed, cutOutSpeed, efficiency;
+
+    size_t size() const { return this->ratedPower.size(); }
+};
+
+struct HydroFleet
+{
+    std::vector<int> x, y;
+    // The share of the design flow where the plant reaches its rated power
+    std::vector<float> ratedPower, designFlow, efficiency;
+
+    size_t size() const { return this->ratedPower.size(); }
+};
+
+struct EnergyFleet
+{
+    SolarFleet solar;
+    WindFleet wind;
+    HydroFleet hydro;
+
+    size_t size() const { return this->solar.size() + this->wind.size() + this->hydro.size(); }
+
+    // Collects all the power plants of the snapshot
+    static EnergyFleet fromSnapshot(const GridSnapshot &snapshot, std::vector<Building> &buildingTypes)
+    {
+        EnergyFleet fleet;
+        snapshot.forEachBuilding([&](int x, int y, BuildingId id)
+                                 { fleet.add(x, y, buildingTypes[id - 1]); });
+        return fleet;
+    }
+
+    void add(int x, int y, Building &building)
+    {
+        float ratedPower = building.getRatedPower();
+        switch (building.getEnergySource())
+        {
+        case SOLAR:
+            this->solar.x.push_back(x);
+            this->solar.y.push_back(y);
+            this->solar.ratedPower.push_back(ratedPower);
+            this->solar.efficiency.push_back(1);
+            break;
+        case WIND:
+            this->wind.x.push_back(x);
+            this->wind.y.push_back(y);
+            this->wind.ratedPower.push_back(ratedPower);
+            this->wind.cutInSpeed.push_back(3);
+            this->wind.ratedSpeed.push_back(12);
+            this->wind.cutOutSpeed.push_back(25);
+            this->wind.efficiency.push_back(1);
+            break;
+        case HYDRO:
+            this->hydro.x.push_back(x);
+            this->hydro.y.push_back(y);
+            this->hydro.ratedPower.push_back(ratedPower);
+            this->hydro.designFlow.push_back(1);
+            this->hydro.efficiency.push_back(1);
+            break;
+        default:
+            break;
+        }
+    }
+};
+
+// Gets the output of every building for every simulated hour, e.g. to write it to disk
+class EnergyStepListener
+{
+public:
+    virtual ~EnergyStepListener() {}
+    // The arrays have the same order as the fleet, the values are in kWh (kW over one hour)
+    virtual void onStep(size_t hour, const EnergyFleet &fleet, const float *solar, const float *wind, const float *hydro) = 0;
+};
+
+struct EnergyResult
+{
+    // The output of all buildings of one type per hour in kWh
+    std::vector<double> solarHourly, windHourly, hydroHourly;
+    // The output of every single building over the whole time span in kWh
+    std::vector<double> solarTotal, windTotal, hydroTotal;
+
+    static double sum(const std::vector<double> &values)
+    {
+        double total = 0;
+        for (double value : values)
+            total += value;
+        return total;
+    }
+
+    static size_t peakHour(const std::vector<double> &values)
+    {
+        return std::max_element(values.begin(), values.end()) - values.begin();
+    }
+};
+
+/*
+Steps through the weather profile hour by hour and computes the output of every power plant.
+The buildings are split into chunks over all cores, every chunk is small enough to stay in the
+cache while all the hours of a block are computed for it. The inner loops have no branches so
+the compiler can vectorize them.
+*/
+class EnergySimulation
+{
+private:
+    // Buildings per inner block, small enough that their parameters and totals stay in the cache
+    static const size_t CACHE_BLOCK = 2048;
+
+    static void solarStep(const SolarFleet &fleet, float irradiance, size_t begin, size_t end, float *__restrict output)
+    {
+        // Linear in the irradiance, the rated power is reached at 1000 W/m^2
+        float load = std::min(std::max(irradiance / 1000.0f, 0.0f), 1.0f);
+        const float *__restrict ratedPower = fleet.ratedPower.data();
+        const float *__restrict efficiency = fleet.efficiency.data();
+        for (size_t i = begin; i < end; i++)
+        {
+            output[i] = ratedPower[i] * efficiency[i] * load;
+        }
+    }
+
+    static void windStep(const WindFleet &fleet, float windSpeed, size_t begin, size_t end, float *__restrict output)
+    {
+        // Cubic between cut in and rated speed, flat up to the cut out speed and nothing outside
+        float speedCubed = windSpeed * windSpeed * windSpeed;
+        const float *__restrict ratedPower = fleet.ratedPower.data();
+        const float *__restrict cutIn = fleet.cutInSpeed.data();
+        const float *__restrict rated = fleet.ratedSpeed.data();
+        const float *__restrict cutOut = fleet.cutOutSpeed.data();
+        const float *__restrict efficiency = fleet.efficiency.data();
+        for (size_t i = begin; i < end; i++)
+        {
+            float cutInCubed = cutIn[i] * cutIn[i] * cutIn[i];
+            float ratedCubed = rated[i] * rated[i] * rated[i];
+            float load = (speedCubed - cutInCubed) / (ratedCubed - cutInCubed);
+            load = std::min(std::max(load, 0.0f), 1.0f);
+            load = (windSpeed > cutOut[i]) ? 0.0f : load;
+            output[i] = ratedPower[i] * efficiency[i] * load;
+        }
+    }
+
+    static void hydroStep(const HydroFleet &fleet, float flow, size_t begin, size_t end, float *__restrict output)
+    {
+        const float *__restrict ratedPower = fleet.ratedPower.data();
+        const float *__restrict designFlow = fleet.designFlow.data();
+        const float *__restrict efficiency = fleet.efficiency.data();
+        for (size_t i = begin; i < end; i++)
+        {
+            float load = std::min(std::max(flow / designFlow[i], 0.0f), 1.0f);
+            output[i] = ratedPower[i] * efficiency[i] * load;
+        }
+    }
+
+    // Adds the output of [begin, end) to the per building totals and gives back the sum
+    static double accumulate(const float *__restrict output, size_t begin, size_t end, double *__restrict total)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            total[i] += output[i];
+        }
+
+        // Summing into a few independent double lanes lets the compiler use SIMD. The order of the additions
+        // only depends on begin and end, so the same range always gives the same sum
+        const int LANES = 8;
+        double lanes[LANES] = {};
+        size_t i = begin;
+        for (; i + LANES <= end; i += LANES)
+        {
+            for (int lane = 0; lane < LANES; lane++)
+                lanes[lane] += output[i + lane];
+        }
+        double sum = 0;
+        for (; i < end; i++)
+            sum += output[i];
+        for (int lane = 0; lane < LANES; lane++)
+            sum += lanes[lane];
+        return sum;
+    }
+
+public:
+    EnergyResult run(const EnergyFleet &fleet, const WeatherProfile &weather, EnergyStepListener *listener = nullptr)
+    {
+        size_t hours = weather.getHourCount();
+        size_t solarCount = fleet.solar.size();
+        size_t windCount = fleet.wind.size();
+        size_t hydroCount = fleet.hydro.size();
+        size_t buildingCount = fleet.size();
+
+        EnergyResult result;
+        result.solarHourly.assign(hours, 0);
+        result.windHourly.assign(hours, 0);
+        result.hydroHourly.assign(hours, 0);
+        result.solarTotal.assign(solarCount, 0);
+        result.windTotal.assign(windCount, 0);
+        result.hydroTotal.assign(hydroCount, 0);
+
+        // Without a listener nobody needs the single hours, so everything is one block.
+        // With a listener every hour of the block is kept for it, so the block must not get too big
+        size_t blockHours = hours;
+        if (listener != nullptr)
+            blockHours = std::max((size_t)1, std::min((size_t)168, (16u << 20) / std::max(buildingCount, (size_t)1)));
+
+        // Outside of listener blocks only one hour per building is kept as scratch space
+        std::vector<float> solarOutput, windOutput, hydroOutput;
+        // The hourly sums of every chunk by its first building. They are added up in the order of the chunks
+        // and not in the order the threads finish, so the same fleet and thread count always give the same result
+        std::map<size_t, std::vector<double>> chunkHourly;
+        std::mutex hourlyLock;
+
+        for (size_t blockStart = 0; blockStart < hours; blockStart += blockHours)
+        {
+            size_t blockLength = std::min(blockHours, hours - blockStart);
+            size_t bufferHours = (listener != nullptr) ? blockLength : 1;
+            solarOutput.resize(bufferHours * solarCount);
+            windOutput.resize(bufferHours * windCount);
+            hydroOutput.resize(bufferHours * hydroCount);
+
+            // The three fleets are put behind each other, so the threads can split them all at once
+            chunkHourly.clear();
+            parallelFor(buildingCount, [&](size_t begin, size_t end)
+                        {
+                // Solar, wind and hydro behind each other
+                std::vector<double> hourly(3 * blockLength, 0);
+                double *solarHourly = hourly.data();
+                double *windHourly = solarHourly + blockLength;
+                double *hydroHourly = windHourly + blockLength;
+                for (size_t blockBegin = begin; blockBegin < end; blockBegin += CACHE_BLOCK)
+                {
+                    size_t blockEnd = std::min(end, blockBegin + CACHE_BLOCK);
+                    // Cut the global range into the part of every fleet
+                    size_t solarBegin = std::min(blockBegin, solarCount), solarEnd = std::min(blockEnd, solarCount);
+                    size_t windBegin = std::min(std::max(blockBegin, solarCount), solarCount + windCount) - solarCount;
+                    size_t windEnd = std::min(std::max(blockEnd, solarCount), solarCount + windCount) - solarCount;
+                    size_t hydroBegin = std::max(blockBegin, solarCount + windCount) - solarCount - windCount;
+                    size_t hydroEnd = std::max(blockEnd, solarCount + windCount) - solarCount - windCount;
+
+                    for (size_t hour = 0; hour < blockLength; hour++)
+                    {
+                        size_t absoluteHour = blockStart + hour;
+                        size_t bufferHour = (listener != nullptr) ? hour : 0;
+                        float *solar = solarOutput.data() + bufferHour * solarCount;
+                        float *wind = windOutput.data() + bufferHour * windCount;
+                        float *hydro = hydroOutput.data() + bufferHour * hydroCount;
+
+                        solarStep(fleet.solar, weather.solarIrradiance[absoluteHour], solarBegin, solarEnd, solar);
+                        windStep(fleet.wind, weather.windSpeed[absoluteHour], windBegin, windEnd, wind);
+                        hydroStep(fleet.hydro, weather.waterFlow[absoluteHour], hydroBegin, hydroEnd, hydro);
+                        solarHourly[hour] += accumulate(solar, solarBegin, solarEnd, result.solarTotal.data());
+                        windHourly[hour] += accumulate(wind, windBegin, windEnd, result.windTotal.data());
+                        hydroHourly[hour] += accumulate(hydro, hydroBegin, hydroEnd, result.hydroTotal.data());
+                    }
+                }
+
+                std::lock_guard<std::mutex> lock(hourlyLock);
+                chunkHourly[begin] = std::move(hourly); },
+                        CACHE_BLOCK);
+
+            for (auto &chunk : chunkHourly)
+            {
+                const double *hourly = chunk.second.data();
+                for (size_t hour = 0; hour < blockLength; hour++)
+                {
+                    result.solarHourly[blockStart + hour] += hourly[hour];
+                    result.windHourly[blockStart + hour] += hourly[blockLength + hour];
+                    result.hydroHourly[blockStart + hour] += hourly[2 * blockLength + hour];
+                }
+            }
+
+            if (listener != nullptr)
+            {
+                for (size_t hour = 0; hour < blockLength; hour++)
+                {
+                    listener->onStep(blockStart + hour, fleet, solarOutput.data() + hour * solarCount,
+                                     windOutput.data() + hour * windCount, hydroOutput.data() + hour * hydroCount);
+                }
+            }
+        }
+        return result;
+    }
+};
+
+void printEnergyReport(OutputSink &output, const EnergyFleet &fleet, const EnergyResult &result)
+{
+    struct
+    {
+        const char *name;
+        size_t count;
+        const std::vector<double> *hourly;
+    } rows[] = {
+        {"Solar Panel", fleet.solar.size(), &result.solarHourly},
+        {"Wind Power Plant", fleet.wind.size(), &result.windHourly},
+        {"Hydroelectric Power Plant", fleet.hydro.size(), &result.hydroHourly},
+    };
+
+    output << "[*] Energy production over " << result.solarHourly.size() << " hours:\n";
+    double total = 0;
+    for (auto &row : rows)
+    {
+        double energy = EnergyResult::sum(*row.hourly);
+        total += energy;
+        output << " " << row.name << " (" << row.count << "x): ";
+        output.writeFixed(energy / 1000, 1) << " MWh";
+        if (energy > 0)
+        {
+            size_t peak = EnergyResult::peakHour(*row.hourly);
+            // One hour at the peak, so the kWh of that hour are also the average kW
+            output << ", peak ";
+            output.writeFixed((*row.hourly)[peak], 1) << " kW in hour " << peak;
+        }
+        output << "\n";
+    }
+    output << " Total: ";
+    output.writeFixed(total / 1000, 1) << " MWh\n";
+}
+
+#endif
@@ -0,0 +1,306 @@
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include "memory.h"
+
+#ifndef GRID_H
+#define GRID_H
+
+// The grid only stores which type of building is in a cell, 0 is always an empty cell
+typedef uint8_t BuildingId;
+
+// A building that should be put at x/y, an id of 0 removes the building there
+struct Placement
+{
+    int x;
+    int y;
+    BuildingId id;
+};
+
+// A cell that was changed from oldId to newId
+struct CellChange
+{
+    int x;
+    int y;
+    BuildingId oldId;
+    BuildingId newId;
+};
+
+// A square piece of the grid, the grid is split into these so a change only has to copy one of them
+struct GridTile
+{
+    static const int SIZE = 64;
+    BuildingId cells[SIZE * SIZE] = {};
+    // One bit per cell that has a building, a tile is exactly one word wide
+    uint64_t occupied[SIZE] = {};
+    // One bit per row of the tile that has any building in it
+    uint64_t occupiedRows = 0;
+    // The sum of cellHash over all cells. Tiles with different checksums differ, equal ones only most likely don't
+    uint64_t checksum = 0;
+
+    // A random looking number for every building in every cell of a tile, 0 for an empty cell (splitmix64)
+    static uint64_t cellHash(int index, BuildingId id)
+    {
+        if (id == 0)
+            return 0;
+        uint64_t hash = (uint64_t)index * 256 + id + 0x9e3779b97f4a7c15ULL;
+        hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+        return hash ^ (hash >> 31);
+    }
+
+    BuildingId get(int x, int y) const { return this->cells[x * SIZE + y]; }
+    void set(int x, int y, BuildingId id)
+    {
+        // Being a sum, the checksum only has to swap the hash of the one cell
+        this->checksum += cellHash(x * SIZE + y, id) - cellHash(x * SIZE + y, this->cells[x * SIZE + y]);
+        this->cells[x * SIZE + y] = id;
+        uint64_t bit = (uint64_t)1 << y;
+        this->occupied[x] = id != 0 ? (this->occupied[x] | bit) : (this->occupied[x] & ~bit);
+        uint64_t rowBit = (uint64_t)1 << x;
+        this->occupiedRows = this->occupied[x] != 0 ? (this->occupiedRows | rowBit) : (this->occupiedRows & ~rowBit);
+    }
+};
+
+// The index of the lowest set bit, the word must not be 0
+inline int countTrailingZeros(uint64_t word)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(word);
+#else
+    int count = 0;
+    while ((word & 1) == 0)
+    {
+        word >>= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+// All tiles that are next to each other in one row of tiles
+struct GridTileRow
+{
+    CountedVector<std::shared_ptr<const GridTile>, MEMORY_GRID> tiles;
+};
+
+/*
+An immutable version of the grid and its statistics.
+Once a snapshot is published it never changes, so everyone can read from it without locking.
+A change creates a new snapshot, which shares every tile (and every row of tiles) that was not changed
+with the previous one.
+*/
+class GridSnapshot
+{
+public:
+    uint64_t version = 0;
+    int height = 0;
+    int width = 0;
+    CountedVector<std::shared_ptr<const GridTileRow>, MEMORY_GRID> tileRows;
+    // How many buildings of each type are placed, the index is the BuildingId
+    CountedVector<long long, MEMORY_STATISTICS> buildingCounts;
+
+    int getTileRowCount() const { return (this->height + GridTile::SIZE - 1) / GridTile::SIZE; }
+    int getTileColumnCount() const { return (this->width + GridTile::SIZE - 1) / GridTile::SIZE; }
+
+    const GridTile &getTile(int tileX, int tileY) const { return *this->tileRows[tileX]->tiles[tileY]; }
+
+    BuildingId get(int x, int y) const
+    {
+        return this->getTile(x / GridTile::SIZE, y / GridTile::SIZE).get(x % GridTile::SIZE, y % GridTile::SIZE);
+    }
+
+    /*
+    Calls function(x, y, id) for every building, row by row from left to right.
+    Empty tiles are skipped with one test and inside a tile only the set bits of the occupancy
+    words are visited, so this costs about as much as there are buildings and not cells.
+    */
+    template <typename F>
+    void forEachBuilding(F function) const
+    {
+        std::vector<const GridTile *> filledTiles;
+        std::vector<int> filledColumns;
+        for (int tileX = 0; tileX < this->getTileRowCount(); tileX++)
+        {
+            filledTiles.clear();
+            filledColumns.clear();
+            uint64_t usedRows = 0;
+            for (int tileY = 0; tileY < this->getTileColumnCount(); tileY++)
+            {
+                const GridTile &tile = this->getTile(tileX, tileY);
+                if (tile.occupiedRows == 0)
+                    continue;
+                filledTiles.push_back(&tile);
+                filledColumns.push_back(tileY * GridTile::SIZE);
+                usedRows |= tile.occupiedRows;
+            }
+            while (usedRows != 0)
+            {
+                int row = countTrailingZeros(usedRows);
+                usedRows &= usedRows - 1;
+                int x = tileX * GridTile::SIZE + row;
+                for (size_t i = 0; i < filledTiles.size(); i++)
+                {
+                    uint64_t word = filledTiles[i]->occupied[row];
+                    while (word != 0)
+                    {
+                        int column = countTrailingZeros(word);
+                        word &= word - 1;
+                        function(x, filledColumns[i] + column, filledTiles[i]->cells[row * GridTile::SIZE + column]);
+                    }
+                }
+            }
+        }
+    }
+
+    /*
+    Calls function(x, y, oldId, newId) for every cell that is different in the other snapshot of the same size.
+    Rows and tiles that both snapshots share are skipped without looking at them, so comparing two
+    versions of the same site (or a fork with its original) only costs as much as the tiles that changed.
+    Tiles that are not shared but have the same checksum (like a site loaded from a file) are only skipped
+    once their cells turned out to be equal, the checksum can't tell two tiles apart for sure.
+    Only the tiles that are left are compared, eight cells at once and only in rows that have a building.
+    The differences come tile by tile, inside a tile row by row.
+    */
+    template <typename F>
+    void forEachDifference(const GridSnapshot &other, F function) const
+    {
+        const int wordsPerRow = GridTile::SIZE / 8;
+        for (int tileX = 0; tileX < this->getTileRowCount(); tileX++)
+        {
+            if (this->tileRows[tileX] == other.tileRows[tileX])
+                continue;
+            for (int tileY = 0; tileY < this->getTileColumnCount(); tileY++)
+            {
+                const GridTile &oldTile = *this->tileRows[tileX]->tiles[tileY];
+                const GridTile &newTile = *other.tileRows[tileX]->tiles[tileY];
+                if (&oldTile == &newTile)
+                    continue;
+                if (oldTile.checksum == newTile.checksum && std::memcmp(oldTile.cells, newTile.cells, sizeof(oldTile.cells)) == 0)
+                    continue;
+                uint64_t usedRows = oldTile.occupiedRows | newTile.occupiedRows;
+                while (usedRows != 0)
+                {
+                    int row = countTrailingZeros(usedRows);
+                    usedRows &= usedRows - 1;
+                    uint64_t oldWords[wordsPerRow], newWords[wordsPerRow];
+                    std::memcpy(oldWords, &oldTile.cells[row * GridTile::SIZE], GridTile::SIZE);
+                    std::memcpy(newWords, &newTile.cells[row * GridTile::SIZE], GridTile::SIZE);
+                    for (int word = 0; word < wordsPerRow; word++)
+                    {
+                        if (oldWords[word] == newWords[word])
+                            continue;
+                        for (int column = word * 8; column < word * 8 + 8; column++)
+                        {
+                            BuildingId oldId = oldTile.cells[row * GridTile::SIZE + column], newId = newTile.cells[row * GridTile::SIZE + column];
+                            if (oldId != newId)
+                                function(tileX * GridTile::SIZE + row, tileY * GridTile::SIZE + column, oldId, newId);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    /*
+    Creates the first version of a grid where every cell is empty.
+    All tiles point to the same empty tile and all rows to the same row of them, so this costs nothing
+    but a few pointers per row and column, no matter how big the grid is. A tile only gets its own
+    memory when the GridWriter copies it for the first change in it.
+    */
+    static std::shared_ptr<const GridSnapshot> createEmpty(int h, int w, int buildingTypeCount)
+    {
+        static const std::shared_ptr<const GridTile> emptyTile = makeCounted<GridTile, MEMORY_GRID>();
+
+        std::shared_ptr<GridSnapshot> snapshot = makeCounted<GridSnapshot, MEMORY_GRID>();
+        snapshot->height = h;
+        snapshot->width = w;
+        snapshot->buildingCounts.assign(buildingTypeCount + 1, 0);
+        snapshot->buildingCounts[0] = (long long)h * w;
+        std::shared_ptr<GridTileRow> emptyRow = makeCounted<GridTileRow, MEMORY_GRID>();
+        emptyRow->tiles.assign(snapshot->getTileColumnCount(), emptyTile);
+        snapshot->tileRows.assign(snapshot->getTileRowCount(), emptyRow);
+        return snapshot;
+    }
+};
+
+// Gets told about every cell that changes, so derived data can be updated around that cell only
+class GridListener
+{
+public:
+    virtual ~GridListener() {}
+    virtual void onCellChanged(int x, int y, BuildingId oldId, BuildingId newId) = 0;
+};
+
+/*
+Builds the next snapshot from the current one.
+Every tile that gets changed is copied the first time it is touched, all the other tiles stay shared.
+Only one writer may exist at a time, the snapshot it is based on is never modified.
+*/
+class GridWriter
+{
+private:
+    std::shared_ptr<GridSnapshot> next;
+    // The rows and tiles we already copied, so they can be changed in place
+    std::unordered_map<int, GridTileRow *> ownRows;
+    std::unordered_map<long long, GridTile *> ownTiles;
+
+    GridTile &getOwnTile(int tileX, int tileY)
+    {
+        long long key = (long long)tileX * this->next->getTileColumnCount() + tileY;
+        auto found = this->ownTiles.find(key);
+        if (found != this->ownTiles.end())
+            return *found->second;
+
+        auto foundRow = this->ownRows.find(tileX);
+        GridTileRow *row;
+        if (foundRow == this->ownRows.end())
+        {
+            std::shared_ptr<GridTileRow> rowCopy = makeCounted<GridTileRow, MEMORY_GRID>(*this->next->tileRows[tileX]);
+            row = rowCopy.get();
+            this->next->tileRows[tileX] = rowCopy;
+            this->ownRows[tileX] = row;
+        }
+        else
+        {
+            row = foundRow->second;
+        }
+
+        std::shared_ptr<GridTile> tileCopy = makeCounted<GridTile, MEMORY_GRID>(*row->tiles[tileY]);
+        row->tiles[tileY] = tileCopy;
+        this->ownTiles[key] = tileCopy.get();
+        return *tileCopy;
+    }
+
+public:
+    GridWriter(const GridSnapshot &current)
+    {
+        // Only the list of rows is copied here, the rows and tiles are copied when they change
+        this->next = makeCounted<GridSnapshot, MEMORY_GRID>(current);
+        this->next->version = current.version + 1;
+    }
+
+    BuildingId get(int x, int y) { return this->next->get(x, y); }
+
+    void set(int x, int y, BuildingId id)
+    {
+        BuildingId oldId = this->next->get(x, y);
+        if (oldId == id)
+            return;
+        this->getOwnTile(x / GridTile::SIZE, y / GridTile::SIZE).set(x % GridTile::SIZE, y % GridTile::SIZE, id);
+        this->next->buildingCounts[oldId]--;
+        this->next->buildingCounts[id]++;
+    }
+
+    // Gives back the finished snapshot, the writer can't be used afterwards
+    std::shared_ptr<const GridSnapshot> finish()
+    {
+        this->ownRows.clear();
+        this->ownTiles.clear();
+        return std::move(this->next);
+    }
+};
+
+#endif
@@ -0,0 +1,387 @@
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <array>
+#include <algorithm>
+#include "simulationstool.h"
+#include "parallel.h"
+
+#ifndef IMAGEEXPORT_H
+#define IMAGEEXPORT_H
+
+enum IMAGE_FORMAT
+{
+    PPM = 0,
+    PNG = 1
+};
+
+// Collects bits from the lowest to the highest, like deflate wants them
+class BitWriter
+{
+private:
+    uint64_t bits = 0;
+    int count = 0;
+
+public:
+    std::string bytes;
+
+    void write(uint32_t value, int length)
+    {
+        this->bits |= (uint64_t)value << this->count;
+        this->count += length;
+        while (this->count >= 8)
+        {
+            this->bytes += (char)(this->bits & 0xFF);
+            this->bits >>= 8;
+            this->count -= 8;
+        }
+    }
+
+    // Fills the last byte with zeros
+    void align()
+    {
+        if (this->count > 0)
+            this->write(0, 8 - this->count);
+    }
+};
+
+/*
+Writes the grid as an image with one colour per building type and scale x scale pixels per cell.
+The image is written in bands of one row of tiles (64 rows of cells), several bands are encoded at
+the same time and then written in order, so only a few bands are ever in memory.
+
+PNG needs deflate, which is written here instead of pulling in zlib: the rows are palette indices
+(the BuildingId is the index), which are mostly long runs of the same value, so every run becomes
+one literal and matches with distance 1 in the fixed Huffman code. The scaled rows repeat the row
+above, PNG's "up" filter turns them into nothing but zeros. Every band ends byte aligned
+(with an empty stored block, like a zlib sync flush) so the bands can be encoded independently
+and each one becomes its own IDAT chunk. The Adler-32 checksum is computed per run and the
+checksums of the bands are combined at the end.
+*/
+class ImageExporter
+{
+private:
+    static const uint32_t ADLER_BASE = 65521;
+
+    // The colour of every BuildingId
+    std::vector<std::array<uint8_t, 3>> palette;
+    // The fixed Huffman codes of deflate for the literals and lengths, already bit reversed
+    uint32_t literalCodes[288];
+    int literalLengths[288];
+    uint32_t crcTable[256];
+
+    struct Band
+    {
+        std::string data;
+        uint32_t adler = 1;
+        uint64_t length = 0;
+    };
+
+    static uint32_t reverseBits(uint32_t value, int length)
+    {
+        uint32_t reversed = 0;
+        for (int i = 0; i < length; i++)
+        {
+            reversed = (reversed << 1) | (value & 1);
+            value >>= 1;
+        }
+        return reversed;
+    }
+
+    uint32_t crc(const char *data, size_t length, uint32_t crc = 0)
+    {
+        crc = ~crc;
+        for (size_t i = 0; i < length; i++)
+            crc = this->crcTable[(crc ^ (uint8_t)data[i]) & 0xFF] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    // The Adler-32 checksum after adding count times the same byte, without looking at every byte
+    static uint32_t adlerRun(uint32_t adler, uint8_t value, uint64_t count)
+    {
+        uint64_t sum1 = adler & 0xFFFF, sum2 = adler >> 16;
+        uint64_t countMod = count % ADLER_BASE;
+        // sum2 gets sum1 + value, sum1 + 2 * value, ... added, which is count * sum1 + value * count * (count + 1) / 2
+        uint64_t triangle = (count % 2 == 0) ? ((count / 2) % ADLER_BASE) * ((count + 1) % ADLER_BASE) : (count % ADLER_BASE) * (((count + 1) / 2) % ADLER_BASE);
+        sum2 = (sum2 + countMod * sum1 + value * (triangle % ADLER_BASE)) % ADLER_BASE;
+        sum1 = (sum1 + value * countMod) % ADLER_BASE;
+        return (uint32_t)(sum1 | (sum2 << 16));
+    }
+
+    // The checksum of two pieces of data from their own checksums, like adler32_combine of zlib
+    static uint32_t adlerCombine(uint32_t first, uint32_t second, uint64_t secondLength)
+    {
+        uint64_t remainder = secondLength % ADLER_BASE;
+        uint64_t sum1 = first & 0xFFFF;
+        uint64_t sum2 = (remainder * sum1) % ADLER_BASE;
+        sum1 += (second & 0xFFFF) + ADLER_BASE - 1;
+        sum2 += (first >> 16) + (second >> 16) + ADLER_BASE - remainder;
+        sum1 %= ADLER_BASE;
+        sum2 %= ADLER_BASE;
+        return (uint32_t)(sum1 | (sum2 << 16));
+    }
+
+    void writeSymbol(BitWriter &writer, int symbol) { writer.write(this->literalCodes[symbol], this->literalLengths[symbol]); }
+
+    // A run of count bytes with the same value: one literal and then copies of the byte before
+    void writeRun(BitWriter &writer, Band &band, uint8_t value, uint64_t count)
+    {
+        static const int lengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        static const int lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        band.adler = adlerRun(band.adler, value, count);
+        band.length += count;
+
+        this->writeSymbol(writer, value);
+        uint64_t remaining = count - 1;
+        while (remaining >= 3)
+        {
+            int length = (int)std::min<uint64_t>(remaining, 258);
+            // Never leave 1 or 2 bytes behind, they would have to be literals
+            if (remaining - length > 0 && remaining - length < 3)
+                length -= 3;
+            int code = std::upper_bound(lengthBase, lengthBase + 29, length) - lengthBase - 1;
+            this->writeSymbol(writer, 257 + code);
+            writer.write(length - lengthBase[code], lengthExtra[code]);
+            // Distance 1 is distance code 0, five zero bits
+            writer.write(0, 5);
+            remaining -= length;
+        }
+        for (; remaining > 0; remaining--)
+            this->writeSymbol(writer, value);
+    }
+
+    // Encodes the rows of cells [x0, x1) as PNG scanlines in a deflate block that ends byte aligned
+    void encodePngBand(const GridSnapshot &snapshot, int x0, int x1, int scale, Band &band)
+    {
+        BitWriter writer;
+        // Not the last block, fixed Huffman codes
+        writer.write(0, 1);
+        writer.write(1, 2);
+        uint64_t rowLength = (uint64_t)snapshot.width * scale;
+        for (int x = x0; x < x1; x++)
+        {
+            // The first scanline of the cell row: filter "none", then the palette index of every pixel
+            this->writeRun(writer, band, 0, 1);
+            uint8_t runValue = 0;
+            uint64_t runLength = 0;
+            for (int tileY = 0; tileY < snapshot.getTileColumnCount(); tileY++)
+            {
+                const GridTile &tile = snapshot.getTile(x / GridTile::SIZE, tileY);
+                int columns = std::min(GridTile::SIZE, snapshot.width - tileY * GridTile::SIZE);
+                // A row of a tile without any building is one piece of the run of empty cells
+                if (tile.occupied[x % GridTile::SIZE] == 0 && runValue == 0)
+                {
+                    runLength += (uint64_t)columns * scale;
+                    continue;
+                }
+                for (int y = 0; y < columns; y++)
+                {
+                    uint8_t value = tile.get(x % GridTile::SIZE, y);
+                    if (value != runValue && runLength > 0)
+                    {
+                        this->writeRun(writer, band, runValue, runLength);
+                        runLength = 0;
+                    }
+                    runValue = value;
+                    runLength += scale;
+                }
+            }
+            if (runLength > 0)
+                this->writeRun(writer, band, runValue, runLength);
+            // The other scanlines of the cell row are the same, with the filter "up" they are all zero
+            for (int repeat = 1; repeat < scale; repeat++)
+            {
+                this->writeRun(writer, band, 2, 1);
+                this->writeRun(writer, band, 0, rowLength);
+            }
+        }
+        // End of block, then an empty stored block to get back to a whole byte
+        this->writeSymbol(writer, 256);
+        writer.write(0, 3);
+        writer.align();
+        writer.bytes += std::string("\x00\x00\xFF\xFF", 4);
+        band.data.swap(writer.bytes);
+    }
+
+    void encodePpmBand(const GridSnapshot &snapshot, int x0, int x1, int scale, Band &band)
+    {
+        size_t rowBytes = (size_t)snapshot.width * scale * 3;
+        band.data.resize(rowBytes * (x1 - x0) * scale);
+        for (int x = x0; x < x1; x++)
+        {
+            char *row = &band.data[rowBytes * (x - x0) * scale];
+            char *pixel = row;
+            for (int tileY = 0; tileY < snapshot.getTileColumnCount(); tileY++)
+            {
+                const BuildingId *cells = &snapshot.getTile(x / GridTile::SIZE, tileY).cells[(x % GridTile::SIZE) * GridTile::SIZE];
+                int columns = std::min(GridTile::SIZE, snapshot.width - tileY * GridTile::SIZE);
+                for (int y = 0; y < columns; y++)
+                {
+                    const std::array<uint8_t, 3> &colour = this->palette[cells[y]];
+                    for (int repeat = 0; repeat < scale; repeat++)
+                    {
+                        *pixel++ = colour[0];
+                        *pixel++ = colour[1];
+                        *pixel++ = colour[2];
+                    }
+                }
+            }
+            for (int repeat = 1; repeat < scale; repeat++)
+                std::copy(row, row + rowBytes, row + rowBytes * repeat);
+        }
+    }
+
+    void writeChunk(OutputSink &output, const char *type, const std::string &data)
+    {
+        this->writeBigEndian(output, data.size());
+        std::string typeAndData = std::string(type, 4) + data;
+        output << typeAndData;
+        this->writeBigEndian(output, this->crc(typeAndData.data(), typeAndData.size()));
+    }
+
+    void writeBigEndian(OutputSink &output, uint32_t value)
+    {
+        char bytes[4] = {(char)(value >> 24), (char)(value >> 16), (char)(value >> 8), (char)value};
+        output.write(bytes, 4);
+    }
+
+public:
+    ImageExporter(std::vector<Building> &buildingTypes)
+    {
+        // Empty cells are light grey, the plants get the colour of what they make energy from
+        this->palette.push_back({235, 235, 235});
+        for (Building &buildingType : buildingTypes)
+        {
+            switch (buildingType.getEnergySource())
+            {
+            case SOLAR:
+                this->palette.push_back({240, 190, 20});
+                break;
+            case WIND:
+                this->palette.push_back({60, 120, 220});
+                break;
+            case HYDRO:
+                this->palette.push_back({20, 150, 120});
+                break;
+            default:
+                this->palette.push_back({90, 90, 90});
+            }
+        }
+
+        for (int symbol = 0; symbol < 288; symbol++)
+        {
+            uint32_t code;
+            int length;
+            if (symbol < 144)
+                code = 0x30 + symbol, length = 8;
+            else if (symbol < 256)
+                code = 0x190 + symbol - 144, length = 9;
+            else if (symbol < 280)
+                code = symbol - 256, length = 7;
+            else
+                code = 0xC0 + symbol - 280, length = 8;
+            this->literalCodes[symbol] = reverseBits(code, length);
+            this->literalLengths[symbol] = length;
+        }
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; bit++)
+                value = (value & 1) ? 0xEDB88320 ^ (value >> 1) : value >> 1;
+            this->crcTable[i] = value;
+        }
+    }
+
+    // Checks if the image of the snapshot can be written with the scale, before anything is written
+    static bool fits(const GridSnapshot &snapshot, int scale)
+    {
+        uint64_t imageWidth = (uint64_t)snapshot.width * scale, imageHeight = (uint64_t)snapshot.height * scale;
+        return scale >= 1 && imageWidth <= INT32_MAX && imageHeight <= INT32_MAX;
+    }
+
+    // Gives back false if the image would be too large for the format
+    bool exportImage(const GridSnapshot &snapshot, OutputSink &output, IMAGE_FORMAT format, int scale = 1)
+    {
+        if (!fits(snapshot, scale))
+            return false;
+        uint64_t imageWidth = (uint64_t)snapshot.width * scale, imageHeight = (uint64_t)snapshot.height * scale;
+
+        uint32_t adler = 1;
+        if (format == PPM)
+        {
+            output << "P6\n" << imageWidth << " " << imageHeight << "\n255\n";
+        }
+        else
+        {
+            output.write("\x89PNG\r\n\x1A\n", 8);
+            std::string header;
+            for (uint32_t value : {(uint32_t)imageWidth, (uint32_t)imageHeight})
+            {
+                for (int shift = 24; shift >= 0; shift -= 8)
+                    header += (char)(value >> shift);
+            }
+            // 8 bit palette, default compression and filters, no interlacing
+            header += std::string("\x08\x03\x00\x00\x00", 5);
+            this->writeChunk(output, "IHDR", header);
+            std::string colours;
+            for (std::array<uint8_t, 3> &colour : this->palette)
+                colours.append((const char *)colour.data(), 3);
+            this->writeChunk(output, "PLTE", colours);
+            // The zlib header: deflate with a 32K window, no dictionary
+            this->writeChunk(output, "IDAT", std::string("\x78\x01", 2));
+        }
+
+        // Encode as many bands at once as there are threads, then write them in order
+        int bandCount = snapshot.getTileRowCount();
+        int threadCount = getThreadCount();
+        std::vector<Band> bands(threadCount);
+        for (int firstBand = 0; firstBand < bandCount; firstBand += threadCount)
+        {
+            int groupSize = std::min(threadCount, bandCount - firstBand);
+            parallelFor(groupSize, [&](size_t begin, size_t end)
+                        {
+                for (size_t i = begin; i < end; i++)
+                {
+                    int x0 = (firstBand + i) * GridTile::SIZE;
+                    int x1 = std::min(x0 + GridTile::SIZE, snapshot.height);
+                    bands[i] = Band();
+                    if (format == PPM)
+                        this->encodePpmBand(snapshot, x0, x1, scale, bands[i]);
+                    else
+                        this->encodePngBand(snapshot, x0, x1, scale, bands[i]);
+                } });
+            for (int i = 0; i < groupSize; i++)
+            {
+                if (format == PPM)
+                {
+                    output << bands[i].data;
+                }
+                else
+                {
+                    this->writeChunk(output, "IDAT", bands[i].data);
+                    adler = adlerCombine(adler, bands[i].adler, bands[i].length);
+                }
+                // Hand every band to the sink right away, so the memory stays bounded
+                output.flush();
+            }
+        }
+
+        if (format == PNG)
+        {
+            // The last block is an empty one with fixed codes, then the checksum of everything
+            BitWriter writer;
+            writer.write(1, 1);
+            writer.write(1, 2);
+            this->writeSymbol(writer, 256);
+            writer.align();
+            for (int shift = 24; shift >= 0; shift -= 8)
+                writer.bytes += (char)(adler >> shift);
+            this->writeChunk(output, "IDAT", writer.bytes);
+            this->writeChunk(output, "IEND", "");
+        }
+        output.flush();
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,372 @@
+#include <vector>
+#include <array>
+#include <memory>
+#include <cmath>
+#include <mutex>
+#include <algorithm>
+#include "simulationstool.h"
+#include "parallel.h"
+#include "energy.h"
+
+#ifndef INTERACTION_H
+#define INTERACTION_H
+
+struct InteractionSettings
+{
+    // How far (in cells) a building can influence others
+    int radius = 5;
+    // The direction the wind blows to, the wake of a turbine reaches the turbines behind it
+    float windX = 0;
+    float windY = 1;
+    // Loss of a turbine directly behind another one, it gets smaller with the distance
+    float wakeLoss = 0.1f;
+    // How many cells the wake gets wider per cell behind the turbine
+    float wakeSpread = 0.25f;
+    // The direction the shadows of tall buildings fall to
+    float shadowX = -1;
+    float shadowY = 0;
+    // Loss of a solar panel right next to a tall building
+    float shadeLoss = 0.15f;
+    float shadeSpread = 0.5f;
+};
+
+// The loss a single source causes in the cells around it
+struct InteractionKernel
+{
+    int radius = 0;
+    int size = 1;
+    // weights[(ox + radius) * size + (oy + radius)] is the loss at the offset (ox, oy) from the source
+    std::vector<float> weights;
+
+    float get(int ox, int oy) const { return this->weights[(ox + this->radius) * this->size + (oy + this->radius)]; }
+
+    // A cone that starts at the source and opens into the given direction, the loss gets smaller with the distance
+    static InteractionKernel createCone(int radius, float directionX, float directionY, float loss, float spread)
+    {
+        InteractionKernel kernel;
+        kernel.radius = radius;
+        kernel.size = 2 * radius + 1;
+        kernel.weights.assign(kernel.size * kernel.size, 0);
+        float length = std::sqrt(directionX * directionX + directionY * directionY);
+        if (length == 0)
+            return kernel;
+        directionX /= length;
+        directionY /= length;
+        for (int ox = -radius; ox <= radius; ox++)
+        {
+            for (int oy = -radius; oy <= radius; oy++)
+            {
+                // How far the offset is behind the source and how far it is to the side
+                float along = ox * directionX + oy * directionY;
+                float across = std::fabs(ox * directionY - oy * directionX);
+                if (along <= 0 || along > radius || across > 0.5f + along * spread)
+                    continue;
+                kernel.weights[(ox + radius) * kernel.size + (oy + radius)] = loss * (1 - along / (radius + 1));
+            }
+        }
+        return kernel;
+    }
+
+    static InteractionKernel createWake(const InteractionSettings &settings)
+    {
+        return createCone(settings.radius, settings.windX, settings.windY, settings.wakeLoss, settings.wakeSpread);
+    }
+
+    static InteractionKernel createShade(const InteractionSettings &settings)
+    {
+        return createCone(settings.radius, settings.shadowX, settings.shadowY, settings.shadeLoss, settings.shadeSpread);
+    }
+};
+
+// Which buildings cause a loss for which others
+bool causesWake(ENERGY_SOURCE source) { return source == WIND; }
+bool castsShadow(ENERGY_SOURCE source) { return source == WIND || source == HYDRO; }
+
+/*
+The loss of every cell, kept tile by tile like the grid itself.
+Tiles without any loss share one tile of zeros, like the empty tiles of GridSnapshot,
+so only the tiles around turbines and tall buildings take up memory.
+*/
+class LossField
+{
+public:
+    typedef std::array<float, GridTile::SIZE * GridTile::SIZE> Tile;
+
+private:
+    int tileColumns = 0;
+    CountedVector<std::shared_ptr<Tile>, MEMORY_STATISTICS> tiles;
+
+    static const std::shared_ptr<Tile> &getZeroTile()
+    {
+        // allocate_shared value-initializes the array, so it is all zeros
+        static const std::shared_ptr<Tile> zeroTile = makeCounted<Tile, MEMORY_STATISTICS>();
+        return zeroTile;
+    }
+
+public:
+    void reset(int height, int width)
+    {
+        int tileRows = (height + GridTile::SIZE - 1) / GridTile::SIZE;
+        this->tileColumns = (width + GridTile::SIZE - 1) / GridTile::SIZE;
+        this->tiles.assign((size_t)tileRows * this->tileColumns, getZeroTile());
+    }
+
+    float get(int x, int y) const
+    {
+        const Tile &tile = *this->tiles[(size_t)(x / GridTile::SIZE) * this->tileColumns + y / GridTile::SIZE];
+        return tile[(x % GridTile::SIZE) * GridTile::SIZE + y % GridTile::SIZE];
+    }
+
+    // The cells of a tile to write into, row by row. A tile that is still shared gets its own zeros first
+    float *getWritableTile(int tileX, int tileY)
+    {
+        std::shared_ptr<Tile> &tile = this->tiles[(size_t)tileX * this->tileColumns + tileY];
+        if (tile == getZeroTile())
+            tile = makeCounted<Tile, MEMORY_STATISTICS>();
+        return tile->data();
+    }
+
+    // Gives the memory of a tile back, it is all zeros again
+    void clearTile(int tileX, int tileY) { this->tiles[(size_t)tileX * this->tileColumns + tileY] = getZeroTile(); }
+};
+
+/*
+Computes how much of its output every cell loses because of the buildings around it:
+wind turbines lose output behind other turbines (wake) and solar panels lose output in the
+shadow of tall buildings (wind turbines and hydro plants).
+
+The losses of all neighbours are added up, which makes this a linear stencil: the loss field is
+the map of sources convolved with a kernel. The full computation works tile by tile (in parallel),
+every tile copies its sources plus a border of radius cells and then adds one shifted row per
+kernel entry, which the compiler can vectorize.
+Because the model is linear, a single changed cell only has to add or remove its kernel around
+itself, so after a setBuilding only (2 * radius + 1)^2 cells are touched.
+*/
+class InteractionModel : public GridListener
+{
+private:
+    InteractionSettings settings;
+    int height = 0;
+    int width = 0;
+    LossField wakeLoss;
+    LossField shadeLoss;
+    InteractionKernel wakeKernel;
+    InteractionKernel shadeKernel;
+    // The energy source of every BuildingId
+    std::vector<ENERGY_SOURCE> sources;
+    std::mutex lock;
+
+    // Adds the kernel times factor around the cell x/y
+    void scatter(LossField &field, const InteractionKernel &kernel, int x, int y, float factor)
+    {
+        int radius = this->settings.radius;
+        for (int ox = -radius; ox <= radius; ox++)
+        {
+            int targetX = x + ox;
+            if (targetX < 0 || targetX >= this->height)
+                continue;
+            const float *kernelRow = &kernel.weights[(ox + radius) * kernel.size + radius];
+            // The row of the kernel can reach into the tiles left and right of the cell
+            int oy = std::max(-radius, -y);
+            int yEnd = std::min(radius, this->width - 1 - y);
+            while (oy <= yEnd)
+            {
+                int targetY = y + oy;
+                int pieceEnd = std::min(yEnd, (targetY / GridTile::SIZE + 1) * GridTile::SIZE - 1 - y);
+                // Parts of the kernel that are 0 don't need a tile of their own
+                if (std::any_of(kernelRow + oy, kernelRow + pieceEnd + 1, [](float weight)
+                                { return weight != 0; }))
+                {
+                    float *tileRow = field.getWritableTile(targetX / GridTile::SIZE, targetY / GridTile::SIZE) +
+                                     (targetX % GridTile::SIZE) * GridTile::SIZE;
+                    for (int o = oy; o <= pieceEnd; o++)
+                    {
+                        tileRow[(y + o) % GridTile::SIZE] += factor * kernelRow[o];
+                    }
+                }
+                oy = pieceEnd + 1;
+            }
+        }
+    }
+
+    // Computes both loss fields for one tile, the tile is read from the snapshot with a border of radius cells
+    void computeTile(const GridSnapshot &snapshot, int tileX, int tileY, std::vector<float> &wakeSources, std::vector<float> &shadeSources)
+    {
+        int radius = this->settings.radius;
+        int x0 = tileX * GridTile::SIZE, y0 = tileY * GridTile::SIZE;
+        int x1 = std::min(x0 + GridTile::SIZE, this->height), y1 = std::min(y0 + GridTile::SIZE, this->width);
+        int planeSize = GridTile::SIZE + 2 * radius;
+
+        // Copy the sources of the tile and its border into two dense planes, outside the grid stays 0
+        wakeSources.assign(planeSize * planeSize, 0);
+        shadeSources.assign(planeSize * planeSize, 0);
+        bool anyWake = false, anyShade = false;
+        int yBegin = std::max(0, y0 - radius), yEnd = std::min(this->width, y1 + radius);
+        for (int x = std::max(0, x0 - radius); x < std::min(this->height, x1 + radius); x++)
+        {
+            // Read the row piece by piece, one tile at a time
+            for (int y = yBegin; y < yEnd;)
+            {
+                const GridTile &tile = snapshot.getTile(x / GridTile::SIZE, y / GridTile::SIZE);
+                const BuildingId *cells = &tile.cells[(x % GridTile::SIZE) * GridTile::SIZE];
+                int pieceEnd = std::min(yEnd, (y / GridTile::SIZE + 1) * GridTile::SIZE);
+                // Nothing in this piece of the row
+                if (tile.occupied[x % GridTile::SIZE] == 0)
+                {
+                    y = pieceEnd;
+                    continue;
+                }
+                for (; y < pieceEnd; y++)
+                {
+                    BuildingId id = cells[y % GridTile::SIZE];
+                    if (id == 0)
+                        continue;
+                    ENERGY_SOURCE source = this->sources[id];
+                    int index = (x - x0 + radius) * planeSize + (y - y0 + radius);
+                    if (causesWake(source))
+                    {
+                        wakeSources[index] = 1;
+                        anyWake = true;
+                    }
+                    if (castsShadow(source))
+                    {
+                        shadeSources[index] = 1;
+                        anyShade = true;
+                    }
+                }
+            }
+        }
+
+        this->convolveTile(anyWake ? &wakeSources : nullptr, this->wakeKernel, this->wakeLoss, tileX, tileY, x1, y1);
+        this->convolveTile(anyShade ? &shadeSources : nullptr, this->shadeKernel, this->shadeLoss, tileX, tileY, x1, y1);
+    }
+
+    void convolveTile(const std::vector<float> *plane, const InteractionKernel &kernel, LossField &field, int tileX, int tileY, int x1, int y1)
+    {
+        int radius = this->settings.radius;
+        int planeSize = GridTile::SIZE + 2 * radius;
+        int x0 = tileX * GridTile::SIZE, y0 = tileY * GridTile::SIZE;
+        // Nothing around this tile causes any loss
+        if (plane == nullptr)
+        {
+            field.clearTile(tileX, tileY);
+            return;
+        }
+        float *cells = field.getWritableTile(tileX, tileY);
+        std::fill(cells, cells + GridTile::SIZE * GridTile::SIZE, 0.0f);
+
+        for (int ox = -radius; ox <= radius; ox++)
+        {
+            for (int oy = -radius; oy <= radius; oy++)
+            {
+                float weight = kernel.get(ox, oy);
+                if (weight == 0)
+                    continue;
+                // The cell x/y gets the loss of the source at x - ox / y - oy
+                for (int x = x0; x < x1; x++)
+                {
+                    const float *__restrict sourceRow = &(*plane)[(x - x0 - ox + radius) * planeSize + (radius - oy)];
+                    float *__restrict fieldRow = cells + (x - x0) * GridTile::SIZE;
+                    for (int y = 0; y < y1 - y0; y++)
+                    {
+                        fieldRow[y] += weight * sourceRow[y];
+                    }
+                }
+            }
+        }
+    }
+
+    void recompute(const GridSnapshot &snapshot)
+    {
+        this->height = snapshot.height;
+        this->width = snapshot.width;
+        this->wakeKernel = InteractionKernel::createWake(this->settings);
+        this->shadeKernel = InteractionKernel::createShade(this->settings);
+        this->wakeLoss.reset(this->height, this->width);
+        this->shadeLoss.reset(this->height, this->width);
+
+        // Every tile only writes its own cells, so the tiles can be computed in parallel
+        int tileColumns = snapshot.getTileColumnCount();
+        size_t tileCount = (size_t)snapshot.getTileRowCount() * tileColumns;
+        parallelFor(tileCount, [&](size_t begin, size_t end)
+                    {
+            std::vector<float> wakeSources, shadeSources;
+            for (size_t tile = begin; tile < end; tile++)
+            {
+                this->computeTile(snapshot, tile / tileColumns, tile % tileColumns, wakeSources, shadeSources);
+            } });
+    }
+
+public:
+    InteractionModel(InteractionSettings settings = InteractionSettings()) : settings(settings) {}
+
+    // Computes everything for the current grid and keeps it up to date from now on
+    void attach(CapycitySim &simulation)
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->sources.assign(1, NO_SOURCE);
+        for (Building &buildingType : simulation.getBuildingTypes())
+        {
+            this->sources.push_back(buildingType.getEnergySource());
+        }
+        std::shared_ptr<const GridSnapshot> snapshot = simulation.addListener(*this);
+        this->recompute(*snapshot);
+    }
+
+    void detach(CapycitySim &simulation) { simulation.removeListener(*this); }
+
+    // Changing the settings needs a full recomputation
+    void setSettings(InteractionSettings settings, CapycitySim &simulation)
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->settings = settings;
+        this->recompute(*simulation.getSnapshot());
+    }
+
+    InteractionSettings getSettings() { return this->settings; }
+
+    void onCellChanged(int x, int y, BuildingId oldId, BuildingId newId) override
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        float wakeChange = (float)causesWake(this->sources[newId]) - (float)causesWake(this->sources[oldId]);
+        float shadeChange = (float)castsShadow(this->sources[newId]) - (float)castsShadow(this->sources[oldId]);
+        if (wakeChange != 0)
+            this->scatter(this->wakeLoss, this->wakeKernel, x, y, wakeChange);
+        if (shadeChange != 0)
+            this->scatter(this->shadeLoss, this->shadeKernel, x, y, shadeChange);
+    }
+
+    // How much of its output a building of the given source keeps at x/y (1 = everything)
+    float getEfficiency(int x, int y, ENERGY_SOURCE source)
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return this->getEfficiencyUnlocked(x, y, source);
+    }
+
+    float getEfficiencyUnlocked(int x, int y, ENERGY_SOURCE source)
+    {
+        float loss = 0;
+        if (source == WIND)
+            loss = this->wakeLoss.get(x, y);
+        else if (source == SOLAR)
+            loss = this->shadeLoss.get(x, y);
+        // Removing buildings again can leave tiny rounding errors, so clamp
+        return std::min(std::max(1 - loss, 0.0f), 1.0f);
+    }
+
+    // Sets the efficiency of every building in the fleet to what this model computed
+    void applyTo(EnergyFleet &fleet)
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        for (size_t i = 0; i < fleet.solar.size(); i++)
+        {
+            fleet.solar.efficiency[i] = this->getEfficiencyUnlocked(fleet.solar.x[i], fleet.solar.y[i], SOLAR);
+        }
+        for (size_t i = 0; i < fleet.wind.size(); i++)
+        {
+            fleet.wind.efficiency[i] = this->getEfficiencyUnlocked(fleet.wind.x[i], fleet.wind.y[i], WIND);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,429 @@
+#include <vector>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+#include <condition_variable>
+#include "simulationstool.h"
+#include "snapshotfile.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+/*
+Keeps every change of the grid on disk, so nothing is lost if the program crashes or exits.
+Two files are used: <path>.log gets every changed cell appended to it, <path>.snapshot holds all
+buildings at some point of the log, so the log can be cut off there and doesn't grow forever.
+
+Changes are only put into a buffer while the grid is locked. A background thread takes everything
+that piled up, writes it as one group and syncs it to the disk, so many changes share one sync
+and the menu never waits for the disk. Every now and then the same thread writes a new snapshot
+from a pinned version of the grid, which doesn't need any lock either.
+
+Every group of the log is:  first sequence (8) | count (4) | count * (x (4) | y (4) | id (1)) | checksum (4)
+The snapshot is a SnapshotFile that also stores the sequence number it was taken at.
+All numbers are little endian. A group that was only partly written when the program died has a
+wrong checksum, recovery stops in front of it.
+*/
+class Journal : public GridListener
+{
+private:
+    // One changed cell, every record stores the new building so replaying it twice does no harm
+    struct Record
+    {
+        uint32_t x;
+        uint32_t y;
+        BuildingId id;
+    };
+
+    static const int RECORD_SIZE = 9;
+
+    std::string path;
+    CapycitySim *simulation = nullptr;
+
+    // Everything below is guarded by the lock
+    std::mutex lock;
+    std::condition_variable wakeUp;
+    CountedVector<Record, MEMORY_JOURNAL> pending;
+    // The sequence number of the last change we were told about, the first change is 1
+    uint64_t sequence = 0;
+    // The sequence number the current snapshot file was taken at
+    uint64_t snapshotSequence = 0;
+    bool stopping = false;
+    // The background thread can't print, so it leaves the last thing that went wrong here
+    std::string error;
+    std::thread writer;
+
+    // A new snapshot is written after this many changes or this much time with at least one change
+    uint64_t snapshotChanges = 100000;
+    std::chrono::seconds snapshotInterval{30};
+
+#ifdef __linux__
+    int logFile = -1;
+#else
+    FILE *logFile = nullptr;
+#endif
+
+    static void putNumber(std::string &buffer, uint64_t value, int bytes)
+    {
+        for (int i = 0; i < bytes; i++)
+            buffer += (char)((value >> (8 * i)) & 0xff);
+    }
+
+    static bool getNumber(const std::string &buffer, size_t &position, uint64_t &value, int bytes)
+    {
+        if (position + bytes > buffer.size())
+            return false;
+        value = 0;
+        for (int i = 0; i < bytes; i++)
+            value |= (uint64_t)(unsigned char)buffer[position + i] << (8 * i);
+        position += bytes;
+        return true;
+    }
+
+    static void putRecord(std::string &buffer, const Record &record)
+    {
+        putNumber(buffer, record.x, 4);
+        putNumber(buffer, record.y, 4);
+        putNumber(buffer, record.id, 1);
+    }
+
+    static bool getRecord(const std::string &buffer, size_t &position, Record &record)
+    {
+        uint64_t x, y, id;
+        if (!getNumber(buffer, position, x, 4) || !getNumber(buffer, position, y, 4) || !getNumber(buffer, position, id, 1))
+            return false;
+        record = Record{(uint32_t)x, (uint32_t)y, (BuildingId)id};
+        return true;
+    }
+
+    static bool readFile(const std::string &path, std::string &contents)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return false;
+        contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    bool openLog(bool truncate)
+    {
+        std::string logPath = this->path + ".log";
+#ifdef __linux__
+        this->logFile = ::open(logPath.c_str(), O_WRONLY | O_CREAT | O_APPEND | (truncate ? O_TRUNC : 0), 0644);
+        return this->logFile != -1;
+#else
+        this->logFile = fopen(logPath.c_str(), truncate ? "wb" : "ab");
+        return this->logFile != nullptr;
+#endif
+    }
+
+    void closeLog()
+    {
+#ifdef __linux__
+        if (this->logFile != -1)
+            ::close(this->logFile);
+        this->logFile = -1;
+#else
+        if (this->logFile != nullptr)
+            fclose(this->logFile);
+        this->logFile = nullptr;
+#endif
+    }
+
+    // Writes everything and makes sure it reached the disk, gives back false if it didn't
+    static bool writeAndSync(
+#ifdef __linux__
+        int file,
+#else
+        FILE *file,
+#endif
+        const std::string &data)
+    {
+#ifdef __linux__
+        const char *next = data.data();
+        size_t length = data.size();
+        while (length > 0)
+        {
+            ssize_t written = ::write(file, next, length);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            next += written;
+            length -= written;
+        }
+        return fdatasync(file) == 0;
+#else
+        if (fwrite(data.data(), 1, data.size(), file) != data.size())
+            return false;
+        return fflush(file) == 0;
+#endif
+    }
+
+#ifdef __linux__
+    // Makes a rename in the directory of the file reach the disk, until then it can get lost in a crash
+    static bool syncDirectory(const std::string &filePath)
+    {
+        size_t slash = filePath.find_last_of('/');
+        std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : filePath.substr(0, slash));
+        int file = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+        if (file == -1)
+            return false;
+        bool synced = fsync(file) == 0;
+        ::close(file);
+        return synced;
+    }
+#endif
+
+    void writeGroup(uint64_t firstSequence, const CountedVector<Record, MEMORY_JOURNAL> &records, std::string &buffer)
+    {
+        buffer.clear();
+        putNumber(buffer, firstSequence, 8);
+        putNumber(buffer, records.size(), 4);
+        for (const Record &record : records)
+            putRecord(buffer, record);
+        putNumber(buffer, fnvChecksum(buffer.data(), buffer.size()), 4);
+        if (!writeAndSync(this->logFile, buffer))
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->error = "Could not write to " + this->path + ".log";
+        }
+    }
+
+    void run()
+    {
+        CountedVector<Record, MEMORY_JOURNAL> group;
+        std::string buffer;
+        std::chrono::steady_clock::time_point lastSnapshot = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> guard(this->lock);
+        while (true)
+        {
+            this->wakeUp.wait_for(guard, this->snapshotInterval, [&]
+                                  { return this->stopping || !this->pending.empty(); });
+
+            // Everything that came in while we were writing the last group goes out as the next one
+            if (!this->pending.empty())
+            {
+                group.swap(this->pending);
+                uint64_t firstSequence = this->sequence - group.size() + 1;
+                guard.unlock();
+                this->writeGroup(firstSequence, group, buffer);
+                group.clear();
+                guard.lock();
+            }
+
+            uint64_t unsaved = this->sequence - this->snapshotSequence;
+            bool due = unsaved >= this->snapshotChanges || (unsaved > 0 && std::chrono::steady_clock::now() - lastSnapshot >= this->snapshotInterval);
+            if (due)
+            {
+                // The sequence is read before the grid, so the snapshot has at least every change up to it.
+                // It may already have some of the changes after it, replaying those again changes nothing
+                uint64_t snapshotSequence = this->sequence;
+                guard.unlock();
+                std::shared_ptr<const GridSnapshot> snapshot = this->simulation->getSnapshot();
+                bool saved = writeSnapshot(this->path + ".snapshot", *snapshot, snapshotSequence);
+                guard.lock();
+                lastSnapshot = std::chrono::steady_clock::now();
+                if (saved)
+                {
+                    // Only this thread writes the log and it never wrote anything newer than the snapshot,
+                    // so the whole log can go. Pending changes are written to the new one
+                    this->snapshotSequence = snapshotSequence;
+                    this->closeLog();
+                    if (!this->openLog(true))
+                        this->error = "Could not open " + this->path + ".log";
+                }
+                else
+                {
+                    this->error = "Could not write " + this->path + ".snapshot";
+                }
+            }
+
+            if (this->stopping && this->pending.empty())
+                return;
+        }
+    }
+
+    // Installs the snapshot as the grid and reads every complete group of the log behind it, in the order they have to be applied
+    bool recover(CapycitySim &simulation, std::vector<Placement> &placements, OutputSink &output)
+    {
+        std::string contents;
+        if (readFile(this->path + ".snapshot", contents) && !contents.empty())
+        {
+            std::shared_ptr<const GridSnapshot> snapshot = SnapshotFile::decode(contents, simulation.getBuildingTypes().size(), this->snapshotSequence);
+            if (snapshot == nullptr)
+            {
+                output << "[!] " << this->path << ".snapshot is damaged\n";
+                return false;
+            }
+            if (!simulation.restore(snapshot))
+            {
+                output << "[!] The journal " << this->path << " is for a " << snapshot->height << "x" << snapshot->width << " building space\n";
+                return false;
+            }
+        }
+        this->sequence = this->snapshotSequence;
+
+        if (!readFile(this->path + ".log", contents))
+            return true;
+        size_t position = 0;
+        while (position < contents.size())
+        {
+            size_t groupStart = position;
+            uint64_t firstSequence, count, storedChecksum;
+            if (!getNumber(contents, position, firstSequence, 8) || !getNumber(contents, position, count, 4) || position + count * RECORD_SIZE + 4 > contents.size())
+                break;
+            size_t recordStart = position;
+            position += count * RECORD_SIZE;
+            size_t groupEnd = position;
+            if (!getNumber(contents, position, storedChecksum, 4) || storedChecksum != fnvChecksum(contents.data() + groupStart, groupEnd - groupStart))
+                break;
+
+            position = recordStart;
+            for (uint64_t i = 0; i < count; i++)
+            {
+                Record record{};
+                getRecord(contents, position, record);
+                // Groups from before the snapshot can still be in the log if we died right after writing it
+                if (firstSequence + i <= this->snapshotSequence)
+                    continue;
+                if (record.x >= (uint32_t)simulation.getHeight() || record.y >= (uint32_t)simulation.getWidth())
+                    continue;
+                placements.push_back(Placement{(int)record.x, (int)record.y, record.id});
+            }
+            position += 4;
+            this->sequence = std::max(this->sequence, firstSequence + count - 1);
+        }
+        if (position < contents.size())
+            output << "[!] Ignored an incomplete end of " << this->path << ".log\n";
+        return true;
+    }
+
+public:
+    ~Journal() { this->close(); }
+
+    // Writes the snapshot to a temporary file first, so there is always one complete snapshot on the disk
+    static bool writeSnapshot(const std::string &snapshotPath, const GridSnapshot &snapshot, uint64_t snapshotSequence = 0)
+    {
+        std::string buffer;
+        SnapshotFile::encode(snapshot, snapshotSequence, buffer);
+
+        std::string temporaryPath = snapshotPath + ".tmp";
+#ifdef __linux__
+        int file = ::open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (file == -1)
+            return false;
+        bool written = writeAndSync(file, buffer);
+        ::close(file);
+        // The log is cut off once we return true, so the new name has to be on the disk before that
+        return written && std::rename(temporaryPath.c_str(), snapshotPath.c_str()) == 0 && syncDirectory(snapshotPath);
+#else
+        FILE *file = fopen(temporaryPath.c_str(), "wb");
+        if (file == nullptr)
+            return false;
+        bool written = writeAndSync(file, buffer);
+        fclose(file);
+        std::remove(snapshotPath.c_str());
+        return written && std::rename(temporaryPath.c_str(), snapshotPath.c_str()) == 0;
+#endif
+    }
+
+    // Reads a snapshot file the journal wrote into a grid of its own, gives back nullptr if it can't be read
+    static std::shared_ptr<const GridSnapshot> loadSnapshot(const std::string &path, int buildingTypeCount, OutputSink &output)
+    {
+        std::string contents;
+        uint64_t snapshotSequence;
+        if (!readFile(path, contents))
+        {
+            output << "[!] Could not open " << path << "\n";
+            return nullptr;
+        }
+        std::shared_ptr<const GridSnapshot> snapshot = SnapshotFile::decode(contents, buildingTypeCount, snapshotSequence);
+        if (snapshot == nullptr)
+            output << "[!] " << path << " is damaged\n";
+        return snapshot;
+    }
+
+    /*
+    Puts the grid back to how it was when the program ended and logs every change from now on.
+    The snapshot becomes the grid as it is, only the changes of the log are placed one by one.
+    Has to be called before any other listener or validator is attached, so they see the recovered grid
+    and the rules can't reject what was already placed.
+    */
+    bool open(const std::string &path, CapycitySim &simulation, OutputSink &output)
+    {
+        this->path = path;
+        this->simulation = &simulation;
+        std::vector<Placement> placements;
+        if (!this->recover(simulation, placements, output))
+            return false;
+        if (!placements.empty())
+        {
+            NullOutputSink ignored;
+            simulation.setBuildings(placements, ignored);
+        }
+
+        // The recovered grid becomes the new snapshot, so the old log can go
+        this->snapshotSequence = this->sequence;
+        std::shared_ptr<const GridSnapshot> snapshot = simulation.addListener(*this);
+        if (!writeSnapshot(this->path + ".snapshot", *snapshot, this->snapshotSequence) || !this->openLog(true))
+        {
+            simulation.removeListener(*this);
+            output << "[!] Could not write the journal " << path << "\n";
+            return false;
+        }
+        this->writer = std::thread(&Journal::run, this);
+        long long buildings = (long long)snapshot->height * snapshot->width - snapshot->buildingCounts[0];
+        if (buildings > 0)
+            output << "[*] Recovered " << buildings << " buildings from " << path << "\n";
+        return true;
+    }
+
+    // Writes everything that is still pending and stops the background thread
+    void close()
+    {
+        if (!this->writer.joinable())
+            return;
+        this->simulation->removeListener(*this);
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->stopping = true;
+        }
+        this->wakeUp.notify_one();
+        this->writer.join();
+        this->closeLog();
+    }
+
+    // Gives back what went wrong in the background since the last call, empty if nothing did
+    std::string takeError()
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        std::string lastError;
+        lastError.swap(this->error);
+        return lastError;
+    }
+
+    void onCellChanged(int x, int y, BuildingId, BuildingId newId) override
+    {
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->pending.push_back(Record{(uint32_t)x, (uint32_t)y, newId});
+            this->sequence++;
+        }
+        this->wakeUp.notify_one();
+    }
+};
+
+#endif
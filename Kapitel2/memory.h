@@ -0,0 +1,142 @@
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstddef>
+
+#ifndef MEMORY_H
+#define MEMORY_H
+
+// The parts of the simulation whose memory is counted
+enum MEMORY_AREA
+{
+    // The tiles, rows of tiles and snapshots of every site and variant
+    MEMORY_GRID = 0,
+    // The building counts and the indexes that are kept up to date on every change (clusters, interactions, overview)
+    MEMORY_STATISTICS = 1,
+    // The buffers the board and every other output is rendered into before it is written
+    MEMORY_OUTPUT = 2,
+    // The changes that wait for the journal thread
+    MEMORY_JOURNAL = 3,
+    MEMORY_AREA_COUNT = 4
+};
+
+const char *memoryAreaNames[] = {
+    "Grid",
+    "Statistics",
+    "Output",
+    "Journal",
+};
+
+// What an area uses right now and the most it ever used
+struct MemoryUsage
+{
+    long long bytes = 0;
+    long long peakBytes = 0;
+    // Allocations since the start and how many of them are not freed yet
+    long long allocations = 0;
+    long long liveAllocations = 0;
+};
+
+/*
+Counts the memory of one area. Every allocation of the area goes through a CountingAllocator,
+which adds to the counters here, so the numbers are what was really allocated and not an estimate.
+Tiles are shared between snapshots and variants, they are only counted once.
+The counters are atomic because a snapshot is freed by whatever thread lets go of it last.
+*/
+class MemoryAccount
+{
+private:
+    std::atomic<long long> bytes{0};
+    std::atomic<long long> peakBytes{0};
+    std::atomic<long long> allocations{0};
+    std::atomic<long long> frees{0};
+
+public:
+    static MemoryAccount &get(MEMORY_AREA area)
+    {
+        // Never destroyed, so whatever is freed at exit can still be counted
+        static MemoryAccount *accounts = new MemoryAccount[MEMORY_AREA_COUNT];
+        return accounts[area];
+    }
+
+    void allocated(size_t size)
+    {
+        long long now = this->bytes.fetch_add(size, std::memory_order_relaxed) + (long long)size;
+        this->allocations.fetch_add(1, std::memory_order_relaxed);
+        long long peak = this->peakBytes.load(std::memory_order_relaxed);
+        while (now > peak && !this->peakBytes.compare_exchange_weak(peak, now, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void freed(size_t size)
+    {
+        this->bytes.fetch_sub(size, std::memory_order_relaxed);
+        this->frees.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    MemoryUsage getUsage()
+    {
+        MemoryUsage usage;
+        usage.bytes = this->bytes.load(std::memory_order_relaxed);
+        usage.peakBytes = this->peakBytes.load(std::memory_order_relaxed);
+        usage.allocations = this->allocations.load(std::memory_order_relaxed);
+        usage.liveAllocations = usage.allocations - this->frees.load(std::memory_order_relaxed);
+        return usage;
+    }
+
+    // Starts the high-water mark again from what is used right now, to measure a single operation
+    void resetPeak() { this->peakBytes.store(this->bytes.load(std::memory_order_relaxed), std::memory_order_relaxed); }
+};
+
+// A drop-in for std::allocator that counts everything it hands out for the area
+template <typename T, MEMORY_AREA AREA>
+class CountingAllocator
+{
+public:
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind
+    {
+        typedef CountingAllocator<U, AREA> other;
+    };
+
+    CountingAllocator() noexcept {}
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U, AREA> &) noexcept {}
+
+    T *allocate(size_t count)
+    {
+        T *memory = std::allocator<T>().allocate(count);
+        MemoryAccount::get(AREA).allocated(count * sizeof(T));
+        return memory;
+    }
+
+    void deallocate(T *memory, size_t count) noexcept
+    {
+        MemoryAccount::get(AREA).freed(count * sizeof(T));
+        std::allocator<T>().deallocate(memory, count);
+    }
+
+    template <typename U>
+    bool operator==(const CountingAllocator<U, AREA> &) const noexcept { return true; }
+    template <typename U>
+    bool operator!=(const CountingAllocator<U, AREA> &) const noexcept { return false; }
+};
+
+template <typename T, MEMORY_AREA AREA>
+using CountedVector = std::vector<T, CountingAllocator<T, AREA>>;
+
+// The render buffers, a std::string whose memory is counted as output
+typedef std::basic_string<char, std::char_traits<char>, CountingAllocator<char, MEMORY_OUTPUT>> OutputBuffer;
+
+// Like std::make_shared, the object and its reference count are counted for the area
+template <typename T, MEMORY_AREA AREA, typename... Args>
+std::shared_ptr<T> makeCounted(Args &&...args)
+{
+    return std::allocate_shared<T>(CountingAllocator<T, AREA>(), std::forward<Args>(args)...);
+}
+
+#endif
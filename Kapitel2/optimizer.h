@@ -0,0 +1,446 @@
+#include <vector>
+#include <map>
+#include <string>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <algorithm>
+#include "simulationstool.h"
+#include "energy.h"
+#include "interaction.h"
+#include "parallel.h"
+#include "rules.h"
+
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+struct OptimizerSettings
+{
+    // How much the new buildings may cost in total
+    Cents budget = 10000;
+    // The maximum amount of a material (by name) the new buildings may need, missing materials are unlimited
+    std::map<std::string, long long> materialLimits;
+    uint64_t seed = 1;
+    // In seconds, checked after every epoch
+    double timeLimit = 5;
+    // Stops after this many epochs, 0 = only the time limit counts.
+    // The result only depends on the seed and the number of epochs, so a run can be repeated with maxEpochs = epochs
+    int maxEpochs = 0;
+    // Moves every chain makes per epoch
+    long long epochIterations = 20000;
+    // Independent annealing chains, they run in parallel
+    int chains = 8;
+    // Epochs from hot to cold, afterwards every chain starts again from its best layout
+    int epochsPerCycle = 40;
+    InteractionSettings interactions;
+    WeatherProfile weather = WeatherProfile::createDefault();
+    // The spacing and water rules the new buildings have to follow, nullptr if there are none
+    PlacementRules *rules = nullptr;
+};
+
+struct OptimizerResult
+{
+    // The buildings to add to the site
+    std::vector<Placement> placements;
+    // Estimated output of the whole site in kWh per year
+    double energy = 0;
+    // What the new buildings cost
+    Cents cost = 0;
+    int epochs = 0;
+    long long iterations = 0;
+};
+
+// Everything about the problem that all chains share and never change
+struct OptimizerProblem
+{
+    int height, width;
+    // The site before the search, the buildings on it stay where they are
+    std::shared_ptr<const GridSnapshot> start;
+    // Per BuildingId: yearly output without losses, price, energy source and needed materials
+    std::vector<double> yield;
+    std::vector<Cents> price;
+    std::vector<ENERGY_SOURCE> sources;
+    std::vector<std::vector<long long>> materials;
+    std::vector<long long> materialLimits;
+    Cents budget;
+    InteractionKernel wakeKernel;
+    InteractionKernel shadeKernel;
+    std::vector<PlacementRule> rules;
+    CellBitmap water;
+};
+
+/*
+One simulated annealing chain. It keeps its own version of the grid together with the wake and shade
+loss fields, so a move only needs to look at the cells within the interaction radius to know how
+much the output changes. The grid shares every tile the chain didn't change with the site and the
+loss fields only have tiles where a building casts a loss, so a chain costs memory for what it
+changes and not for the size of the site.
+*/
+class AnnealingChain
+{
+private:
+    const OptimizerProblem &problem;
+    std::mt19937_64 random;
+    std::unique_ptr<GridWriter> cells;
+    LossField wakeLoss, shadeLoss;
+    std::vector<long long> materialUsage;
+    Cents cost = 0;
+    double score = 0;
+
+    static double efficiency(float loss) { return std::min(std::max(1.0 - loss, 0.0), 1.0); }
+
+    LossField &lossFieldFor(ENERGY_SOURCE source) { return source == WIND ? this->wakeLoss : this->shadeLoss; }
+
+    // What the building with the given id at x/y produces with the current losses
+    double contribution(int x, int y, BuildingId id)
+    {
+        ENERGY_SOURCE source = this->problem.sources[id];
+        if (source == WIND || source == SOLAR)
+            return this->problem.yield[id] * efficiency(this->lossFieldFor(source).get(x, y));
+        return this->problem.yield[id];
+    }
+
+    // How the output of the receivers around x/y changes if the kernel is added there factor times (1 or -1)
+    double neighbourDelta(int x, int y, const InteractionKernel &kernel, LossField &field, ENERGY_SOURCE receiver, float factor)
+    {
+        double delta = 0;
+        int radius = kernel.radius;
+        for (int ox = -radius; ox <= radius; ox++)
+        {
+            int nx = x + ox;
+            if (nx < 0 || nx >= this->problem.height)
+                continue;
+            for (int oy = -radius; oy <= radius; oy++)
+            {
+                int ny = y + oy;
+                float weight = kernel.get(ox, oy);
+                if (weight == 0 || ny < 0 || ny >= this->problem.width)
+                    continue;
+                BuildingId neighbour = this->cells->get(nx, ny);
+                if (neighbour == 0 || this->problem.sources[neighbour] != receiver)
+                    continue;
+                float loss = field.get(nx, ny);
+                delta += this->problem.yield[neighbour] * (efficiency(loss + factor * weight) - efficiency(loss));
+            }
+        }
+        return delta;
+    }
+
+    void scatter(int x, int y, const InteractionKernel &kernel, LossField &field, float factor)
+    {
+        int radius = kernel.radius;
+        for (int ox = -radius; ox <= radius; ox++)
+        {
+            int nx = x + ox;
+            if (nx < 0 || nx >= this->problem.height)
+                continue;
+            for (int oy = -radius; oy <= radius; oy++)
+            {
+                int ny = y + oy;
+                float weight = kernel.get(ox, oy);
+                // Adding nothing would still give the cell a tile of its own
+                if (weight == 0 || ny < 0 || ny >= this->problem.width)
+                    continue;
+                float *tile = field.getWritableTile(nx / GridTile::SIZE, ny / GridTile::SIZE);
+                tile[(nx % GridTile::SIZE) * GridTile::SIZE + ny % GridTile::SIZE] += factor * weight;
+            }
+        }
+    }
+
+    // The change of the score if the building id is added (factor 1) or removed (factor -1) at x/y
+    double changeDelta(int x, int y, BuildingId id, float factor)
+    {
+        ENERGY_SOURCE source = this->problem.sources[id];
+        double delta = factor * this->contribution(x, y, id);
+        if (causesWake(source))
+            delta += this->neighbourDelta(x, y, this->problem.wakeKernel, this->wakeLoss, WIND, factor);
+        if (castsShadow(source))
+            delta += this->neighbourDelta(x, y, this->problem.shadeKernel, this->shadeLoss, SOLAR, factor);
+        return delta;
+    }
+
+    void apply(int x, int y, BuildingId id, float factor, double delta)
+    {
+        ENERGY_SOURCE source = this->problem.sources[id];
+        this->cells->set(x, y, factor > 0 ? id : 0);
+        if (causesWake(source))
+            this->scatter(x, y, this->problem.wakeKernel, this->wakeLoss, factor);
+        if (castsShadow(source))
+            this->scatter(x, y, this->problem.shadeKernel, this->shadeLoss, factor);
+        this->cost += factor > 0 ? this->problem.price[id] : -this->problem.price[id];
+        for (size_t i = 0; i < this->materialUsage.size(); i++)
+        {
+            this->materialUsage[i] += (long long)factor * this->problem.materials[id][i];
+        }
+        this->score += delta;
+    }
+
+    bool fitsLimits(BuildingId id)
+    {
+        if (this->cost + this->problem.price[id] > this->problem.budget)
+            return false;
+        for (size_t i = 0; i < this->materialUsage.size(); i++)
+        {
+            if (this->problem.materialLimits[i] >= 0 && this->materialUsage[i] + this->problem.materials[id][i] > this->problem.materialLimits[i])
+                return false;
+        }
+        return true;
+    }
+
+    // The same checks as PlacementRules::allows, but against the layout of this chain
+    bool followsRules(int x, int y, BuildingId id)
+    {
+        for (const PlacementRule &rule : this->problem.rules)
+        {
+            if (rule.kind == NEEDS_WATER && rule.first == id && !this->problem.water.get(x, y))
+                return false;
+            if (rule.kind != MIN_SPACING || (rule.first != id && rule.second != id))
+                continue;
+            BuildingId other = rule.first == id ? rule.second : rule.first;
+            int reach = rule.distance - 1;
+            for (int nx = std::max(0, x - reach); nx <= std::min(this->problem.height - 1, x + reach); nx++)
+            {
+                for (int ny = std::max(0, y - reach); ny <= std::min(this->problem.width - 1, y + reach); ny++)
+                {
+                    if (this->cells->get(nx, ny) == other)
+                        return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool accept(double delta, double temperature)
+    {
+        if (delta >= 0)
+            return true;
+        if (temperature <= 0)
+            return false;
+        return std::uniform_real_distribution<double>(0, 1)(this->random) < std::exp(delta / temperature);
+    }
+
+public:
+    std::shared_ptr<const GridSnapshot> bestLayout;
+    double bestScore = 0;
+    Cents bestCost = 0;
+
+    AnnealingChain(const OptimizerProblem &problem, uint64_t seed) : problem(problem), random(seed)
+    {
+        this->bestLayout = problem.start;
+        this->reset(problem.start);
+        this->bestScore = this->score;
+        this->bestCost = this->cost;
+    }
+
+    // Starts again from the given layout, the losses and the score are computed from scratch
+    void reset(std::shared_ptr<const GridSnapshot> layout)
+    {
+        this->cells.reset(new GridWriter(*GridSnapshot::createEmpty(this->problem.height, this->problem.width, this->problem.yield.size() - 1)));
+        this->wakeLoss.reset(this->problem.height, this->problem.width);
+        this->shadeLoss.reset(this->problem.height, this->problem.width);
+        this->materialUsage.assign(this->problem.materialLimits.size(), 0);
+        this->cost = 0;
+        this->score = 0;
+        // Add the buildings one after the other, this gives the exact score with the normal deltas
+        layout->forEachBuilding([&](int x, int y, BuildingId id)
+                                {
+            double delta = this->changeDelta(x, y, id, 1);
+            this->apply(x, y, id, 1, delta);
+            // The buildings that were already on the site don't count against the budget
+            if (this->problem.start->get(x, y) != 0)
+            {
+                this->cost -= this->problem.price[id];
+                for (size_t m = 0; m < this->materialUsage.size(); m++)
+                    this->materialUsage[m] -= this->problem.materials[id][m];
+            } });
+        // The grid we added them to has the same cells as the layout, but the layout shares its tiles
+        this->cells.reset(new GridWriter(*layout));
+    }
+
+    void runEpoch(long long iterations, double temperature)
+    {
+        int typeCount = this->problem.yield.size() - 1;
+        for (long long iteration = 0; iteration < iterations; iteration++)
+        {
+            int x = std::uniform_int_distribution<int>(0, this->problem.height - 1)(this->random);
+            int y = std::uniform_int_distribution<int>(0, this->problem.width - 1)(this->random);
+            // The buildings that were there before stay where they are
+            if (this->problem.start->get(x, y) != 0)
+                continue;
+            BuildingId current = this->cells->get(x, y);
+            BuildingId next = std::uniform_int_distribution<int>(0, typeCount)(this->random);
+            if (next == current)
+                continue;
+
+            // Every move is: remove what is there (if anything), then add the new building (if any)
+            double delta = 0;
+            if (current != 0)
+            {
+                double removeDelta = this->changeDelta(x, y, current, -1);
+                this->apply(x, y, current, -1, removeDelta);
+                delta += removeDelta;
+            }
+            if (next != 0 && this->fitsLimits(next) && this->followsRules(x, y, next))
+            {
+                double addDelta = this->changeDelta(x, y, next, 1);
+                if (this->accept(delta + addDelta, temperature))
+                {
+                    this->apply(x, y, next, 1, addDelta);
+                    continue;
+                }
+            }
+            else if (next == 0 && this->accept(delta, temperature))
+            {
+                continue;
+            }
+            // Rejected, put the old building back
+            if (current != 0)
+                this->apply(x, y, current, 1, -delta);
+        }
+
+        if (this->score > this->bestScore)
+        {
+            this->bestScore = this->score;
+            this->bestCost = this->cost;
+            // The best layout keeps the tiles, the chain copies a tile again before it changes it
+            this->bestLayout = this->cells->finish();
+            this->cells.reset(new GridWriter(*this->bestLayout));
+        }
+    }
+};
+
+/*
+Searches for buildings to add to a site that give as much energy as possible without going over
+the budget or the material limits, and only where the placement rules allow them. Several annealing
+chains run in parallel, every chain has its own random generator that is derived from the seed, so
+the result only depends on the seed and on how many epochs were run.
+*/
+class LayoutOptimizer
+{
+public:
+    OptimizerResult optimize(CapycitySim &simulation, const OptimizerSettings &settings)
+    {
+        std::shared_ptr<const GridSnapshot> snapshot = simulation.getSnapshot();
+        std::vector<Building> &buildingTypes = simulation.getBuildingTypes();
+
+        OptimizerProblem problem;
+        problem.height = snapshot->height;
+        problem.width = snapshot->width;
+        problem.budget = settings.budget;
+        problem.wakeKernel = InteractionKernel::createWake(settings.interactions);
+        problem.shadeKernel = InteractionKernel::createShade(settings.interactions);
+        problem.start = snapshot;
+        // Without rules the water bitmap stays empty and is never looked at
+        if (settings.rules != nullptr)
+        {
+            problem.rules = settings.rules->getRules();
+            problem.water = settings.rules->getWater();
+        }
+
+        // The materials get an index, so the chains can count them in a plain vector
+        std::vector<std::string> materialNames;
+        for (Building &buildingType : buildingTypes)
+        {
+            for (Material &material : buildingType.getNecessaryMaterials())
+            {
+                if (std::find(materialNames.begin(), materialNames.end(), material.getName()) == materialNames.end())
+                    materialNames.push_back(material.getName());
+            }
+        }
+        for (std::string &name : materialNames)
+        {
+            auto limit = settings.materialLimits.find(name);
+            problem.materialLimits.push_back(limit == settings.materialLimits.end() ? -1 : limit->second);
+        }
+
+        // Simulate one building of every type to know how much it produces without any losses
+        EnergyFleet fleet;
+        for (size_t i = 0; i < buildingTypes.size(); i++)
+            fleet.add(0, 0, buildingTypes[i]);
+        EnergyResult yields = EnergySimulation().run(fleet, settings.weather);
+        size_t solarIndex = 0, windIndex = 0, hydroIndex = 0;
+
+        problem.yield.push_back(0);
+        problem.price.push_back(0);
+        problem.sources.push_back(NO_SOURCE);
+        problem.materials.push_back(std::vector<long long>(materialNames.size(), 0));
+        for (Building &buildingType : buildingTypes)
+        {
+            ENERGY_SOURCE source = buildingType.getEnergySource();
+            double yield = 0;
+            if (source == SOLAR)
+                yield = yields.solarTotal[solarIndex++];
+            else if (source == WIND)
+                yield = yields.windTotal[windIndex++];
+            else if (source == HYDRO)
+                yield = yields.hydroTotal[hydroIndex++];
+            problem.yield.push_back(yield);
+            problem.price.push_back(buildingType.getTotalPrice());
+            problem.sources.push_back(source);
+            std::vector<long long> materials(materialNames.size(), 0);
+            for (Material &material : buildingType.getNecessaryMaterials())
+            {
+                materials[std::find(materialNames.begin(), materialNames.end(), material.getName()) - materialNames.begin()]++;
+            }
+            problem.materials.push_back(materials);
+        }
+
+        // The temperature starts at a tenth of the best yield and goes down to almost nothing in every cycle
+        double hottest = 0.1 * *std::max_element(problem.yield.begin(), problem.yield.end());
+        double coldest = hottest * 1e-4;
+
+        std::vector<std::unique_ptr<AnnealingChain>> chains;
+        std::seed_seq seeds{(uint32_t)settings.seed, (uint32_t)(settings.seed >> 32)};
+        std::vector<uint32_t> chainSeeds(std::max(settings.chains, 1));
+        seeds.generate(chainSeeds.begin(), chainSeeds.end());
+        for (uint32_t chainSeed : chainSeeds)
+        {
+            chains.emplace_back(new AnnealingChain(problem, chainSeed));
+        }
+
+        OptimizerResult result;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        while (true)
+        {
+            int cycleEpoch = result.epochs % settings.epochsPerCycle;
+            double progress = cycleEpoch / (double)std::max(settings.epochsPerCycle - 1, 1);
+            double temperature = hottest * std::pow(coldest / hottest, progress);
+            parallelFor(chains.size(), [&](size_t begin, size_t end)
+                        {
+                for (size_t i = begin; i < end; i++)
+                    chains[i]->runEpoch(settings.epochIterations, temperature); });
+            result.epochs++;
+            result.iterations += settings.epochIterations * chains.size();
+
+            // After a cycle every chain continues from the best layout it has seen
+            if (result.epochs % settings.epochsPerCycle == 0)
+            {
+                for (std::unique_ptr<AnnealingChain> &chain : chains)
+                    chain->reset(chain->bestLayout);
+            }
+
+            if (settings.maxEpochs > 0 && result.epochs >= settings.maxEpochs)
+                break;
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if (elapsed.count() >= settings.timeLimit)
+                break;
+        }
+
+        // The best chain wins, on a tie the one with the lower index so the result stays deterministic
+        AnnealingChain *best = chains[0].get();
+        for (std::unique_ptr<AnnealingChain> &chain : chains)
+        {
+            if (chain->bestScore > best->bestScore)
+                best = chain.get();
+        }
+        result.energy = best->bestScore;
+        result.cost = best->bestCost;
+        // Only the tiles the chain changed are compared, the others are still shared with the site
+        problem.start->forEachDifference(*best->bestLayout, [&](int x, int y, BuildingId, BuildingId id)
+                                         { result.placements.push_back(Placement{x, y, id}); });
+        return result;
+    }
+};
+
+#endif
@@ -0,0 +1,237 @@
+#include <string>
+#include <cstring>
+#include <charconv>
+#include <type_traits>
+#include <cstdio>
+#include "memory.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#ifndef OUTPUTSINK_H
+#define OUTPUTSINK_H
+
+// Money is counted in whole cents, so a sum is exact and the same no matter in which order it is added up
+typedef long long Cents;
+
+/*
+Writes the cents as a decimal number with 0 to 2 decimals into the buffer (at least 24 characters)
+and gives back how many characters it used. Halves are rounded away from 0, like std::round.
+*/
+inline size_t formatCents(char *buffer, Cents value, int decimals = 2)
+{
+    static const long long powers[] = {1, 10, 100};
+    char *next = buffer;
+    unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long)value : value;
+    unsigned long long divisor = powers[2 - decimals];
+    magnitude = (magnitude + divisor / 2) / divisor;
+    if (value < 0 && magnitude != 0)
+        *next++ = '-';
+    next = std::to_chars(next, buffer + 24, magnitude / powers[decimals]).ptr;
+    if (decimals > 0)
+    {
+        unsigned long long fraction = magnitude % powers[decimals];
+        *next++ = '.';
+        for (int i = decimals - 1; i >= 0; i--)
+        {
+            next[i] = '0' + fraction % 10;
+            fraction /= 10;
+        }
+        next += decimals;
+    }
+    return next - buffer;
+}
+
+/*
+All the output of the simulation goes through a sink. The sink collects everything in one
+reusable buffer and only hands it to the operating system when flush() is called (or when the
+buffer gets really big), so a whole frame is written with one write() instead of one per line.
+*/
+class OutputSink
+{
+protected:
+    OutputBuffer buffer;
+    // If the buffer grows larger than this we flush early so the memory stays bounded
+    size_t flushThreshold = 4 * 1024 * 1024;
+
+    // Write the given bytes to wherever this sink points to
+    virtual void commit(const char *data, size_t length) = 0;
+
+public:
+    OutputSink() { this->buffer.reserve(64 * 1024); }
+    virtual ~OutputSink() {}
+
+    OutputSink &write(const char *data, size_t length)
+    {
+        this->buffer.append(data, length);
+        if (this->buffer.size() >= this->flushThreshold)
+            this->flush();
+        return *this;
+    }
+
+    OutputSink &operator<<(const std::string &str) { return this->write(str.data(), str.length()); }
+    OutputSink &operator<<(const OutputBuffer &str) { return this->write(str.data(), str.length()); }
+    OutputSink &operator<<(const char *str) { return this->write(str, std::strlen(str)); }
+    OutputSink &operator<<(char c) { return this->write(&c, 1); }
+
+    template <typename T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, char>::value && !std::is_same<T, bool>::value, int>::type = 0>
+    OutputSink &operator<<(T value)
+    {
+        // Format the number without going through a stream
+        char digits[24];
+        std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), value);
+        return this->write(digits, result.ptr - digits);
+    }
+
+    // Writes a floating point number with a fixed amount of decimals
+    OutputSink &writeFixed(double value, int precision)
+    {
+        char digits[64];
+        std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), value, std::chars_format::fixed, precision);
+        if (result.ec != std::errc())
+            return this->write("?", 1);
+        return this->write(digits, result.ptr - digits);
+    }
+
+    // Writes an amount of money in whole units with two decimals, 1050 cents become 10.50
+    OutputSink &writeCents(Cents value)
+    {
+        char digits[24];
+        return this->write(digits, formatCents(digits, value));
+    }
+
+    // Gives direct access to the buffer, so renderers can append to it without any copies
+    OutputBuffer &getBuffer() { return this->buffer; }
+
+    void flush()
+    {
+        if (this->buffer.empty())
+            return;
+        this->commit(this->buffer.data(), this->buffer.size());
+        // clear() keeps the capacity, so the buffer is reused for the next frame
+        this->buffer.clear();
+    }
+};
+
+// Writes everything to a file descriptor, used for the terminal and for files
+class FileDescriptorOutputSink : public OutputSink
+{
+protected:
+#ifdef __linux__
+    int fd = -1;
+
+    void commit(const char *data, size_t length) override
+    {
+        // write() may write less than we asked for, so loop until everything is out
+        while (length > 0 && this->fd != -1)
+        {
+            ssize_t written = ::write(this->fd, data, length);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return;
+            }
+            data += written;
+            length -= written;
+        }
+    }
+#else
+    FILE *file = nullptr;
+
+    void commit(const char *data, size_t length) override
+    {
+        if (this->file == nullptr)
+            return;
+        fwrite(data, 1, length, this->file);
+        fflush(this->file);
+    }
+#endif
+};
+
+class TerminalOutputSink : public FileDescriptorOutputSink
+{
+public:
+    TerminalOutputSink()
+    {
+#ifdef __linux__
+        this->fd = STDOUT_FILENO;
+#else
+        this->file = stdout;
+#endif
+    }
+    ~TerminalOutputSink() { this->flush(); }
+};
+
+class FileOutputSink : public FileDescriptorOutputSink
+{
+public:
+    FileOutputSink(const std::string &path)
+    {
+#ifdef __linux__
+        this->fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#else
+        this->file = fopen(path.c_str(), "wb");
+#endif
+    }
+    ~FileOutputSink()
+    {
+        this->flush();
+#ifdef __linux__
+        if (this->fd != -1)
+            close(this->fd);
+#else
+        if (this->file != nullptr)
+            fclose(this->file);
+#endif
+    }
+
+    bool isOpen()
+    {
+#ifdef __linux__
+        return this->fd != -1;
+#else
+        return this->file != nullptr;
+#endif
+    }
+};
+
+// Keeps everything in memory, useful if the output needs to be inspected or sent somewhere else
+class MemoryOutputSink : public OutputSink
+{
+protected:
+    std::string contents;
+
+    void commit(const char *data, size_t length) override { this->contents.append(data, length); }
+
+public:
+    std::string &getContents()
+    {
+        this->flush();
+        return this->contents;
+    }
+    void clear()
+    {
+        this->buffer.clear();
+        this->contents.clear();
+    }
+};
+
+// Throws everything away
+class NullOutputSink : public OutputSink
+{
+protected:
+    void commit(const char *, size_t) override {}
+};
+
+// The sink everything goes to if nothing else is specified
+OutputSink &terminalOutput()
+{
+    static TerminalOutputSink terminal;
+    return terminal;
+}
+
+#endif
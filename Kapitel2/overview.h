@@ -0,0 +1,233 @@
+#include <vector>
+#include <string>
+#include <mutex>
+#include <cctype>
+#include <cstdint>
+#include <algorithm>
+#include "simulationstool.h"
+#include "parallel.h"
+
+#ifndef OVERVIEW_H
+#define OVERVIEW_H
+
+enum OVERVIEW_MODE
+{
+    // Every character shows the type most of the buildings in its block have, lower case if less than half of the block is built
+    DOMINANT_TYPE = 0,
+    // Every character shows how much of its block is built, from ' ' (nothing) to '@' (everything)
+    DENSITY = 1
+};
+
+/*
+Keeps the number of buildings of every type for blocks of the grid, starting with one block per
+tile (64x64 cells) and merging 2x2 blocks into one on every level above, until a single block is left.
+A change only updates the one block on every level that contains the cell, so it costs O(log n).
+An overview picks the level whose blocks fit the terminal best and only has to add up a few
+blocks per character, which makes it instant even for huge sites.
+*/
+class OverviewPyramid : public GridListener
+{
+private:
+    struct Level
+    {
+        // How many cells one block is high and wide
+        int blockSize;
+        int rows;
+        int columns;
+        // typeCount + 1 numbers per block, index 0 is the number of all buildings, then one per BuildingId
+        CountedVector<uint64_t, MEMORY_STATISTICS> counts;
+    };
+
+    std::vector<Level> levels;
+    int height = 0;
+    int width = 0;
+    int typeCount = 0;
+    std::vector<std::string> labels;
+    std::mutex lock;
+
+    uint64_t *getBlock(Level &level, int blockX, int blockY)
+    {
+        return &level.counts[((size_t)blockX * level.columns + blockY) * (this->typeCount + 1)];
+    }
+
+    void build(const GridSnapshot &snapshot)
+    {
+        this->height = snapshot.height;
+        this->width = snapshot.width;
+        this->levels.clear();
+
+        // The first level has one block per tile, so it can be counted from the occupancy bits of the tiles
+        Level first;
+        first.blockSize = GridTile::SIZE;
+        first.rows = snapshot.getTileRowCount();
+        first.columns = snapshot.getTileColumnCount();
+        first.counts.assign((size_t)first.rows * first.columns * (this->typeCount + 1), 0);
+        this->levels.push_back(first);
+        parallelFor((size_t)first.rows * first.columns, [&](size_t begin, size_t end)
+                    {
+            for (size_t index = begin; index < end; index++)
+            {
+                const GridTile &tile = snapshot.getTile(index / first.columns, index % first.columns);
+                uint64_t *block = &this->levels[0].counts[index * (this->typeCount + 1)];
+                for (int row = 0; row < GridTile::SIZE; row++)
+                {
+                    uint64_t word = tile.occupied[row];
+                    while (word != 0)
+                    {
+                        int column = countTrailingZeros(word);
+                        word &= word - 1;
+                        block[0]++;
+                        block[tile.get(row, column)]++;
+                    }
+                }
+            } });
+
+        // Every level above adds up 2x2 blocks of the level below
+        while (this->levels.back().rows > 1 || this->levels.back().columns > 1)
+        {
+            Level &below = this->levels.back();
+            Level next;
+            next.blockSize = below.blockSize * 2;
+            next.rows = (below.rows + 1) / 2;
+            next.columns = (below.columns + 1) / 2;
+            next.counts.assign((size_t)next.rows * next.columns * (this->typeCount + 1), 0);
+            for (int blockX = 0; blockX < below.rows; blockX++)
+            {
+                for (int blockY = 0; blockY < below.columns; blockY++)
+                {
+                    uint64_t *source = this->getBlock(below, blockX, blockY);
+                    uint64_t *target = &next.counts[((size_t)(blockX / 2) * next.columns + blockY / 2) * (this->typeCount + 1)];
+                    for (int i = 0; i <= this->typeCount; i++)
+                        target[i] += source[i];
+                }
+            }
+            this->levels.push_back(next);
+        }
+    }
+
+    char getCharacter(const uint64_t *counts, uint64_t cellCount, OVERVIEW_MODE mode)
+    {
+        if (counts[0] == 0)
+            return ' ';
+        if (mode == DENSITY)
+        {
+            // Anything built shows up as at least a '.'
+            const std::string shades = " .:-=+*#%@";
+            size_t shade = (counts[0] * (shades.size() - 1) + cellCount - 1) / cellCount;
+            return shades[std::min(shade, shades.size() - 1)];
+        }
+        int dominant = 1;
+        for (int id = 2; id <= this->typeCount; id++)
+        {
+            if (counts[id] > counts[dominant])
+                dominant = id;
+        }
+        char label = this->labels[dominant].empty() ? '?' : this->labels[dominant][0];
+        return counts[0] * 2 >= cellCount ? label : std::tolower(label);
+    }
+
+public:
+    // Counts everything of the current grid and keeps the counts up to date from now on
+    void attach(CapycitySim &simulation)
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->typeCount = simulation.getBuildingTypes().size();
+        this->labels.assign(1, EmptyBuilding().getLabel());
+        for (Building &buildingType : simulation.getBuildingTypes())
+        {
+            this->labels.push_back(buildingType.getLabel());
+        }
+        std::shared_ptr<const GridSnapshot> snapshot = simulation.addListener(*this);
+        this->build(*snapshot);
+    }
+
+    void detach(CapycitySim &simulation) { simulation.removeListener(*this); }
+
+    void onCellChanged(int x, int y, BuildingId oldId, BuildingId newId) override
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        for (Level &level : this->levels)
+        {
+            uint64_t *block = this->getBlock(level, x / level.blockSize, y / level.blockSize);
+            if (oldId != 0)
+            {
+                block[0]--;
+                block[oldId]--;
+            }
+            if (newId != 0)
+            {
+                block[0]++;
+                block[newId]++;
+            }
+        }
+    }
+
+    /*
+    Draws the whole site into a box of at most columns x rows characters (including the border).
+    Small sites that don't even fill one tile per character are counted from the snapshot directly,
+    that only visits the buildings, everything else comes from the pyramid.
+    */
+    void render(OutputSink &output, const GridSnapshot &snapshot, int columns, int rows, OVERVIEW_MODE mode)
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        // The border takes two characters in both directions and every block is drawn two characters wide,
+        // because a character is about twice as high as it is wide
+        int innerColumns = std::max((columns - 2) / 2, 1), innerRows = std::max(rows - 2, 1);
+        long long needed = std::max((this->height + innerRows - 1) / innerRows, (this->width + innerColumns - 1) / innerColumns);
+        needed = std::max(needed, 1LL);
+
+        // Use the coarsest level whose blocks are not bigger than what one character has to show
+        int levelIndex = -1;
+        for (size_t i = 0; i < this->levels.size() && this->levels[i].blockSize <= needed; i++)
+            levelIndex = (int)i;
+        long long blocksPerCharacter = levelIndex == -1 ? 1 : (needed + this->levels[levelIndex].blockSize - 1) / this->levels[levelIndex].blockSize;
+        long long cellsPerCharacter = levelIndex == -1 ? needed : blocksPerCharacter * this->levels[levelIndex].blockSize;
+        int characterRows = (this->height + cellsPerCharacter - 1) / cellsPerCharacter;
+        int characterColumns = (this->width + cellsPerCharacter - 1) / cellsPerCharacter;
+
+        std::vector<uint64_t> counts((size_t)characterRows * characterColumns * (this->typeCount + 1), 0);
+        if (levelIndex == -1)
+        {
+            snapshot.forEachBuilding([&](int x, int y, BuildingId id)
+                                     {
+                uint64_t *character = &counts[((size_t)(x / cellsPerCharacter) * characterColumns + y / cellsPerCharacter) * (this->typeCount + 1)];
+                character[0]++;
+                character[id]++; });
+        }
+        else
+        {
+            Level &level = this->levels[levelIndex];
+            for (int blockX = 0; blockX < level.rows; blockX++)
+            {
+                for (int blockY = 0; blockY < level.columns; blockY++)
+                {
+                    uint64_t *source = this->getBlock(level, blockX, blockY);
+                    uint64_t *character = &counts[((size_t)(blockX / blocksPerCharacter) * characterColumns + blockY / blocksPerCharacter) * (this->typeCount + 1)];
+                    for (int i = 0; i <= this->typeCount; i++)
+                        character[i] += source[i];
+                }
+            }
+        }
+
+        output << "[*] Overview, two characters show " << cellsPerCharacter << "x" << cellsPerCharacter << " cells\n";
+        std::string line = "+" + std::string(2 * characterColumns, '-') + "+\n";
+        output << line;
+        for (int characterX = 0; characterX < characterRows; characterX++)
+        {
+            output << '|';
+            // Blocks at the right and bottom edge can be cut off by the end of the grid
+            long long cellRows = std::min(cellsPerCharacter, this->height - characterX * cellsPerCharacter);
+            for (int characterY = 0; characterY < characterColumns; characterY++)
+            {
+                long long cellColumns = std::min(cellsPerCharacter, this->width - characterY * cellsPerCharacter);
+                const uint64_t *character = &counts[((size_t)characterX * characterColumns + characterY) * (this->typeCount + 1)];
+                char shown = this->getCharacter(character, cellRows * cellColumns, mode);
+                output << shown << shown;
+            }
+            output << "|\n";
+        }
+        output << line;
+    }
+};
+
+#endif
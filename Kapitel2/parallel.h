@@ -0,0 +1,150 @@
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <functional>
+#include <algorithm>
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// How many threads the parallel parts of the simulation use
+int getThreadCount()
+{
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Set on the threads of parallelForEach, every core is busy with its tasks already
+thread_local bool insideTask = false;
+
+/*
+Splits [0, count) into one chunk per thread and calls work(begin, end) for every chunk.
+The calling thread works on the first chunk itself, so nothing is spawned for small jobs.
+minChunk keeps tiny ranges from being spread over too many threads.
+*/
+void parallelFor(size_t count, const std::function<void(size_t, size_t)> &work, size_t minChunk = 1)
+{
+    if (count == 0)
+        return;
+    // Inside a task of parallelForEach more threads would only fight over the cores
+    if (insideTask)
+    {
+        work(0, count);
+        return;
+    }
+    size_t threadCount = std::min((size_t)getThreadCount(), (count + minChunk - 1) / minChunk);
+    threadCount = std::max(threadCount, (size_t)1);
+    size_t chunkSize = (count + threadCount - 1) / threadCount;
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; i++)
+    {
+        size_t begin = i * chunkSize;
+        size_t end = std::min(count, begin + chunkSize);
+        if (begin >= end)
+            break;
+        threads.emplace_back(work, begin, end);
+    }
+    work(0, std::min(count, chunkSize));
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+}
+
+/*
+Calls work(index) for every index in [0, count), for tasks that take very different amounts of time.
+Every thread starts with its own share of the indices and takes them from the front. A thread that
+runs out steals the back half of the biggest share that is left, so one big task at the end of a share
+doesn't keep the other tasks of that share waiting. Parallel loops inside a task run on the thread of the task.
+*/
+void parallelForEach(size_t count, const std::function<void(size_t)> &work)
+{
+    if (count == 0)
+        return;
+    if (insideTask)
+    {
+        for (size_t index = 0; index < count; index++)
+            work(index);
+        return;
+    }
+
+    struct Share
+    {
+        std::mutex lock;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+    size_t threadCount = std::min((size_t)getThreadCount(), count);
+    std::vector<Share> shares(threadCount);
+    for (size_t i = 0; i < threadCount; i++)
+    {
+        shares[i].begin = count * i / threadCount;
+        shares[i].end = count * (i + 1) / threadCount;
+    }
+
+    auto runWorker = [&](size_t self)
+    {
+        insideTask = true;
+        while (true)
+        {
+            size_t index = 0;
+            bool found = false;
+            {
+                std::lock_guard<std::mutex> guard(shares[self].lock);
+                if (shares[self].begin < shares[self].end)
+                {
+                    index = shares[self].begin++;
+                    found = true;
+                }
+            }
+            if (!found)
+            {
+                // Look for the share with the most indices left and take the back half of it
+                size_t victim = self, mostLeft = 0;
+                for (size_t i = 0; i < threadCount; i++)
+                {
+                    std::lock_guard<std::mutex> guard(shares[i].lock);
+                    if (shares[i].end - shares[i].begin > mostLeft)
+                    {
+                        mostLeft = shares[i].end - shares[i].begin;
+                        victim = i;
+                    }
+                }
+                if (mostLeft == 0)
+                    break;
+                size_t stolenBegin, stolenEnd;
+                {
+                    std::lock_guard<std::mutex> guard(shares[victim].lock);
+                    // Someone else may have been faster
+                    if (shares[victim].begin == shares[victim].end)
+                        continue;
+                    size_t left = shares[victim].end - shares[victim].begin;
+                    stolenEnd = shares[victim].end;
+                    stolenBegin = stolenEnd - (left + 1) / 2;
+                    shares[victim].end = stolenBegin;
+                }
+                {
+                    std::lock_guard<std::mutex> guard(shares[self].lock);
+                    shares[self].begin = stolenBegin + 1;
+                    shares[self].end = stolenEnd;
+                }
+                index = stolenBegin;
+            }
+            work(index);
+        }
+        insideTask = false;
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; i++)
+    {
+        threads.emplace_back(runWorker, i);
+    }
+    runWorker(0);
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+}
+
+#endif
@@ -0,0 +1,257 @@
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <cstdint>
+#include "simulationstool.h"
+#include "energy.h"
+#include "journal.h"
+#include "scenarios.h"
+#include "parallel.h"
+
+#ifndef PORTFOLIO_H
+#define PORTFOLIO_H
+
+// The numbers of one site, or of all sites together
+struct PortfolioRow
+{
+    std::string name;
+    bool loaded = false;
+    // How many buildings of each type, the index is the BuildingId
+    std::vector<long long> buildingCounts;
+    Cents cost = 0;
+    // kWh over the whole weather profile, without the wake and shading losses
+    double energy = 0;
+    // The total cost in every price scenario, in the order of the scenarios
+    std::vector<Cents> scenarioTotals;
+};
+
+struct PortfolioReport
+{
+    std::vector<PortfolioRow> sites;
+    PortfolioRow total;
+    std::vector<std::string> scenarioNames;
+};
+
+/*
+Many sites that are each stored in a snapshot file. A site is only read from its file when a report
+needs it, and is kept in memory afterwards until the loaded sites take more than the memory limit.
+Then the site that was used longest ago is dropped, it is read again the next time it is needed.
+A report runs one task per site on parallelForEach, so a huge site doesn't hold up the small ones,
+and everything is added up at the end in the order of the sites.
+*/
+class Portfolio
+{
+private:
+    struct Site
+    {
+        std::string name;
+        std::string path;
+        // nullptr while the site is not in memory
+        std::shared_ptr<const GridSnapshot> snapshot;
+        size_t memory = 0;
+        uint64_t lastUsed = 0;
+    };
+
+    std::vector<Building> buildingTypes;
+    std::vector<Site> sites;
+    size_t memoryLimit;
+    // Everything below and the snapshots of the sites are guarded by the lock
+    std::mutex lock;
+    size_t loadedMemory = 0;
+    uint64_t useCounter = 0;
+
+    // Every tile with a building has its own memory, the empty ones are all the same tile
+    static size_t getMemory(const GridSnapshot &snapshot)
+    {
+        size_t memory = sizeof(GridSnapshot) + (size_t)snapshot.getTileRowCount() * snapshot.getTileColumnCount() * sizeof(std::shared_ptr<const GridTile>);
+        for (int tileX = 0; tileX < snapshot.getTileRowCount(); tileX++)
+        {
+            for (int tileY = 0; tileY < snapshot.getTileColumnCount(); tileY++)
+            {
+                if (snapshot.getTile(tileX, tileY).occupiedRows != 0)
+                    memory += sizeof(GridTile);
+            }
+        }
+        return memory;
+    }
+
+    // Must be called with the lock held, the site that was just loaded is never dropped
+    void evict(size_t keep)
+    {
+        while (this->loadedMemory > this->memoryLimit)
+        {
+            Site *oldest = nullptr;
+            for (size_t i = 0; i < this->sites.size(); i++)
+            {
+                Site &site = this->sites[i];
+                if (i != keep && site.snapshot != nullptr && (oldest == nullptr || site.lastUsed < oldest->lastUsed))
+                    oldest = &site;
+            }
+            if (oldest == nullptr)
+                return;
+            // Reports that still work on it keep their own reference, so this only drops ours
+            oldest->snapshot = nullptr;
+            this->loadedMemory -= oldest->memory;
+        }
+    }
+
+public:
+    Portfolio(std::vector<Building> &buildingTypes, size_t memoryLimit = (size_t)1 << 30)
+    {
+        this->buildingTypes = buildingTypes;
+        this->memoryLimit = memoryLimit;
+    }
+
+    void add(const std::string &name, const std::string &path)
+    {
+        // Starts out of memory and never used
+        Site site;
+        site.name = name;
+        site.path = path;
+        this->sites.push_back(site);
+    }
+
+    // Reads a file with one snapshot file per line, a line can start with a name and a '=' before the path
+    bool load(const std::string &path, OutputSink &output)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            output << "[!] Could not open " << path << "\n";
+            return false;
+        }
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (line.empty() || line[0] == '#')
+                continue;
+            size_t equals = line.find('=');
+            if (equals == std::string::npos)
+                this->add(line, line);
+            else
+                this->add(line.substr(0, equals), line.substr(equals + 1));
+        }
+        return true;
+    }
+
+    size_t getSiteCount() { return this->sites.size(); }
+    size_t getLoadedMemory()
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return this->loadedMemory;
+    }
+
+    // Gives back the site, reads it from its file if it is not in memory, nullptr if the file can't be read
+    std::shared_ptr<const GridSnapshot> getSite(size_t index, OutputSink &output)
+    {
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            Site &site = this->sites[index];
+            site.lastUsed = ++this->useCounter;
+            if (site.snapshot != nullptr)
+                return site.snapshot;
+        }
+
+        // Reading the file doesn't need the lock, two tasks reading the same site at once just both read it
+        std::shared_ptr<const GridSnapshot> snapshot = Journal::loadSnapshot(this->sites[index].path, this->buildingTypes.size(), output);
+        if (snapshot == nullptr)
+            return nullptr;
+        std::lock_guard<std::mutex> guard(this->lock);
+        Site &site = this->sites[index];
+        if (site.snapshot == nullptr)
+        {
+            site.snapshot = snapshot;
+            site.memory = getMemory(*snapshot);
+            this->loadedMemory += site.memory;
+            this->evict(index);
+        }
+        return snapshot;
+    }
+
+    /*
+    The buildings, cost, energy and scenario totals of every site and of all of them together.
+    weather may be nullptr to skip the energy simulation, which is by far the slowest part.
+    */
+    PortfolioReport report(PriceScenarios &scenarios, const WeatherProfile *weather, OutputSink &output)
+    {
+        PortfolioReport report;
+        report.sites.resize(this->sites.size());
+        std::vector<MemoryOutputSink> errors(this->sites.size());
+        parallelForEach(this->sites.size(), [&](size_t index)
+                        {
+            PortfolioRow &row = report.sites[index];
+            row.name = this->sites[index].name;
+            std::shared_ptr<const GridSnapshot> snapshot = this->getSite(index, errors[index]);
+            if (snapshot == nullptr)
+                return;
+            row.loaded = true;
+            row.buildingCounts.assign(snapshot->buildingCounts.begin(), snapshot->buildingCounts.end());
+            row.buildingCounts[0] = 0;
+            for (size_t id = 1; id <= this->buildingTypes.size(); id++)
+                row.cost += row.buildingCounts[id] * this->buildingTypes[id - 1].getTotalPrice();
+            row.scenarioTotals = scenarios.evaluate(*snapshot).totals;
+            if (weather != nullptr)
+            {
+                EnergyFleet fleet = EnergyFleet::fromSnapshot(*snapshot, this->buildingTypes);
+                EnergyResult result = EnergySimulation().run(fleet, *weather);
+                row.energy = EnergyResult::sum(result.solarTotal) + EnergyResult::sum(result.windTotal) + EnergyResult::sum(result.hydroTotal);
+            } });
+
+        // Added up in the order of the sites, so the energy total is the same every time
+        report.total.name = "Total";
+        report.total.buildingCounts.assign(this->buildingTypes.size() + 1, 0);
+        report.scenarioNames = scenarios.getScenarioNames();
+        report.total.scenarioTotals.assign(report.scenarioNames.size(), 0);
+        for (size_t index = 0; index < report.sites.size(); index++)
+        {
+            output << errors[index].getContents();
+            PortfolioRow &row = report.sites[index];
+            if (!row.loaded)
+                continue;
+            report.total.loaded = true;
+            for (size_t id = 1; id < row.buildingCounts.size(); id++)
+                report.total.buildingCounts[id] += row.buildingCounts[id];
+            report.total.cost += row.cost;
+            report.total.energy += row.energy;
+            for (size_t i = 0; i < row.scenarioTotals.size(); i++)
+                report.total.scenarioTotals[i] += row.scenarioTotals[i];
+        }
+        return report;
+    }
+};
+
+void printPortfolioReport(OutputSink &output, const PortfolioReport &report, std::vector<Building> &buildingTypes)
+{
+    output << "[*] Portfolio:\n";
+    std::vector<const PortfolioRow *> rows;
+    for (const PortfolioRow &row : report.sites)
+        rows.push_back(&row);
+    rows.push_back(&report.total);
+    for (const PortfolioRow *row : rows)
+    {
+        output << " " << row->name << ": ";
+        if (!row->loaded)
+        {
+            output << "could not be read\n";
+            continue;
+        }
+        for (size_t id = 1; id < row->buildingCounts.size(); id++)
+            output << row->buildingCounts[id] << "x " << buildingTypes[id - 1].getLabel() << " ";
+        output.writeCents(row->cost);
+        output << "$, ";
+        output.writeFixed(row->energy / 1000, 2);
+        output << " MWh";
+        // Scenario 0 has the current prices, that is the cost from above
+        for (size_t i = 1; i < row->scenarioTotals.size(); i++)
+        {
+            output << ", " << report.scenarioNames[i] << " ";
+            output.writeCents(row->scenarioTotals[i]);
+            output << "$";
+        }
+        output << "\n";
+    }
+}
+
+#endif
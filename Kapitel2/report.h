@@ -0,0 +1,353 @@
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "simulationstool.h"
+#include "clusters.h"
+
+#ifndef REPORT_H
+#define REPORT_H
+
+enum REPORT_FORMAT
+{
+    JSON = 0,
+    CSV = 1
+};
+
+enum REPORT_TABLE
+{
+    // One row per building type and material and one with the total
+    REPORT_SUMMARY = 1,
+    // One row per 64x64 block that has buildings in it
+    REPORT_REGIONS = 2,
+    // One row per building
+    REPORT_BUILDINGS = 3,
+    // One row per connected group of buildings
+    REPORT_CLUSTERS = 4
+};
+
+/*
+Writes tables as JSON or CSV straight into the buffer of an output sink, row by row and field by field.
+Numbers are formatted with to_chars and strings are only copied, so writing a row never allocates and
+a table with millions of rows streams out as fast as the sink can write it.
+JSON is one object with an array of row objects per table, CSV has a header line per table and an
+empty line between two tables.
+*/
+class ReportWriter
+{
+private:
+    OutputSink &output;
+    REPORT_FORMAT format;
+    // For JSON the "name": in front of every field, for CSV nothing
+    std::vector<std::string> keys;
+    size_t column = 0;
+    bool firstRow = true;
+    bool firstTable = true;
+
+    static void writeString(OutputSink &output, REPORT_FORMAT format, const char *text, size_t length)
+    {
+        if (format == CSV)
+        {
+            // Only fields with a separator, a quote or a line break have to be quoted
+            if (std::find_if(text, text + length, [](char c)
+                             { return c == ',' || c == '"' || c == '\n' || c == '\r'; }) == text + length)
+            {
+                output.write(text, length);
+                return;
+            }
+            output << '"';
+            for (size_t i = 0; i < length; i++)
+            {
+                if (text[i] == '"')
+                    output << '"';
+                output << text[i];
+            }
+            output << '"';
+            return;
+        }
+
+        output << '"';
+        size_t start = 0;
+        for (size_t i = 0; i < length; i++)
+        {
+            unsigned char c = text[i];
+            if (c != '"' && c != '\\' && c >= 0x20)
+                continue;
+            // Everything up to the special character goes out in one piece
+            output.write(text + start, i - start);
+            if (c == '"' || c == '\\')
+            {
+                const char escaped[2] = {'\\', (char)c};
+                output.write(escaped, 2);
+            }
+            else
+            {
+                const char hex[] = "0123456789abcdef";
+                const char escaped[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+                output.write(escaped, 6);
+            }
+            start = i + 1;
+        }
+        output.write(text + start, length - start);
+        output << '"';
+    }
+
+    void nextField()
+    {
+        if (this->column > 0)
+            this->output << ',';
+        if (this->format == JSON)
+            this->output << this->keys[this->column];
+        this->column++;
+    }
+
+public:
+    ReportWriter(OutputSink &output, REPORT_FORMAT format) : output(output)
+    {
+        this->format = format;
+    }
+
+    void begin()
+    {
+        if (this->format == JSON)
+            this->output << '{';
+    }
+
+    void end()
+    {
+        this->output << (this->format == JSON ? "}\n" : "");
+    }
+
+    void beginTable(const std::string &name, const std::vector<std::string> &columns)
+    {
+        this->keys.clear();
+        this->firstRow = true;
+        if (this->format == JSON)
+        {
+            if (!this->firstTable)
+                this->output << ',';
+            writeString(this->output, JSON, name.data(), name.size());
+            this->output << ":[";
+            // The keys are escaped once here instead of once per row
+            MemoryOutputSink key;
+            for (const std::string &column : columns)
+            {
+                key.clear();
+                writeString(key, JSON, column.data(), column.size());
+                key << ':';
+                this->keys.push_back(key.getContents());
+            }
+        }
+        else
+        {
+            if (!this->firstTable)
+                this->output << '\n';
+            for (size_t i = 0; i < columns.size(); i++)
+            {
+                if (i > 0)
+                    this->output << ',';
+                writeString(this->output, CSV, columns[i].data(), columns[i].size());
+            }
+            this->output << '\n';
+        }
+        this->firstTable = false;
+    }
+
+    void endTable()
+    {
+        if (this->format == JSON)
+            this->output << "\n]";
+    }
+
+    void beginRow()
+    {
+        this->column = 0;
+        if (this->format == JSON)
+        {
+            this->output << (this->firstRow ? "\n{" : ",\n{");
+        }
+        this->firstRow = false;
+    }
+
+    void endRow() { this->output << (this->format == JSON ? '}' : '\n'); }
+
+    void field(long long value)
+    {
+        this->nextField();
+        this->output << value;
+    }
+
+    void field(const std::string &value)
+    {
+        this->nextField();
+        writeString(this->output, this->format, value.data(), value.size());
+    }
+
+    // Money is written as a plain number with two decimals
+    void fieldCents(Cents value)
+    {
+        this->nextField();
+        this->output.writeCents(value);
+    }
+
+    // null in JSON, nothing in CSV
+    void fieldEmpty()
+    {
+        this->nextField();
+        if (this->format == JSON)
+            this->output << "null";
+    }
+};
+
+// Everything the summary boxes show: the buildings, the materials (both with their price) and the total
+void writeSummaryTable(ReportWriter &writer, const GridSnapshot &snapshot, std::vector<Building> &buildingTypes)
+{
+    writer.beginTable("summary", {"kind", "name", "count", "price", "cost"});
+    long long totalCount = 0;
+    Cents totalCost = 0;
+    for (size_t id = 1; id <= buildingTypes.size(); id++)
+    {
+        Building &buildingType = buildingTypes[id - 1];
+        long long count = snapshot.buildingCounts[id];
+        writer.beginRow();
+        writer.field("building");
+        writer.field(buildingType.getLabel());
+        writer.field(count);
+        writer.fieldCents(buildingType.getTotalPrice());
+        writer.fieldCents(count * buildingType.getTotalPrice());
+        writer.endRow();
+        totalCount += count;
+        totalCost += count * buildingType.getTotalPrice();
+    }
+
+    // The materials in the order they first show up in the recipes, the cost is already in the buildings
+    std::vector<Material> materials;
+    for (Building &buildingType : buildingTypes)
+    {
+        for (Material &material : buildingType.getNecessaryMaterials())
+        {
+            if (std::find_if(materials.begin(), materials.end(), [&](Material &known)
+                             { return known.getName() == material.getName(); }) == materials.end())
+                materials.push_back(material);
+        }
+    }
+    for (Material &material : materials)
+    {
+        long long amount = 0;
+        for (size_t id = 1; id <= buildingTypes.size(); id++)
+        {
+            for (Material &needed : buildingTypes[id - 1].getNecessaryMaterials())
+            {
+                if (needed.getName() == material.getName())
+                    amount += snapshot.buildingCounts[id];
+            }
+        }
+        writer.beginRow();
+        writer.field("material");
+        writer.field(material.getName());
+        writer.field(amount);
+        writer.fieldCents(material.getPrice());
+        writer.fieldEmpty();
+        writer.endRow();
+    }
+
+    writer.beginRow();
+    writer.field("total");
+    writer.fieldEmpty();
+    writer.field(totalCount);
+    writer.fieldEmpty();
+    writer.fieldCents(totalCost);
+    writer.endRow();
+    writer.endTable();
+}
+
+// The buildings per 64x64 block, x and y are the top left cell the way the user types it (XxY, 1 indexed)
+void writeRegionTable(ReportWriter &writer, const GridSnapshot &snapshot, std::vector<Building> &buildingTypes)
+{
+    std::vector<std::string> columns{"x", "y", "width", "height", "count"};
+    for (Building &buildingType : buildingTypes)
+        columns.push_back(buildingType.getLabel());
+    columns.push_back("cost");
+    writer.beginTable("regions", columns);
+
+    std::vector<long long> counts(buildingTypes.size() + 1);
+    const int tileSize = GridTile::SIZE;
+    for (int tileX = 0; tileX < snapshot.getTileRowCount(); tileX++)
+    {
+        for (int tileY = 0; tileY < snapshot.getTileColumnCount(); tileY++)
+        {
+            const GridTile &tile = snapshot.getTile(tileX, tileY);
+            if (tile.occupiedRows == 0)
+                continue;
+            std::fill(counts.begin(), counts.end(), 0);
+            long long total = 0;
+            for (int row = 0; row < GridTile::SIZE; row++)
+            {
+                uint64_t word = tile.occupied[row];
+                while (word != 0)
+                {
+                    int column = countTrailingZeros(word);
+                    word &= word - 1;
+                    counts[tile.get(row, column)]++;
+                    total++;
+                }
+            }
+            writer.beginRow();
+            writer.field(tileY * GridTile::SIZE + 1);
+            writer.field(tileX * GridTile::SIZE + 1);
+            // The blocks at the right and bottom edge can be smaller
+            writer.field(std::min(tileSize, snapshot.width - tileY * tileSize));
+            writer.field(std::min(tileSize, snapshot.height - tileX * tileSize));
+            writer.field(total);
+            Cents cost = 0;
+            for (size_t id = 1; id <= buildingTypes.size(); id++)
+            {
+                writer.field(counts[id]);
+                cost += counts[id] * buildingTypes[id - 1].getTotalPrice();
+            }
+            writer.fieldCents(cost);
+            writer.endRow();
+        }
+    }
+    writer.endTable();
+}
+
+// Every building, row by row
+void writeBuildingTable(ReportWriter &writer, const GridSnapshot &snapshot, std::vector<Building> &buildingTypes)
+{
+    std::vector<std::string> labels{""};
+    for (Building &buildingType : buildingTypes)
+        labels.push_back(buildingType.getLabel());
+    writer.beginTable("buildings", {"x", "y", "type"});
+    snapshot.forEachBuilding([&](int x, int y, BuildingId id)
+                             {
+        writer.beginRow();
+        writer.field(y + 1);
+        writer.field(x + 1);
+        writer.field(labels[id]);
+        writer.endRow(); });
+    writer.endTable();
+}
+
+// Every cluster, the biggest first, x and y are one of its cells
+void writeClusterTable(ReportWriter &writer, const std::vector<Cluster> &clusters, std::vector<Building> &buildingTypes)
+{
+    std::vector<std::string> columns{"x", "y", "count"};
+    for (Building &buildingType : buildingTypes)
+        columns.push_back(buildingType.getLabel());
+    columns.push_back("cost");
+    writer.beginTable("clusters", columns);
+    for (const Cluster &cluster : clusters)
+    {
+        writer.beginRow();
+        writer.field(cluster.y + 1);
+        writer.field(cluster.x + 1);
+        writer.field(cluster.size);
+        for (size_t id = 1; id <= buildingTypes.size(); id++)
+            writer.field(id < cluster.buildingCounts.size() ? cluster.buildingCounts[id] : 0);
+        writer.fieldCents(cluster.cost);
+        writer.endRow();
+    }
+    writer.endTable();
+}
+
+#endif
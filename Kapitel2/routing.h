@@ -0,0 +1,267 @@
+#include <vector>
+#include <tuple>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <unordered_map>
+#include "simulationstool.h"
+#include "clusters.h"
+#include "parallel.h"
+
+#ifndef ROUTING_H
+#define ROUTING_H
+
+// The cable from one plant to the connection point
+struct CableRoute
+{
+    // The plant the cable starts at, for a cluster the plant of the cluster that is closest to the connection point
+    int x = 0;
+    int y = 0;
+    // In cells, -1 if the plant is walled in and no cable can be laid
+    long long length = -1;
+    // Only filled for a single route, every cell from the plant to the connection point
+    std::vector<std::tuple<int, int>> path;
+};
+
+struct CableNetwork
+{
+    std::vector<CableRoute> routes;
+    long long totalLength = 0;
+    Cents totalCost = 0;
+    // Plants (or clusters) that have no way to the connection point
+    long long unreachable = 0;
+};
+
+/*
+Lays cables over empty cells to a connection point, moving left, right, up or down.
+The grid is turned into two bitsets (empty cells and buildings) with a blocked border around
+it, so the searches never need a bounds check and a row starts at a new word. Every row is
+padded to whole words, which lets the rows be filled in parallel.
+A single route uses A* with a bucket queue. When the ties are broken by taking the newest cell
+first, it runs straight through open space and only spreads out around obstacles.
+All plants at once use a single breadth first search that starts at the connection point. It
+records every building it runs into and stops as soon as all of them have been found.
+*/
+class CableRouter
+{
+private:
+    int height = 0;
+    int width = 0;
+    // Bits per padded row, always a multiple of 64
+    size_t stride = 0;
+    std::vector<uint64_t> empty;
+    std::vector<uint64_t> buildings;
+    long long buildingCount = 0;
+    // What one cell of cable costs
+    Cents cablePrice;
+
+    size_t index(int x, int y) const { return (size_t)(x + 1) * this->stride + (y + 1); }
+    void toCoordinate(size_t cell, int &x, int &y) const
+    {
+        x = cell / this->stride - 1;
+        y = cell % this->stride - 1;
+    }
+
+    static bool test(const std::vector<uint64_t> &bits, size_t cell) { return (bits[cell >> 6] >> (cell & 63)) & 1; }
+    static void mark(std::vector<uint64_t> &bits, size_t cell) { bits[cell >> 6] |= (uint64_t)1 << (cell & 63); }
+
+    // The breadth first search of routeAll, Index is the smallest type that can hold every cell
+    template <typename Index, typename Record>
+    void searchLevels(size_t target, std::vector<uint64_t> &visited, long long &remaining, Record record)
+    {
+        std::vector<Index> frontier{(Index)target}, next;
+        Index neighbourOffsets[4] = {1, (Index)-1, (Index)this->stride, (Index)((Index)0 - (Index)this->stride)};
+
+        // One level of the search after the other, so the distance is just the number of the level
+        for (long long length = 1; !frontier.empty() && remaining > 0; length++)
+        {
+            next.clear();
+            for (Index cell : frontier)
+            {
+                for (Index offset : neighbourOffsets)
+                {
+                    Index neighbour = cell + offset;
+                    uint64_t &word = visited[neighbour >> 6];
+                    uint64_t bit = (uint64_t)1 << (neighbour & 63);
+                    if (word & bit)
+                        continue;
+                    word |= bit;
+                    if (test(this->empty, neighbour))
+                        next.push_back(neighbour);
+                    else
+                        record(neighbour, length);
+                }
+            }
+            frontier.swap(next);
+        }
+    }
+
+public:
+    CableRouter(const GridSnapshot &snapshot, Cents cablePrice = 100)
+    {
+        this->height = snapshot.height;
+        this->width = snapshot.width;
+        this->cablePrice = cablePrice;
+        this->stride = ((size_t)this->width + 2 + 63) / 64 * 64;
+        size_t words = (size_t)(this->height + 2) * this->stride / 64;
+        this->empty.assign(words, 0);
+        this->buildings.assign(words, 0);
+        for (size_t id = 1; id < snapshot.buildingCounts.size(); id++)
+            this->buildingCount += snapshot.buildingCounts[id];
+
+        // Every row starts at its own word, so the threads never write to the same word.
+        // The occupancy words of the tiles are copied over whole, only shifted by one for the border
+        size_t rowWords = this->stride / 64;
+        parallelFor(this->height, [&](size_t begin, size_t end)
+                    {
+            for (size_t x = begin; x < end; x++)
+            {
+                uint64_t *buildingRow = &this->buildings[(x + 1) * rowWords];
+                uint64_t *emptyRow = &this->empty[(x + 1) * rowWords];
+                for (int tileY = 0; tileY < snapshot.getTileColumnCount(); tileY++)
+                {
+                    uint64_t word = snapshot.getTile(x / GridTile::SIZE, tileY).occupied[x % GridTile::SIZE];
+                    if (word == 0)
+                        continue;
+                    buildingRow[tileY] |= word << 1;
+                    if (word >> 63)
+                        buildingRow[tileY + 1] |= word >> 63;
+                }
+                // Empty are all the cells of the grid that have no building, the border and the padding stay 0
+                for (size_t i = 0; i < rowWords; i++)
+                {
+                    size_t first = std::max(i * 64, (size_t)1), last = std::min(i * 64 + 63, (size_t)this->width);
+                    if (first > last)
+                        continue;
+                    uint64_t inside = (~(uint64_t)0 >> (63 - (last - i * 64))) & (~(uint64_t)0 << (first - i * 64));
+                    emptyRow[i] = inside & ~buildingRow[i];
+                }
+            } }, 64);
+    }
+
+    Cents getCablePrice() { return this->cablePrice; }
+
+    // The shortest cable from the plant at x/y to the connection point, with the path
+    CableRoute route(int x, int y, int targetX, int targetY)
+    {
+        CableRoute result;
+        result.x = x;
+        result.y = y;
+        size_t start = this->index(x, y), target = this->index(targetX, targetY);
+        if (start == target)
+        {
+            result.length = 0;
+            result.path.push_back(std::make_tuple(x, y));
+            return result;
+        }
+
+        // f = g + h never gets smaller with the manhattan distance, so the buckets are only walked forward
+        auto heuristic = [&](size_t cell)
+        {
+            int cellX, cellY;
+            this->toCoordinate(cell, cellX, cellY);
+            return (size_t)(std::abs(cellX - targetX) + std::abs(cellY - targetY));
+        };
+        std::vector<std::vector<size_t>> buckets(heuristic(start) + 1);
+        std::unordered_map<size_t, size_t> cameFrom;
+        std::unordered_map<size_t, size_t> distance;
+        std::vector<uint64_t> closed(this->empty.size(), 0);
+        buckets[heuristic(start)].push_back(start);
+        distance[start] = 0;
+        cameFrom[start] = start;
+        size_t neighbourOffsets[4] = {1, (size_t)-1, this->stride, (size_t)0 - this->stride};
+
+        bool found = false;
+        for (size_t f = heuristic(start); f < buckets.size() && !found; f++)
+        {
+            while (!buckets[f].empty() && !found)
+            {
+                // Newest first, so the search follows one path as long as it doesn't get worse
+                size_t cell = buckets[f].back();
+                buckets[f].pop_back();
+                if (test(closed, cell))
+                    continue;
+                mark(closed, cell);
+                size_t nextDistance = distance[cell] + 1;
+                for (size_t offset : neighbourOffsets)
+                {
+                    size_t neighbour = cell + offset;
+                    if (neighbour == target)
+                    {
+                        cameFrom[target] = cell;
+                        distance[target] = nextDistance;
+                        found = true;
+                        break;
+                    }
+                    if (!test(this->empty, neighbour) || test(closed, neighbour))
+                        continue;
+                    auto known = distance.find(neighbour);
+                    if (known != distance.end() && known->second <= nextDistance)
+                        continue;
+                    distance[neighbour] = nextDistance;
+                    cameFrom[neighbour] = cell;
+                    size_t nextF = nextDistance + heuristic(neighbour);
+                    if (nextF >= buckets.size())
+                        buckets.resize(nextF + 1);
+                    buckets[nextF].push_back(neighbour);
+                }
+            }
+        }
+        if (!found)
+            return result;
+
+        result.length = distance[target];
+        for (size_t cell = target;; cell = cameFrom[cell])
+        {
+            int cellX, cellY;
+            this->toCoordinate(cell, cellX, cellY);
+            result.path.push_back(std::make_tuple(cellX, cellY));
+            if (cell == start)
+                break;
+        }
+        std::reverse(result.path.begin(), result.path.end());
+        return result;
+    }
+
+    // Cables from every plant to the connection point, or only one per cluster if clusters are given
+    CableNetwork routeAll(int targetX, int targetY, ClusterIndex *clusters = nullptr)
+    {
+        CableNetwork network;
+        std::unordered_map<long long, bool> reachedClusters;
+        long long remaining = clusters != nullptr ? clusters->getClusterCount() : this->buildingCount;
+
+        auto record = [&](size_t cell, long long length)
+        {
+            CableRoute route;
+            this->toCoordinate(cell, route.x, route.y);
+            route.length = length;
+            // The first plant of a cluster we find is the closest one, the others don't need their own cable
+            if (clusters != nullptr && !reachedClusters.emplace(clusters->getClusterIdAt(route.x, route.y), true).second)
+                return;
+            network.routes.push_back(route);
+            network.totalLength += length;
+            remaining--;
+        };
+
+        // The border counts as visited from the start, so a single test tells if a cell still has to be looked at
+        std::vector<uint64_t> visited(this->empty.size());
+        for (size_t i = 0; i < visited.size(); i++)
+            visited[i] = ~(this->empty[i] | this->buildings[i]);
+        size_t target = this->index(targetX, targetY);
+        mark(visited, target);
+        if (test(this->buildings, target))
+            record(target, 0);
+
+        // Half the memory for the queues makes the search noticeably faster, so use 32 bit if the grid is small enough
+        if (visited.size() * 64 <= UINT32_MAX)
+            this->searchLevels<uint32_t>(target, visited, remaining, record);
+        else
+            this->searchLevels<size_t>(target, visited, remaining, record);
+
+        network.unreachable = remaining;
+        network.totalCost = network.totalLength * this->cablePrice;
+        return network;
+    }
+};
+
+#endif
@@ -0,0 +1,338 @@
+#include <vector>
+#include <array>
+#include <memory>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <mutex>
+#include <cstdint>
+#include <algorithm>
+#include "simulationstool.h"
+
+#ifndef RULES_H
+#define RULES_H
+
+enum RULE_KIND
+{
+    // The two types must be at least distance cells apart (in every direction, diagonals count as 1)
+    MIN_SPACING = 0,
+    // The type can only be placed on water cells
+    NEEDS_WATER = 1
+};
+
+struct PlacementRule
+{
+    RULE_KIND kind;
+    BuildingId first;
+    BuildingId second = 0;
+    int distance = 0;
+};
+
+/*
+One bit per cell, kept in tiles of 64x64 cells like the grid, so every row of a tile is one word.
+Tiles without a set bit all share one empty tile, a bitmap of a huge grid only costs a pointer per
+tile until bits are set. Copies share their tiles too, a shared tile is copied before it changes.
+*/
+class CellBitmap
+{
+private:
+    typedef std::array<uint64_t, GridTile::SIZE> Tile;
+
+    int height = 0;
+    int width = 0;
+    int tileColumns = 0;
+    CountedVector<std::shared_ptr<Tile>, MEMORY_STATISTICS> tiles;
+
+    static const std::shared_ptr<Tile> &getEmptyTile()
+    {
+        // allocate_shared value-initializes the array, so no bit is set
+        static const std::shared_ptr<Tile> emptyTile = makeCounted<Tile, MEMORY_STATISTICS>();
+        return emptyTile;
+    }
+
+    // The bits of row x in the tile column tileY
+    uint64_t getWord(int x, int tileY) const { return (*this->tiles[(size_t)(x / GridTile::SIZE) * this->tileColumns + tileY])[x % GridTile::SIZE]; }
+
+public:
+    void resize(int h, int w)
+    {
+        this->height = h;
+        this->width = w;
+        this->tileColumns = (w + GridTile::SIZE - 1) / GridTile::SIZE;
+        int tileRows = (h + GridTile::SIZE - 1) / GridTile::SIZE;
+        this->tiles.assign((size_t)tileRows * this->tileColumns, getEmptyTile());
+    }
+
+    bool get(int x, int y) const { return (this->getWord(x, y / GridTile::SIZE) >> (y % GridTile::SIZE)) & 1; }
+
+    void set(int x, int y, bool value)
+    {
+        std::shared_ptr<Tile> &tile = this->tiles[(size_t)(x / GridTile::SIZE) * this->tileColumns + y / GridTile::SIZE];
+        uint64_t word = (*tile)[x % GridTile::SIZE];
+        uint64_t bit = (uint64_t)1 << (y % GridTile::SIZE);
+        uint64_t changed = value ? (word | bit) : (word & ~bit);
+        if (changed == word)
+            return;
+        // The empty tile and the tiles of copies are never changed in place
+        if (tile.use_count() > 1)
+            tile = makeCounted<Tile, MEMORY_STATISTICS>(*tile);
+        (*tile)[x % GridTile::SIZE] = changed;
+    }
+
+    // Checks if any bit in the rectangle [x0, x1] x [y0, y1] is set, the rectangle is clipped to the grid
+    bool any(int x0, int y0, int x1, int y1) const
+    {
+        x0 = std::max(x0, 0);
+        y0 = std::max(y0, 0);
+        x1 = std::min(x1, this->height - 1);
+        y1 = std::min(y1, this->width - 1);
+        if (x0 > x1 || y0 > y1)
+            return false;
+        int firstTile = y0 / GridTile::SIZE, lastTile = y1 / GridTile::SIZE;
+        uint64_t firstMask = ~(uint64_t)0 << (y0 % GridTile::SIZE);
+        uint64_t lastMask = ~(uint64_t)0 >> (GridTile::SIZE - 1 - y1 % GridTile::SIZE);
+        for (int x = x0; x <= x1; x++)
+        {
+            for (int tileY = firstTile; tileY <= lastTile; tileY++)
+            {
+                uint64_t mask = ~(uint64_t)0;
+                if (tileY == firstTile)
+                    mask &= firstMask;
+                if (tileY == lastTile)
+                    mask &= lastMask;
+                if (this->getWord(x, tileY) & mask)
+                    return true;
+            }
+        }
+        return false;
+    }
+};
+
+/*
+Additional rules for placing buildings: minimum distances between types (which also covers
+"may not be next to each other") and types that need water cells.
+For every type that appears in a spacing rule the rules keep a bitmap of where these buildings
+are, so checking a placement only looks at the (2 * distance - 1)^2 cells around it and never
+at the whole grid.
+*/
+class PlacementRules : public PlacementValidator
+{
+private:
+    std::vector<PlacementRule> rules;
+    CellBitmap water;
+    // One bitmap per BuildingId, empty for the types no spacing rule talks about
+    std::vector<CellBitmap> occupied;
+    std::vector<bool> tracked;
+    std::vector<std::string> labels;
+    std::mutex lock;
+    int height = 0;
+    int width = 0;
+
+    static bool parseCoordinate(const std::string &text, int &x, int &y)
+    {
+        // XxY, just like the user types it, X is the column and Y the row
+        size_t separator = text.find('x');
+        if (separator == std::string::npos)
+            return false;
+        try
+        {
+            y = std::stoi(text.substr(0, separator)) - 1;
+            x = std::stoi(text.substr(separator + 1)) - 1;
+        }
+        catch (...)
+        {
+            return false;
+        }
+        return true;
+    }
+
+    int findType(const std::string &label)
+    {
+        for (size_t i = 1; i < this->labels.size(); i++)
+        {
+            if (this->labels[i] == label)
+                return (int)i;
+        }
+        return -1;
+    }
+
+public:
+    PlacementRules(int h, int w)
+    {
+        this->height = h;
+        this->width = w;
+        this->water.resize(h, w);
+    }
+
+    // Has to be called before attach, the bitmaps are only built there
+    void addRule(PlacementRule rule) { this->rules.push_back(rule); }
+    std::vector<PlacementRule> &getRules() { return this->rules; }
+
+    // A copy of the water cells that shares their tiles, for code that checks placements on a grid of its own (like the optimizer)
+    CellBitmap getWater()
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return this->water;
+    }
+
+    void setWater(int x, int y, bool isWater)
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->water.set(x, y, isWater);
+    }
+
+    /*
+    Loads rules from a text file with one rule per line, the types are given by their labels:
+        spacing W W 3       two W must be at least 3 cells apart
+        apart W S           a W may not be next to a S (the same as spacing W S 2)
+        water H             H can only be placed on water
+        lake 1x1 4x6        the cells from 1x1 to 4x6 are water
+    Empty lines and lines starting with # are skipped. Gives back false and prints the line if it can't be read.
+    */
+    bool load(const std::string &path, CapycitySim &simulation, OutputSink &output)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            output << "[!] Could not open " << path << "\n";
+            return false;
+        }
+        this->labels.assign(1, EmptyBuilding().getLabel());
+        for (Building &buildingType : simulation.getBuildingTypes())
+        {
+            this->labels.push_back(buildingType.getLabel());
+        }
+
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(file, line))
+        {
+            lineNumber++;
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::stringstream lineStream(line);
+            std::string kind, first, second, third;
+            lineStream >> kind >> first >> second >> third;
+            bool valid = false;
+            if (kind == "spacing" || kind == "apart")
+            {
+                int firstType = this->findType(first), secondType = this->findType(second);
+                int distance = 2;
+                if (kind == "spacing")
+                {
+                    try
+                    {
+                        distance = std::stoi(third);
+                    }
+                    catch (...)
+                    {
+                        distance = -1;
+                    }
+                }
+                valid = firstType > 0 && secondType > 0 && distance > 0;
+                if (valid)
+                    this->addRule(PlacementRule{MIN_SPACING, (BuildingId)firstType, (BuildingId)secondType, distance});
+            }
+            else if (kind == "water")
+            {
+                int type = this->findType(first);
+                valid = type > 0;
+                if (valid)
+                    this->addRule(PlacementRule{NEEDS_WATER, (BuildingId)type});
+            }
+            else if (kind == "lake")
+            {
+                int x0, y0, x1, y1;
+                valid = parseCoordinate(first, x0, y0) && parseCoordinate(second, x1, y1);
+                if (valid)
+                {
+                    for (int x = std::max(0, std::min(x0, x1)); x <= std::min(this->height - 1, std::max(x0, x1)); x++)
+                    {
+                        for (int y = std::max(0, std::min(y0, y1)); y <= std::min(this->width - 1, std::max(y0, y1)); y++)
+                        {
+                            this->setWater(x, y, true);
+                        }
+                    }
+                }
+            }
+            if (!valid)
+            {
+                output << "[!] Invalid rule in line " << lineNumber << ": " << line << "\n";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Builds the bitmaps from the current grid and checks every change from now on
+    void attach(CapycitySim &simulation)
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->labels.assign(1, EmptyBuilding().getLabel());
+        for (Building &buildingType : simulation.getBuildingTypes())
+        {
+            this->labels.push_back(buildingType.getLabel());
+        }
+        this->tracked.assign(this->labels.size(), false);
+        for (PlacementRule &rule : this->rules)
+        {
+            if (rule.kind == MIN_SPACING)
+            {
+                this->tracked[rule.first] = true;
+                this->tracked[rule.second] = true;
+            }
+        }
+        this->occupied.assign(this->labels.size(), CellBitmap());
+        for (size_t id = 1; id < this->labels.size(); id++)
+        {
+            if (this->tracked[id])
+                this->occupied[id].resize(this->height, this->width);
+        }
+
+        std::shared_ptr<const GridSnapshot> snapshot = simulation.setValidator(this);
+        snapshot->forEachBuilding([&](int x, int y, BuildingId id)
+                                  {
+            if (this->tracked[id])
+                this->occupied[id].set(x, y, true); });
+    }
+
+    void detach(CapycitySim &simulation) { simulation.setValidator(nullptr); }
+
+    bool allows(int x, int y, BuildingId, BuildingId newId, OutputSink &output) override
+    {
+        // Removing a building is always fine
+        if (newId == 0)
+            return true;
+        std::lock_guard<std::mutex> guard(this->lock);
+        for (PlacementRule &rule : this->rules)
+        {
+            if (rule.kind == NEEDS_WATER && rule.first == newId && !this->water.get(x, y))
+            {
+                output << "[!] " << this->labels[newId] << " can only be placed on water\n";
+                return false;
+            }
+            if (rule.kind != MIN_SPACING || (rule.first != newId && rule.second != newId))
+                continue;
+            // The rule works in both directions, so look for the other type of the rule
+            BuildingId other = rule.first == newId ? rule.second : rule.first;
+            int reach = rule.distance - 1;
+            if (this->occupied[other].any(x - reach, y - reach, x + reach, y + reach))
+            {
+                output << "[!] " << this->labels[newId] << " must be at least " << rule.distance << " cells away from any " << this->labels[other] << "\n";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void onAccepted(int x, int y, BuildingId oldId, BuildingId newId) override
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        if (oldId != 0 && this->tracked[oldId])
+            this->occupied[oldId].set(x, y, false);
+        if (newId != 0 && this->tracked[newId])
+            this->occupied[newId].set(x, y, true);
+    }
+};
+
+#endif
@@ -0,0 +1,163 @@
+#include <vector>
+#include <string>
+#include <cmath>
+#include "simulationstool.h"
+
+#ifndef SCENARIOS_H
+#define SCENARIOS_H
+
+// The total cost of the site under every scenario, scenario 0 always has the current prices
+struct ScenarioTable
+{
+    std::vector<std::string> names;
+    std::vector<Cents> totals;
+};
+
+/*
+A matrix of prices, one row per scenario and one column per material and per building type (its base price).
+What the site costs only depends on how much of every column it uses: the materials come from the
+recipes of the building types times how many of them are placed. So evaluating every scenario is one
+matrix-vector product. The matrix is stored column by column, then the inner loop runs over all
+scenarios of one column with a fixed amount, which the compiler turns into vector instructions.
+*/
+class PriceScenarios
+{
+private:
+    std::vector<std::string> columnNames;
+    int materialCount = 0;
+    // How much of every material one building of each type needs, the index is BuildingId - 1
+    std::vector<std::vector<long long>> recipes;
+    std::vector<std::string> scenarioNames;
+    // prices[column * scenarioCount + scenario]
+    std::vector<Cents> prices;
+    std::vector<Cents> currentPrices;
+
+    int getScenarioCount() { return this->scenarioNames.size(); }
+
+public:
+    // The columns are every material the recipes use in the order they first show up, then the building labels
+    PriceScenarios(std::vector<Building> &buildingTypes)
+    {
+        std::vector<Cents> materialPrices;
+        for (Building &buildingType : buildingTypes)
+        {
+            for (Material &material : buildingType.getNecessaryMaterials())
+            {
+                if (this->getColumn(material.getName()) != -1)
+                    continue;
+                this->columnNames.push_back(material.getName());
+                materialPrices.push_back(material.getPrice());
+            }
+        }
+        this->materialCount = this->columnNames.size();
+        this->currentPrices = materialPrices;
+        for (Building &buildingType : buildingTypes)
+        {
+            std::vector<long long> recipe(this->materialCount, 0);
+            for (Material &material : buildingType.getNecessaryMaterials())
+                recipe[this->getColumn(material.getName())]++;
+            this->recipes.push_back(recipe);
+            this->columnNames.push_back(buildingType.getLabel());
+            this->currentPrices.push_back(buildingType.getBasePrice());
+        }
+        this->add("Current");
+    }
+
+    // The index of the material or building label, -1 if there is no such column
+    int getColumn(const std::string &name)
+    {
+        for (size_t i = 0; i < this->columnNames.size(); i++)
+        {
+            if (this->columnNames[i] == name)
+                return (int)i;
+        }
+        return -1;
+    }
+
+    std::vector<std::string> &getColumnNames() { return this->columnNames; }
+    std::vector<std::string> &getScenarioNames() { return this->scenarioNames; }
+
+    // Adds a scenario that starts with the current prices and gives back its index
+    int add(const std::string &name)
+    {
+        int oldCount = this->getScenarioCount();
+        std::vector<Cents> grown((size_t)(oldCount + 1) * this->columnNames.size());
+        for (size_t column = 0; column < this->columnNames.size(); column++)
+        {
+            for (int scenario = 0; scenario < oldCount; scenario++)
+                grown[column * (oldCount + 1) + scenario] = this->prices[column * oldCount + scenario];
+            grown[column * (oldCount + 1) + oldCount] = this->currentPrices[column];
+        }
+        this->prices.swap(grown);
+        this->scenarioNames.push_back(name);
+        return oldCount;
+    }
+
+    void setPrice(int scenario, int column, Cents price) { this->prices[(size_t)column * this->getScenarioCount() + scenario] = price; }
+    Cents getPrice(int scenario, int column) { return this->prices[(size_t)column * this->getScenarioCount() + scenario]; }
+
+    // Changes the price by the given percentage of the current price, rounded to whole cents
+    void changeBy(int scenario, int column, double percent)
+    {
+        this->setPrice(scenario, column, std::llround(this->currentPrices[column] * (1 + percent / 100)));
+    }
+
+    // What the buildings of the snapshot cost in every scenario
+    ScenarioTable evaluate(const GridSnapshot &snapshot)
+    {
+        // How much of every column the site uses
+        std::vector<long long> amounts(this->columnNames.size(), 0);
+        for (size_t type = 0; type < this->recipes.size(); type++)
+        {
+            long long count = snapshot.buildingCounts[type + 1];
+            amounts[this->materialCount + type] = count;
+            for (int material = 0; material < this->materialCount; material++)
+                amounts[material] += count * this->recipes[type][material];
+        }
+
+        ScenarioTable table;
+        table.names = this->scenarioNames;
+        int scenarioCount = this->getScenarioCount();
+        table.totals.assign(scenarioCount, 0);
+        Cents *totals = table.totals.data();
+        for (size_t column = 0; column < amounts.size(); column++)
+        {
+            long long amount = amounts[column];
+            if (amount == 0)
+                continue;
+            const Cents *columnPrices = &this->prices[column * scenarioCount];
+            for (int scenario = 0; scenario < scenarioCount; scenario++)
+                totals[scenario] += amount * columnPrices[scenario];
+        }
+        return table;
+    }
+};
+
+void printScenarios(OutputSink &output, const ScenarioTable &table)
+{
+    output << "[*] Scenarios:\n";
+    Cents current = table.totals[0];
+    for (size_t i = 0; i < table.totals.size(); i++)
+    {
+        output << " " << (long long)i << ": " << table.names[i] << ", ";
+        output.writeCents(table.totals[i]);
+        output << "$";
+        if (i > 0)
+        {
+            Cents change = table.totals[i] - current;
+            output << " (" << (change >= 0 ? "+" : "");
+            output.writeCents(change);
+            output << "$";
+            if (current != 0)
+            {
+                output << ", " << (change >= 0 ? "+" : "");
+                output.writeFixed(change * 100.0 / current, 1);
+                output << "%";
+            }
+            output << ")";
+        }
+        output << "\n";
+    }
+}
+
+#endif
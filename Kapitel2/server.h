@@ -0,0 +1,597 @@
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <sstream>
+#include "simulationstool.h"
+#include "outputsink.h"
+#include "report.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#endif
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#ifdef __linux__
+
+/*
+Lets several local clients work on one simulation at the same time.
+The clients send the same commands as the menu, one per line:
+    place XxY <building type>
+    delete XxY
+    print [width]
+    summary
+    report <json|csv> [summary|regions|buildings]
+    types
+    quit
+Every answer ends with a line containing only a "."
+
+One epoll loop does all the socket work, the commands themselves run on a pool of workers.
+Commands that only read (print, summary, report, types) work on a snapshot of the grid, so they run
+at the same time as each other and as place/delete, which the simulation itself serializes.
+Commands of one connection are answered in the order they came in.
+SIGINT and SIGTERM stop the server, it finishes the running commands and closes every connection.
+*/
+class CapycityServer
+{
+private:
+    struct Connection
+    {
+        int fd;
+        uint64_t id;
+        std::string readBuffer;
+        std::string writeBuffer;
+        size_t writeOffset = 0;
+        std::deque<std::string> pendingCommands;
+        // True while one of our commands is running on a worker
+        bool busy = false;
+        bool closing = false;
+        bool lineTooLong = false;
+        // What the connection is registered for in epoll right now
+        uint32_t events = EPOLLIN | EPOLLRDHUP;
+    };
+
+    struct Job
+    {
+        uint64_t connectionId;
+        std::string command;
+    };
+
+    struct Result
+    {
+        uint64_t connectionId;
+        std::string response;
+    };
+
+    CapycitySim &simulation;
+
+    int listenFd = -1;
+    int epollFd = -1;
+    // The workers use this to wake up the event loop when they are done with a job
+    int wakeFd = -1;
+    // Becomes readable when SIGINT or SIGTERM arrive
+    int signalFd = -1;
+    std::string unixPath;
+
+    std::map<uint64_t, std::unique_ptr<Connection>> connections;
+    std::map<int, uint64_t> connectionIds;
+    uint64_t nextConnectionId = 1;
+
+    std::vector<std::thread> workers;
+    std::deque<Job> jobs;
+    std::mutex jobsLock;
+    std::condition_variable jobsAvailable;
+    std::vector<Result> results;
+    std::mutex resultsLock;
+    std::atomic<bool> running{false};
+
+    // A command line longer than this is not a command, the connection gets closed
+    static const size_t MAX_LINE_LENGTH = 64 * 1024;
+
+    static sigset_t getShutdownSignals()
+    {
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        return signals;
+    }
+
+    static bool setNonBlocking(int fd)
+    {
+        int flags = fcntl(fd, F_GETFL, 0);
+        return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+    }
+
+    // Only digits and at most 9 of them like is_int of the menu, so std::stoi can't throw on what a client sends
+    static bool isSmallNumber(const std::string &text)
+    {
+        return !text.empty() && text.length() <= 9 && text.find_first_not_of("0123456789") == std::string::npos;
+    }
+
+    // Parses "XxY" the same way the menu does, returns -1/-1 if it is not valid
+    static std::tuple<int, int> parseCoordinate(const std::string &parts)
+    {
+        size_t delim = parts.find('x');
+        if (delim == std::string::npos)
+            return std::make_tuple(-1, -1);
+        std::string first = parts.substr(0, delim);
+        std::string second = parts.substr(delim + 1);
+        if (!isSmallNumber(first) || !isSmallNumber(second))
+            return std::make_tuple(-1, -1);
+        // Substract one because normal humans don't start to count from 0
+        int y = std::stoi(first) - 1;
+        int x = std::stoi(second) - 1;
+        return std::make_tuple(x, y);
+    }
+
+    // Runs a single command and writes the answer to output
+    void handleCommand(const std::string &command, OutputSink &output)
+    {
+        std::stringstream commandStream(command);
+        std::string name, argument, buildingString;
+        commandStream >> name >> argument >> buildingString;
+
+        if (name == "place" || name == "delete")
+        {
+            int x, y;
+            std::tie(x, y) = parseCoordinate(argument);
+            if (x < 0 || y < 0)
+            {
+                output << "[!] Invalid coordinates\n";
+                return;
+            }
+            if (name == "delete")
+            {
+                this->simulation.setBuilding(x, y, EmptyBuilding(), output);
+                return;
+            }
+            std::vector<Building> &buildingTypes = this->simulation.getBuildingTypes();
+            if (!isSmallNumber(buildingString) || std::stoul(buildingString) >= buildingTypes.size())
+            {
+                output << "[!] Not a valid building type\n";
+                return;
+            }
+            this->simulation.setBuilding(x, y, buildingTypes[std::stoul(buildingString)], output);
+        }
+        else if (name == "print")
+        {
+            // There is no terminal on the other side, so the client tells us how wide it is
+            int width = 1000;
+            if (isSmallNumber(argument))
+                width = std::stoi(argument);
+            this->simulation.printInfo(output, width);
+        }
+        else if (name == "summary")
+        {
+            this->simulation.printSummary(output);
+        }
+        else if (name == "report")
+        {
+            // The same tables as the Report menu entry, summary if no table is given
+            if (argument != "json" && argument != "csv")
+            {
+                output << "[!] Only json and csv are supported\n";
+                return;
+            }
+            std::string table = buildingString.empty() ? "summary" : buildingString;
+            if (table != "summary" && table != "regions" && table != "buildings")
+            {
+                output << "[!] Invalid table " << table << "\n";
+                return;
+            }
+            std::shared_ptr<const GridSnapshot> snapshot = this->simulation.getSnapshot();
+            ReportWriter writer(output, argument == "json" ? JSON : CSV);
+            writer.begin();
+            if (table == "summary")
+                writeSummaryTable(writer, *snapshot, this->simulation.getBuildingTypes());
+            else if (table == "regions")
+                writeRegionTable(writer, *snapshot, this->simulation.getBuildingTypes());
+            else
+                writeBuildingTable(writer, *snapshot, this->simulation.getBuildingTypes());
+            writer.end();
+        }
+        else if (name == "types")
+        {
+            this->simulation.printAllBuildingTypes(output);
+        }
+        else if (name == "memory")
+        {
+            printMemoryUsage(output);
+        }
+        else
+        {
+            output << "[!] Invalid choice\n";
+        }
+    }
+
+    void workerLoop()
+    {
+        MemoryOutputSink output;
+        while (true)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(this->jobsLock);
+                this->jobsAvailable.wait(lock, [this]
+                                         { return !this->jobs.empty() || !this->running; });
+                if (this->jobs.empty())
+                    return;
+                job = std::move(this->jobs.front());
+                this->jobs.pop_front();
+            }
+
+            output.clear();
+            this->handleCommand(job.command, output);
+            output << ".\n";
+
+            {
+                std::lock_guard<std::mutex> lock(this->resultsLock);
+                this->results.push_back(Result{job.connectionId, output.getContents()});
+            }
+            uint64_t one = 1;
+            ::write(this->wakeFd, &one, sizeof(one));
+        }
+    }
+
+    void updateEvents(Connection &connection)
+    {
+        // Only ask for EPOLLOUT while there is something we could not write yet.
+        // Once the connection is closing nothing is read anymore, a half closed client would wake us up all the time otherwise
+        uint32_t events = 0;
+        if (!connection.closing)
+            events |= EPOLLIN | EPOLLRDHUP;
+        if (connection.writeOffset < connection.writeBuffer.length())
+            events |= (uint32_t)EPOLLOUT;
+        if (events == connection.events)
+            return;
+        connection.events = events;
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = connection.fd;
+        epoll_ctl(this->epollFd, EPOLL_CTL_MOD, connection.fd, &event);
+    }
+
+    void closeConnection(Connection &connection)
+    {
+        epoll_ctl(this->epollFd, EPOLL_CTL_DEL, connection.fd, nullptr);
+        close(connection.fd);
+        this->connectionIds.erase(connection.fd);
+        // This destroys the connection, so it must be the last thing we do with it
+        this->connections.erase(connection.id);
+    }
+
+    // Returns false if the connection was closed
+    bool flushConnection(Connection &connection)
+    {
+        while (connection.writeOffset < connection.writeBuffer.length())
+        {
+            ssize_t written = ::send(connection.fd, connection.writeBuffer.data() + connection.writeOffset,
+                                     connection.writeBuffer.length() - connection.writeOffset, MSG_NOSIGNAL);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    break;
+                this->closeConnection(connection);
+                return false;
+            }
+            connection.writeOffset += written;
+        }
+        if (connection.writeOffset == connection.writeBuffer.length())
+        {
+            connection.writeBuffer.clear();
+            connection.writeOffset = 0;
+        }
+        if (connection.closing && !connection.busy && connection.pendingCommands.empty() && connection.writeBuffer.empty())
+        {
+            this->closeConnection(connection);
+            return false;
+        }
+        this->updateEvents(connection);
+        return true;
+    }
+
+    // Hands the next command of the connection to the workers, if there is one and nothing else is running
+    void dispatchNext(Connection &connection)
+    {
+        while (!connection.busy && !connection.pendingCommands.empty())
+        {
+            std::string command = std::move(connection.pendingCommands.front());
+            connection.pendingCommands.pop_front();
+            if (command == "quit")
+            {
+                // Everything after quit is ignored
+                if (connection.lineTooLong)
+                    connection.writeBuffer += "[!] The line is too long\n.\n";
+                connection.pendingCommands.clear();
+                connection.closing = true;
+                break;
+            }
+            if (command.empty())
+                continue;
+            connection.busy = true;
+            {
+                std::lock_guard<std::mutex> lock(this->jobsLock);
+                this->jobs.push_back(Job{connection.id, std::move(command)});
+            }
+            this->jobsAvailable.notify_one();
+        }
+        this->flushConnection(connection);
+    }
+
+    void acceptConnections()
+    {
+        while (true)
+        {
+            int fd = accept4(this->listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+                return;
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+            std::unique_ptr<Connection> connection(new Connection());
+            connection->fd = fd;
+            connection->id = this->nextConnectionId++;
+            epoll_event event{};
+            event.events = EPOLLIN | EPOLLRDHUP;
+            event.data.fd = fd;
+            epoll_ctl(this->epollFd, EPOLL_CTL_ADD, fd, &event);
+            this->connectionIds[fd] = connection->id;
+            this->connections[connection->id] = std::move(connection);
+        }
+    }
+
+    // Splits the received data into commands, an incomplete last line stays in the buffer
+    void splitCommands(Connection &connection)
+    {
+        size_t lineStart = 0;
+        size_t lineEnd;
+        while ((lineEnd = connection.readBuffer.find('\n', lineStart)) != std::string::npos)
+        {
+            size_t length = lineEnd - lineStart;
+            if (length > 0 && connection.readBuffer[lineEnd - 1] == '\r')
+                length--;
+            connection.pendingCommands.push_back(connection.readBuffer.substr(lineStart, length));
+            lineStart = lineEnd + 1;
+        }
+        connection.readBuffer.erase(0, lineStart);
+    }
+
+    void readConnection(Connection &connection)
+    {
+        char chunk[16 * 1024];
+        while (!connection.closing)
+        {
+            ssize_t received = ::recv(connection.fd, chunk, sizeof(chunk), 0);
+            if (received > 0)
+            {
+                connection.readBuffer.append(chunk, received);
+                this->splitCommands(connection);
+                if (connection.readBuffer.length() > MAX_LINE_LENGTH)
+                {
+                    // Answer what came before the line and close afterwards
+                    connection.pendingCommands.push_back("quit");
+                    connection.readBuffer.clear();
+                    connection.lineTooLong = true;
+                    connection.closing = true;
+                }
+                continue;
+            }
+            if (received < 0 && errno == EINTR)
+                continue;
+            if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            // The client hung up, answer what is still open and close afterwards
+            connection.closing = true;
+        }
+        this->dispatchNext(connection);
+    }
+
+    void collectResults()
+    {
+        uint64_t counter;
+        ::read(this->wakeFd, &counter, sizeof(counter));
+
+        std::vector<Result> finished;
+        {
+            std::lock_guard<std::mutex> lock(this->resultsLock);
+            finished.swap(this->results);
+        }
+        for (Result &result : finished)
+        {
+            auto it = this->connections.find(result.connectionId);
+            // The connection might be gone already
+            if (it == this->connections.end())
+                continue;
+            Connection &connection = *it->second;
+            connection.busy = false;
+            connection.writeBuffer += result.response;
+            this->dispatchNext(connection);
+        }
+    }
+
+    bool startListening(int fd)
+    {
+        this->listenFd = fd;
+        if (listen(fd, SOMAXCONN) < 0 || !setNonBlocking(fd))
+        {
+            close(fd);
+            this->listenFd = -1;
+            return false;
+        }
+        return true;
+    }
+
+public:
+    CapycityServer(CapycitySim &simulation) : simulation(simulation) {}
+
+    ~CapycityServer()
+    {
+        this->stop();
+        if (this->listenFd != -1)
+            close(this->listenFd);
+        if (!this->unixPath.empty())
+            unlink(this->unixPath.c_str());
+    }
+
+    bool listenUnix(const std::string &path)
+    {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (fd < 0 || path.length() >= sizeof(address.sun_path))
+            return false;
+        path.copy(address.sun_path, path.length());
+        // Remove a socket file an older server left behind
+        unlink(path.c_str());
+        if (bind(fd, (sockaddr *)&address, sizeof(address)) < 0)
+        {
+            close(fd);
+            return false;
+        }
+        this->unixPath = path;
+        return this->startListening(fd);
+    }
+
+    bool listenTcp(int port)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return false;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        // Only local clients are allowed
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd, (sockaddr *)&address, sizeof(address)) < 0)
+        {
+            close(fd);
+            return false;
+        }
+        return this->startListening(fd);
+    }
+
+    // The signals have to be blocked before any other thread is started, otherwise one of them gets the signal instead of the signalfd
+    static void blockShutdownSignals()
+    {
+        sigset_t signals = getShutdownSignals();
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    }
+
+    // Blocks until stop() is called or SIGINT/SIGTERM arrive
+    void run(int workerCount = std::thread::hardware_concurrency())
+    {
+        if (this->listenFd == -1)
+            return;
+        this->epollFd = epoll_create1(EPOLL_CLOEXEC);
+        this->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = this->listenFd;
+        epoll_ctl(this->epollFd, EPOLL_CTL_ADD, this->listenFd, &event);
+        event.data.fd = this->wakeFd;
+        epoll_ctl(this->epollFd, EPOLL_CTL_ADD, this->wakeFd, &event);
+        sigset_t signals = getShutdownSignals();
+        this->signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+        event.data.fd = this->signalFd;
+        epoll_ctl(this->epollFd, EPOLL_CTL_ADD, this->signalFd, &event);
+
+        this->running = true;
+        for (int i = 0; i < std::max(workerCount, 1); i++)
+        {
+            this->workers.emplace_back(&CapycityServer::workerLoop, this);
+        }
+
+        epoll_event events[256];
+        while (this->running)
+        {
+            int eventCount = epoll_wait(this->epollFd, events, 256, 200);
+            for (int i = 0; i < eventCount; i++)
+            {
+                int fd = events[i].data.fd;
+                if (fd == this->listenFd)
+                {
+                    this->acceptConnections();
+                    continue;
+                }
+                if (fd == this->wakeFd)
+                {
+                    this->collectResults();
+                    continue;
+                }
+                if (fd == this->signalFd)
+                {
+                    signalfd_siginfo signal;
+                    ::read(this->signalFd, &signal, sizeof(signal));
+                    this->stop();
+                    continue;
+                }
+                auto it = this->connectionIds.find(fd);
+                if (it == this->connectionIds.end())
+                    continue;
+                Connection &connection = *this->connections[it->second];
+                if (events[i].events & EPOLLOUT)
+                {
+                    if (!this->flushConnection(connection))
+                        continue;
+                }
+                if (events[i].events & (EPOLLHUP | EPOLLERR))
+                {
+                    // Nobody is there anymore who could read the answers
+                    this->closeConnection(connection);
+                    continue;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP))
+                {
+                    this->readConnection(connection);
+                }
+            }
+        }
+
+        for (std::thread &worker : this->workers)
+        {
+            worker.join();
+        }
+        this->workers.clear();
+        while (!this->connections.empty())
+        {
+            this->closeConnection(*this->connections.begin()->second);
+        }
+        close(this->signalFd);
+        close(this->wakeFd);
+        close(this->epollFd);
+    }
+
+    void stop()
+    {
+        this->running = false;
+        this->jobsAvailable.notify_all();
+    }
+};
+
+#endif
+
+#endif
@@ -3,10 +3,73 @@
 #include <vector>
 #include <sstream>
 #include <tuple>
+#include <climits>
+#include <cstdint>
+#include <stdexcept>
 #include "simulationstool.h"
+#include "server.h"
+#include "energy.h"
+#include "interaction.h"
+#include "optimizer.h"
+#include "concurrent.h"
+#include "rules.h"
+#include "clusters.h"
+#include "routing.h"
+#include "overview.h"
+#include "imageexport.h"
+#include "journal.h"
+#include "scenarios.h"
+#include "variants.h"
+#include "diff.h"
+#include "snapshotfile.h"
+#include "portfolio.h"
+#include "report.h"
+#include "timeseries.h"
 using namespace std;
 
+// The site the menu works on, either the main site or one of its variants
 CapycitySim *simulation;
+CapycitySim *mainSite;
+// The what-if versions of the main site and the one that is open, empty for the main site
+SiteVariants variants;
+string currentVariant;
+// Wake and shading losses, kept up to date on every change of the simulation once a menu entry needed them
+InteractionModel interactions;
+bool interactionsAttached = false;
+// The connected groups of buildings, kept up to date like the interactions
+ClusterIndex clusters;
+bool clustersAttached = false;
+// Block counts for the zoomed out overview
+OverviewPyramid overview;
+// Spacing and water rules from --rules, nullptr if there are none
+PlacementRules *rules = nullptr;
+// Every change is written to it in the background if --journal is given
+Journal journal;
+OutputSink &output = terminalOutput();
+
+// The interactions of the open site, they are only computed the first time they are needed
+InteractionModel &getInteractionModel()
+{
+    if (!interactionsAttached)
+        interactions.attach(*simulation);
+    interactionsAttached = true;
+    return interactions;
+}
+
+ClusterIndex &getClusterIndex()
+{
+    if (!clustersAttached)
+        clusters.attach(*simulation);
+    clustersAttached = true;
+    return clusters;
+}
+
+// Everything we printed so far has to be visible before we wait for the user
+void readLine(string &line)
+{
+    output.flush();
+    getline(cin, line);
+}
 
 // https://stackoverflow.com/questions/4654636/how-to-determine-if-a-string-is-a-number-with-c
 bool is_number(const std::string &s)
@@ -17,6 +80,12 @@ bool is_number(const std::string &s)
     return !s.empty() && it == s.end();
 }
 
+// Like is_number, but the number also has to fit into an int
+bool is_int(const std::string &s)
+{
+    return is_number(s) && s.length() <= 9;
+}
+
 tuple<int, int> getCoordinateFromUser(std::string prompt = "Where do you want to place the building? (Format XxY)")
 {
     // Init some variables we need for getting x and y of the "map"
@@ -25,10 +94,10 @@ tuple<int, int> getCoordinateFromUser(std::string prompt = "Where do you want to
     char delim = 'x';
 
     // Prompt the user for the coordinates of the "map"
-    cout << "[?] " << prompt << endl;
-    cout << "> ";
+    output << "[?] " << prompt << "\n";
+    output << "> ";
     // Read the coordinates from the console
-    getline(cin, parts);
+    readLine(parts);
     stringstream partsStream = stringstream(parts);
     string part;
     // Split the coordinates into an array
@@ -59,7 +128,7 @@ void deleteBuilding()
     tie(x, y) = getCoordinateFromUser("Which building do you want to delete? (Format XxY)");
     if (x == -1 || y == -1)
     {
-        cout << "[!] Invalid coordinates" << endl;
+        output << "[!] Invalid coordinates\n";
         return;
     }
     simulation->setBuilding(x, y, EmptyBuilding());
@@ -71,19 +140,19 @@ void pickPlacement()
     tie(x, y) = getCoordinateFromUser();
     if (x == -1 || y == -1)
     {
-        cout << "[!] Invalid coordinates" << endl;
+        output << "[!] Invalid coordinates\n";
         return;
     }
-    cout << "[?] Choose the building you want to place" << endl;
+    output << "[?] Choose the building you want to place\n";
 
     vector<Building> buildingTypes = simulation->getBuildingTypes();
 
     simulation->printAllBuildingTypes();
-    cout << "> ";
+    output << "> ";
     // Ask the user for the building type
     int buildingType = -1;
     string buildingString;
-    getline(cin, buildingString);
+    readLine(buildingString);
     // If it is just a number we already have the building type
     if (is_number(buildingString))
     {
@@ -91,42 +160,651 @@ void pickPlacement()
     }
     else
     {
-        cout << "[!] Not a valid building type" << endl;
+        output << "[!] Not a valid building type\n";
         return;
     }
     // If the supplied building is not a valid building return
     if (buildingType >= buildingTypes.size())
     {
-        cout << "[!] Not a valid building type" << endl;
+        output << "[!] Not a valid building type\n";
         return;
     }
     simulation->setBuilding(x, y, static_cast<Building>(buildingTypes[buildingType]));
 }
 
+// Asks the user for a weather profile, returns false if it could not be loaded
+bool readWeather(WeatherProfile &weather)
+{
+    output << "[?] Which weather profile should be used? (csv file with irradiance,windspeed,flow per hour, leave empty for the default year)\n";
+    output << "> ";
+    string path;
+    readLine(path);
+
+    if (path.empty())
+    {
+        weather = WeatherProfile::createDefault();
+    }
+    else if (!WeatherProfile::load(path, weather))
+    {
+        output << "[!] Could not load the weather profile\n";
+        return false;
+    }
+    return true;
+}
+
+void simulateEnergy()
+{
+    WeatherProfile weather;
+    if (!readWeather(weather))
+        return;
+
+    EnergyFleet fleet = EnergyFleet::fromSnapshot(*simulation->getSnapshot(), simulation->getBuildingTypes());
+    getInteractionModel().applyTo(fleet);
+    EnergyResult result = EnergySimulation().run(fleet, weather);
+    printEnergyReport(output, fleet, result);
+}
+
+// Asks the user for a number, returns false if it is not one
+bool readNumber(string question, double &value)
+{
+    output << question << "\n";
+    output << "> ";
+    string line;
+    readLine(line);
+    try
+    {
+        value = stod(line);
+    }
+    catch (...)
+    {
+        output << "[!] Not a valid number\n";
+        return false;
+    }
+    return true;
+}
+
+// Asks the user for a whole number that is not negative, returns false if it is not one or too big
+bool readWholeNumber(string question, unsigned long long maximum, unsigned long long &value)
+{
+    output << question << "\n";
+    output << "> ";
+    string line;
+    readLine(line);
+    try
+    {
+        if (!is_number(line))
+            throw invalid_argument(line);
+        value = stoull(line);
+    }
+    catch (...)
+    {
+        output << "[!] Not a valid number\n";
+        return false;
+    }
+    if (value > maximum)
+    {
+        output << "[!] The number is too big\n";
+        return false;
+    }
+    return true;
+}
+
+void optimizeLayout()
+{
+    OptimizerSettings settings;
+    settings.interactions = interactions.getSettings();
+    double budget;
+    unsigned long long seed, epochs;
+    if (!readNumber("[?] How much may the new buildings cost?", budget) ||
+        !readNumber("[?] How many seconds should the search take?", settings.timeLimit) ||
+        !readWholeNumber("[?] Which seed should be used? (the same seed and epochs give the same layout)", UINT64_MAX, seed) ||
+        !readWholeNumber("[?] After how many epochs should the search stop? (0 = when the time is up)", INT_MAX, epochs))
+        return;
+    settings.budget = llround(budget * 100);
+    settings.seed = seed;
+    settings.maxEpochs = (int)epochs;
+    settings.rules = rules;
+
+    output << "[*] Searching...\n";
+    output.flush();
+    OptimizerResult result = LayoutOptimizer().optimize(*simulation, settings);
+    output << "[*] Found " << (int)result.placements.size() << " new buildings for ";
+    output.writeCents(result.cost);
+    output << "$, the site would produce ";
+    output.writeFixed(result.energy / 1000, 2);
+    output << " MWh per year (" << result.epochs << " epochs, " << result.iterations << " moves)\n";
+    output << "[*] Seed " << to_string(seed) << " with " << result.epochs << " epochs gives this layout again\n";
+    if (result.placements.empty())
+        return;
+
+    output << "[?] Place them? (y/n)\n";
+    output << "> ";
+    string answer;
+    readLine(answer);
+    if (answer != "y")
+        return;
+    // The layout follows the rules, but the site might have changed while we were searching.
+    // Big layouts are placed from all threads, commit() then checks them like any other change
+    ConcurrentPlacement placement(*simulation);
+    parallelFor(result.placements.size(), [&](size_t begin, size_t end)
+                {
+        for (size_t i = begin; i < end; i++)
+            placement.place(result.placements[i].x, result.placements[i].y, result.placements[i].id); },
+                4096);
+    int placed = placement.commit(output);
+    if (placed < (int)result.placements.size())
+    {
+        output << "[!] " << (int)result.placements.size() - placed << " of the buildings were refused, the site produces less than estimated\n";
+    }
+}
+
+void showClusters()
+{
+    ClusterSettings settings;
+    double connectivity;
+    if (!readNumber("[?] Which connectivity should be used? (4 or 8)", connectivity))
+        return;
+    if (connectivity != 4 && connectivity != 8)
+    {
+        output << "[!] Only 4 and 8 are possible\n";
+        return;
+    }
+    settings.connectivity = connectivity;
+    output << "[?] Only connect buildings of the same type? (y/n)\n";
+    output << "> ";
+    string answer;
+    readLine(answer);
+    settings.perType = answer == "y";
+
+    // Only label everything again if something changed, otherwise the clusters are already up to date.
+    // If nothing was labeled yet, the new settings are used for the first labeling
+    ClusterSettings current = clusters.getSettings();
+    if (!clustersAttached)
+        clusters.setSettings(settings);
+    else if (current.connectivity != settings.connectivity || current.perType != settings.perType)
+        clusters.setSettings(settings, *simulation);
+    vector<Cluster> found = getClusterIndex().getClusters();
+    printClusters(output, found, *simulation);
+}
+
+// What one cell of cable costs
+const Cents CABLE_PRICE = 50;
+
+void planCables()
+{
+    int targetX, targetY;
+    tie(targetX, targetY) = getCoordinateFromUser("Where is the grid connection? (Format XxY)");
+    if (targetX < 0 || targetY < 0 || targetX >= simulation->getHeight() || targetY >= simulation->getWidth())
+    {
+        output << "[!] Invalid coordinates\n";
+        return;
+    }
+    double mode;
+    if (!readNumber("[?] Connect 1: one plant, 2: every plant or 3: every cluster?", mode))
+        return;
+
+    CableRouter router(*simulation->getSnapshot(), CABLE_PRICE);
+    if (mode == 1)
+    {
+        int x, y;
+        tie(x, y) = getCoordinateFromUser("Which plant should be connected? (Format XxY)");
+        if (x < 0 || y < 0 || x >= simulation->getHeight() || y >= simulation->getWidth())
+        {
+            output << "[!] Invalid coordinates\n";
+            return;
+        }
+        CableRoute route = router.route(x, y, targetX, targetY);
+        if (route.length < 0)
+        {
+            output << "[!] There is no way from " << (y + 1) << "x" << (x + 1) << " to the grid connection\n";
+            return;
+        }
+        output << "[*] The cable from " << (y + 1) << "x" << (x + 1) << " is " << route.length << " cells long and costs ";
+        output.writeCents(route.length * CABLE_PRICE);
+        output << "$\n";
+    }
+    else if (mode == 2 || mode == 3)
+    {
+        CableNetwork network = router.routeAll(targetX, targetY, mode == 3 ? &getClusterIndex() : nullptr);
+        output << "[*] " << (long long)network.routes.size() << (mode == 3 ? " clusters" : " plants") << " connected with " << network.totalLength << " cells of cable for ";
+        output.writeCents(network.totalCost);
+        output << "$\n";
+        if (network.unreachable > 0)
+            output << "[!] " << network.unreachable << " can't reach the grid connection\n";
+    }
+    else
+    {
+        output << "[!] Invalid choice\n";
+    }
+}
+
+void showOverview()
+{
+    double mode;
+    if (!readNumber("[?] Show 1: the main building type or 2: how densely it is built?", mode))
+        return;
+    if (mode != 1 && mode != 2)
+    {
+        output << "[!] Invalid choice\n";
+        return;
+    }
+    int columns, rows;
+    simulation->getTerminalSize(columns, rows);
+    // Leave some room for the headline and the menu prompt below
+    overview.render(output, *simulation->getSnapshot(), columns, rows - 3, mode == 1 ? DOMINANT_TYPE : DENSITY);
+}
+
+void exportImage()
+{
+    output << "[?] Where should the image be saved? (.png or .ppm)\n";
+    output << "> ";
+    string path;
+    readLine(path);
+    IMAGE_FORMAT format;
+    if (path.size() > 4 && path.substr(path.size() - 4) == ".png")
+        format = PNG;
+    else if (path.size() > 4 && path.substr(path.size() - 4) == ".ppm")
+        format = PPM;
+    else
+    {
+        output << "[!] Only .png and .ppm files are supported\n";
+        return;
+    }
+    unsigned long long scale;
+    if (!readWholeNumber("[?] How many pixels should one cell be wide?", INT_MAX, scale))
+        return;
+    // Checked before the file is opened, so an existing file stays as it is
+    std::shared_ptr<const GridSnapshot> snapshot = simulation->getSnapshot();
+    if (!ImageExporter::fits(*snapshot, (int)scale))
+    {
+        output << "[!] The image can't be that large\n";
+        return;
+    }
+
+    FileOutputSink file(path);
+    if (!file.isOpen())
+    {
+        output << "[!] Could not open " << path << "\n";
+        return;
+    }
+    ImageExporter(simulation->getBuildingTypes()).exportImage(*snapshot, file, format, (int)scale);
+    output << "[*] Saved the site to " << path << "\n";
+}
+
+// Reads the price changes as Metal+30,Wood-10;S+20 and adds a scenario for every part between the ;
+bool readScenarios(PriceScenarios &scenarios)
+{
+    output << "[*] Prices that can be changed:";
+    for (string &name : scenarios.getColumnNames())
+        output << " " << name;
+    output << "\n";
+    output << "[?] How should the prices change? (Format Metal+30,Wood-10;S+20, ; starts the next scenario)\n";
+    output << "> ";
+    string line;
+    readLine(line);
+
+    // Every scenario is a list of changes like Metal+30, which means 30% more than now
+    stringstream scenarioStream(line);
+    string scenarioText;
+    while (getline(scenarioStream, scenarioText, ';'))
+    {
+        if (scenarioText.empty())
+            continue;
+        int scenario = scenarios.add(scenarioText);
+        stringstream changeStream(scenarioText);
+        string change;
+        while (getline(changeStream, change, ','))
+        {
+            size_t sign = change.find_first_of("+-");
+            int column = sign == string::npos ? -1 : scenarios.getColumn(change.substr(0, sign));
+            double percent;
+            try
+            {
+                percent = column == -1 ? 0 : stod(change.substr(sign));
+            }
+            catch (const std::exception &)
+            {
+                column = -1;
+            }
+            if (column == -1)
+            {
+                output << "[!] Invalid change " << change << "\n";
+                return false;
+            }
+            scenarios.changeBy(scenario, column, percent);
+        }
+    }
+    return true;
+}
+
+void compareScenarios()
+{
+    PriceScenarios scenarios(simulation->getBuildingTypes());
+    if (readScenarios(scenarios))
+        printScenarios(output, scenarios.evaluate(*simulation->getSnapshot()));
+}
+
+// Moves everything that follows the grid over to the other site, the journal always stays with the main site.
+// The interactions and clusters are only computed again when they are needed on the new site
+void switchSite(CapycitySim *site, string variant)
+{
+    if (interactionsAttached)
+        interactions.detach(*simulation);
+    if (clustersAttached)
+        clusters.detach(*simulation);
+    interactionsAttached = false;
+    clustersAttached = false;
+    overview.detach(*simulation);
+    if (rules != nullptr)
+        rules->detach(*simulation);
+    simulation = site;
+    currentVariant = variant;
+    overview.attach(*simulation);
+    if (rules != nullptr)
+        rules->attach(*simulation);
+}
+
+void manageVariants()
+{
+    output << "[*] Working on " << (currentVariant.empty() ? "the main site" : "the variant " + currentVariant) << "\n";
+    double choice;
+    if (!readNumber("[?] 1: Fork the current site, 2: Switch to a variant, 3: Compare, 4: Promote a variant, 5: Delete a variant", choice))
+        return;
+    if (choice == 3)
+    {
+        variants.printComparison(output, *mainSite);
+        return;
+    }
+    if (choice < 1 || choice > 5)
+    {
+        output << "[!] Invalid choice\n";
+        return;
+    }
+
+    output << "[?] Which variant?" << (choice == 2 ? " (leave empty for the main site)" : "") << "\n";
+    output << "> ";
+    string name;
+    readLine(name);
+    if (choice == 1)
+    {
+        if (variants.fork(name, *simulation) == nullptr)
+        {
+            output << "[!] Invalid name or there already is a variant " << name << "\n";
+            return;
+        }
+        output << "[*] Created the variant " << name << ", switch to it to change it\n";
+        return;
+    }
+    if (choice == 2)
+    {
+        CapycitySim *site = name.empty() ? mainSite : variants.get(name);
+        if (site == nullptr)
+        {
+            output << "[!] There is no variant " << name << "\n";
+            return;
+        }
+        switchSite(site, name);
+        output << "[*] Working on " << (name.empty() ? "the main site" : "the variant " + name) << "\n";
+        return;
+    }
+    if (variants.get(name) == nullptr)
+    {
+        output << "[!] There is no variant " << name << "\n";
+        return;
+    }
+    // The variant can't stay open if it is promoted or deleted
+    if (name == currentVariant)
+        switchSite(mainSite, "");
+    if (choice == 4)
+    {
+        // The rules follow the open site, the main site needs them while the variant is promoted
+        bool moveRules = rules != nullptr && simulation != mainSite;
+        if (moveRules)
+        {
+            rules->detach(*simulation);
+            rules->attach(*mainSite);
+        }
+        variants.promote(name, *mainSite, output);
+        if (moveRules)
+        {
+            rules->detach(*mainSite);
+            rules->attach(*simulation);
+        }
+    }
+    else
+    {
+        variants.remove(name);
+        output << "[*] Deleted the variant " << name << "\n";
+    }
+}
+
+// Only reads the tiles of the part that is shown from the file, so this is instant even for huge sites
+void showSnapshotPart(string path)
+{
+    SnapshotFile file;
+    if (!file.open(path, output))
+        return;
+    output << "[*] " << path << " is a " << file.getHeight() << "x" << file.getWidth() << " building space\n";
+    int minX, minY, maxX, maxY;
+    tie(minX, minY) = getCoordinateFromUser("Where is the top left corner? (Format XxY)");
+    tie(maxX, maxY) = getCoordinateFromUser("Where is the bottom right corner? (Format XxY)");
+    if (minX < 0 || minY < 0 || maxX < minX || maxY < minY || maxX >= file.getHeight() || maxY >= file.getWidth())
+    {
+        output << "[!] Invalid coordinates\n";
+        return;
+    }
+    if (maxX - minX >= 100 || maxY - minY >= 100)
+    {
+        output << "[!] Only up to 100x100 cells can be shown\n";
+        return;
+    }
+    shared_ptr<const GridSnapshot> part = file.loadRegion(minX, minY, maxX, maxY, simulation->getBuildingTypes().size(), output);
+    if (part == nullptr)
+        return;
+    for (int x = minX; x <= maxX; x++)
+    {
+        for (int y = minY; y <= maxY; y++)
+            output << (y == minY ? " " : "  ") << simulation->getBuildingFromId(part->get(x, y)).getLabel();
+        output << "\n";
+    }
+}
+
+void showDiff()
+{
+    double choice;
+    if (!readNumber("[?] 1: Save the site as a snapshot file, 2: Compare with a snapshot file, 3: Compare with a variant, 4: Show a part of a snapshot file", choice))
+        return;
+    if (choice < 1 || choice > 4)
+    {
+        output << "[!] Invalid choice\n";
+        return;
+    }
+    output << (choice == 3 ? "[?] Which variant?\n" : "[?] Which file?\n");
+    output << "> ";
+    string name;
+    readLine(name);
+
+    if (choice == 4)
+    {
+        showSnapshotPart(name);
+        return;
+    }
+    shared_ptr<const GridSnapshot> current = simulation->getSnapshot();
+    if (choice == 1)
+    {
+        if (Journal::writeSnapshot(name, *current))
+            output << "[*] Saved the site to " << name << "\n";
+        else
+            output << "[!] Could not write " << name << "\n";
+        return;
+    }
+    shared_ptr<const GridSnapshot> other;
+    if (choice == 2)
+    {
+        other = Journal::loadSnapshot(name, simulation->getBuildingTypes().size(), output);
+    }
+    else
+    {
+        CapycitySim *variant = variants.get(name);
+        if (variant == nullptr)
+            output << "[!] There is no variant " << name << "\n";
+        else
+            other = variant->getSnapshot();
+    }
+    if (other == nullptr)
+        return;
+    if (other->height != current->height || other->width != current->width)
+    {
+        output << "[!] " << name << " is a " << other->height << "x" << other->width << " building space\n";
+        return;
+    }
+    // What happened from the other layout to the current site
+    printDiff(output, diffLayouts(*other, *current, simulation->getBuildingTypes()), *simulation);
+}
+
+void showPortfolio()
+{
+    output << "[?] Which portfolio file? (one snapshot file per line, optionally name=file)\n";
+    output << "> ";
+    string path;
+    readLine(path);
+    Portfolio portfolio(simulation->getBuildingTypes());
+    if (!portfolio.load(path, output))
+        return;
+    if (portfolio.getSiteCount() == 0)
+    {
+        output << "[!] There are no sites in " << path << "\n";
+        return;
+    }
+    PriceScenarios scenarios(simulation->getBuildingTypes());
+    if (!readScenarios(scenarios))
+        return;
+    WeatherProfile weather = WeatherProfile::createDefault();
+    printPortfolioReport(output, portfolio.report(scenarios, &weather, output), simulation->getBuildingTypes());
+}
+
+void writeReport()
+{
+    output << "[?] Where should the report be saved? (.json or .csv)\n";
+    output << "> ";
+    string path;
+    readLine(path);
+    REPORT_FORMAT format;
+    if (path.size() > 5 && path.substr(path.size() - 5) == ".json")
+        format = JSON;
+    else if (path.size() > 4 && path.substr(path.size() - 4) == ".csv")
+        format = CSV;
+    else
+    {
+        output << "[!] Only .json and .csv files are supported\n";
+        return;
+    }
+    double choice;
+    if (!readNumber("[?] 1: Summary, 2: Regions, 3: Every building, 4: Clusters", choice))
+        return;
+    if (choice < REPORT_SUMMARY || choice > REPORT_CLUSTERS)
+    {
+        output << "[!] Invalid choice\n";
+        return;
+    }
+
+    FileOutputSink file(path);
+    if (!file.isOpen())
+    {
+        output << "[!] Could not open " << path << "\n";
+        return;
+    }
+    shared_ptr<const GridSnapshot> snapshot = simulation->getSnapshot();
+    ReportWriter writer(file, format);
+    writer.begin();
+    if (choice == REPORT_SUMMARY)
+        writeSummaryTable(writer, *snapshot, simulation->getBuildingTypes());
+    else if (choice == REPORT_REGIONS)
+        writeRegionTable(writer, *snapshot, simulation->getBuildingTypes());
+    else if (choice == REPORT_BUILDINGS)
+        writeBuildingTable(writer, *snapshot, simulation->getBuildingTypes());
+    else
+        writeClusterTable(writer, getClusterIndex().getClusters(), simulation->getBuildingTypes());
+    writer.end();
+    output << "[*] Saved the report to " << path << "\n";
+}
+
+void recordTimeSeries()
+{
+    double choice;
+    if (!readNumber("[?] 1: Simulate and save every building, 2: Simulate and save every cluster, 3: Read a saved file", choice))
+        return;
+    if (choice < 1 || choice > 3)
+    {
+        output << "[!] Invalid choice\n";
+        return;
+    }
+    output << "[?] Which file?\n";
+    output << "> ";
+    string path;
+    readLine(path);
+
+    if (choice != 3)
+    {
+        WeatherProfile weather;
+        if (!readWeather(weather))
+            return;
+        EnergyFleet fleet = EnergyFleet::fromSnapshot(*simulation->getSnapshot(), simulation->getBuildingTypes());
+        getInteractionModel().applyTo(fleet);
+        // The series are written by the writer thread while the simulation goes on
+        TimeSeriesWriter writer;
+        if (!writer.open(path, fleet, choice == 2 ? &getClusterIndex() : nullptr, output))
+            return;
+        EnergySimulation().run(fleet, weather, &writer);
+        writer.close();
+        output << "[*] Saved " << writer.getHourCount() << " hours of " << writer.getSeriesCount() << " series to " << path << "\n";
+    }
+
+    TimeSeriesFile file;
+    if (!file.open(path, output))
+        return;
+    printTimeSeriesReport(output, file);
+}
+
+// Loads the rules file and checks every placement against it from now on
+bool loadRules(string path)
+{
+    rules = new PlacementRules(simulation->getHeight(), simulation->getWidth());
+    if (!rules->load(path, *simulation, output))
+        return false;
+    rules->attach(*simulation);
+    output << "[*] Loaded " << (int)rules->getRules().size() << " rules\n";
+    return true;
+}
+
 void showMenu()
 {
+    string journalError = journal.takeError();
+    if (!journalError.empty())
+        output << "[!] " << journalError << "\n";
+
     // Loop over all the menu options and print them
-    cout << "[*] Menu:" << endl;
-    for (int i = EXIT; i <= PRINT; i++)
+    output << "[*] Menu:\n";
+    for (int i = EXIT; i <= MEMORY; i++)
     {
-        cout << " " << i << ": " << menuItems[i] << endl;
+        output << " " << i << ": " << menuItems[i] << "\n";
     }
 
     // Prompt the user for the menu option
-    cout << "[?] Enter your choice: " << endl;
-    cout << "> ";
+    output << "[?] Enter your choice: \n";
+    output << "> ";
     string choice;
-    getline(cin, choice);
+    readLine(choice);
     if (!is_number(choice))
     {
-        cout << "[!] Invalid choice" << endl;
+        output << "[!] Invalid choice\n";
         showMenu();
         return;
     }
     int choiceInt = stoi(choice);
-    if (choiceInt < EXIT || choiceInt > PRINT)
+    if (choiceInt < EXIT || choiceInt > MEMORY)
     {
-        cout << "[!] Invalid choice" << endl;
+        output << "[!] Invalid choice\n";
         showMenu();
         return;
     }
@@ -134,7 +812,8 @@ void showMenu()
     switch (choiceInt)
     {
     case EXIT:
-        cout << "[*] Bye!" << endl;
+        output << "[*] Bye!\n";
+        output.flush();
         exit(0);
     case PLACE:
         pickPlacement();
@@ -143,45 +822,160 @@ void showMenu()
         deleteBuilding();
         break;
     case PRINT:
-        cout << "[*] Current building space" << endl;
+        output << "[*] Current building space\n";
         simulation->printInfo();
         break;
+    case SUMMARY:
+        simulation->printSummary();
+        break;
+    case ENERGY:
+        simulateEnergy();
+        break;
+    case OPTIMIZE:
+        optimizeLayout();
+        break;
+    case CLUSTERS:
+        showClusters();
+        break;
+    case CABLES:
+        planCables();
+        break;
+    case OVERVIEW:
+        showOverview();
+        break;
+    case EXPORT:
+        exportImage();
+        break;
+    case SCENARIOS:
+        compareScenarios();
+        break;
+    case VARIANTS:
+        manageVariants();
+        break;
+    case DIFF:
+        showDiff();
+        break;
+    case PORTFOLIO:
+        showPortfolio();
+        break;
+    case REPORT:
+        writeReport();
+        break;
+    case TIMESERIES:
+        recordTimeSeries();
+        break;
+    case MEMORY:
+        printMemoryUsage(output);
+        break;
+    }
+}
+
+int runServer(string address, string dimensions, string rulesPath, string journalPath)
+{
+#ifdef __linux__
+    // Before the journal starts its thread, so only the server gets SIGINT and SIGTERM
+    CapycityServer::blockShutdownSignals();
+    // The dimensions are given as HxW, just like in the interactive mode
+    vector<int> dimArray;
+    stringstream partsStream = stringstream(dimensions);
+    string part;
+    while (getline(partsStream, part, 'x'))
+    {
+        if (is_int(part))
+        {
+            dimArray.push_back(stoi(part));
+        }
+    }
+    if (dimArray.size() != 2 || dimArray[0] < 1 || dimArray[1] < 1)
+    {
+        output << "[!] Invalid dimensions\n";
+        return -1;
+    }
+    simulation = new CapycitySim(dimArray[0], dimArray[1]);
+    if (!journalPath.empty() && !journal.open(journalPath, *simulation, output))
+    {
+        output.flush();
+        return -1;
+    }
+    if (!rulesPath.empty() && !loadRules(rulesPath))
+    {
+        output.flush();
+        return -1;
+    }
+
+    // The address is either unix:<path> or tcp:<port>
+    CapycityServer server(*simulation);
+    bool listening = false;
+    if (address.rfind("unix:", 0) == 0)
+    {
+        listening = server.listenUnix(address.substr(5));
+    }
+    else if (address.rfind("tcp:", 0) == 0 && is_int(address.substr(4)) && stoi(address.substr(4)) >= 1 && stoi(address.substr(4)) <= 65535)
+    {
+        listening = server.listenTcp(stoi(address.substr(4)));
+    }
+    if (!listening)
+    {
+        output << "[!] Could not listen on " << address << "\n";
+        delete simulation;
+        return -1;
     }
+    output << "[*] Listening on " << address << "\n";
+    output.flush();
+    server.run();
+    journal.close();
+    delete simulation;
+    return 0;
+#else
+    output << "[!] The server mode is only supported on linux\n";
+    return -1;
+#endif
 }
 
-int main()
+int main(int argc, char **argv)
 {
-    cout << "[!] Please maximize the terminal window for the best experience" << endl;
+    // simulationstool [--rules <file>] [--journal <path>] [--server unix:<path>|tcp:<port> HxW]
+    vector<string> args;
+    string rulesPath, journalPath;
+    for (int i = 1; i < argc; i++)
+    {
+        if (string(argv[i]) == "--rules" && i + 1 < argc)
+            rulesPath = argv[++i];
+        else if (string(argv[i]) == "--journal" && i + 1 < argc)
+            journalPath = argv[++i];
+        else
+            args.push_back(argv[i]);
+    }
+    if (args.size() == 3 && args[0] == "--server")
+    {
+        return runServer(args[1], args[2], rulesPath, journalPath);
+    }
+
+    output << "[!] Please maximize the terminal window for the best experience\n";
     // Init some variables we need for getting the height and width of the "map"
     vector<int> dimArray;
     string parts;
     char delim = 'x';
 
     // Prompt the user for the dimensions of the "map"
-    cout << "[?] How big should the building space be? (Format HxW)" << endl;
-    cout << "> ";
+    output << "[?] How big should the building space be? (Format HxW)\n";
+    output << "> ";
     // Read the dimensions from the console
-    getline(cin, parts);
+    readLine(parts);
     stringstream partsStream = stringstream(parts);
     string part;
     // Split the dimensions into an array
     while (getline(partsStream, part, delim))
     {
-        if (is_number(part))
+        if (is_int(part))
         {
-            // If the dimension is larger than 99, dont handle it, because that will print very ugly
-            if (part.length() > 2)
-            {
-                cout << "[!] The dimensions are too big!";
-                return 0;
-            }
             dimArray.push_back(stoi(part));
         }
     }
     // If the don't have exactly two dimensions, exit the program
     if (dimArray.size() != 2 || dimArray[0] < 1 || dimArray[1] < 1)
     {
-        cout << "[!] Invalid input" << endl;
+        output << "[!] Invalid input\n";
         return -1;
     }
 
@@ -191,6 +985,19 @@ int main()
 
     // Create the simulation
     simulation = new CapycitySim(h, w);
+    mainSite = simulation;
+    // The journal has to put the grid back before anyone else looks at it
+    if (!journalPath.empty() && !journal.open(journalPath, *simulation, output))
+    {
+        output.flush();
+        return -1;
+    }
+    overview.attach(*simulation);
+    if (!rulesPath.empty() && !loadRules(rulesPath))
+    {
+        output.flush();
+        return -1;
+    }
 
     // Just show the menu forever
     while (true)
@@ -4,6 +4,13 @@
 #include <cmath>
 #include <sstream>
 #include <iomanip>
+#include <algorithm>
+#include <mutex>
+#include <string_view>
+#include <fstream>
+#include <cstdlib>
+#include "outputsink.h"
+#include "grid.h"
 
 #ifdef __linux__
 #include <sys/ioctl.h>
@@ -22,7 +29,21 @@ enum MENU
     EXIT = 0,
     PLACE = 1,
     DEL = 2,
-    PRINT = 3
+    PRINT = 3,
+    SUMMARY = 4,
+    ENERGY = 5,
+    OPTIMIZE = 6,
+    CLUSTERS = 7,
+    CABLES = 8,
+    OVERVIEW = 9,
+    EXPORT = 10,
+    SCENARIOS = 11,
+    VARIANTS = 12,
+    DIFF = 13,
+    PORTFOLIO = 14,
+    REPORT = 15,
+    TIMESERIES = 16,
+    MEMORY = 17
 };
 
 const char *menuItems[] = {
@@ -30,6 +51,20 @@ const char *menuItems[] = {
     "Place",
     "Delete",
     "Print",
+    "Summary",
+    "Energy",
+    "Optimize",
+    "Clusters",
+    "Cables",
+    "Overview",
+    "Export",
+    "Scenarios",
+    "Variants",
+    "Diff",
+    "Portfolio",
+    "Report",
+    "Time series",
+    "Memory",
 };
 
 // MATERIALS
@@ -37,11 +72,11 @@ const char *menuItems[] = {
 class Material
 {
 protected:
-    double price;
+    Cents price;
     std::string name;
 
 public:
-    double getPrice() { return this->price; }
+    Cents getPrice() { return this->price; }
     std::string getName() { return this->name; }
 };
 
@@ -50,7 +85,7 @@ class Wood : public Material
 public:
     Wood()
     {
-        this->price = 1;
+        this->price = 100;
         this->name = "Wood";
     }
 };
@@ -60,7 +95,7 @@ class Metal : public Material
 public:
     Metal()
     {
-        this->price = 2;
+        this->price = 200;
         this->name = "Metal";
     }
 };
@@ -70,27 +105,41 @@ class Plastic : public Material
 public:
     Plastic()
     {
-        this->price = 3;
+        this->price = 300;
         this->name = "Plastic";
     }
 };
 
 // BUILDINGS
 
+// Where a building gets its energy from, the energy simulation needs this to pick the right model
+enum ENERGY_SOURCE
+{
+    NO_SOURCE = 0,
+    SOLAR = 1,
+    WIND = 2,
+    HYDRO = 3
+};
+
 class Building
 {
 protected:
-    double basePrice;
+    Cents basePrice;
     std::string label;
     std::string fullLabel;
     std::vector<Material> necessaryMaterials;
+    // The maximum power output in kW
+    double ratedPower = 0;
+    ENERGY_SOURCE energySource = NO_SOURCE;
 
 public:
-    double getBasePrice() { return this->basePrice; }
-    double getTotalPrice()
+    Cents getBasePrice() { return this->basePrice; }
+    double getRatedPower() { return this->ratedPower; }
+    ENERGY_SOURCE getEnergySource() { return this->energySource; }
+    Cents getTotalPrice()
     {
         // Calculate the total price by taking the base price and adding all the material prices on top
-        double totalPrice = this->basePrice;
+        Cents totalPrice = this->basePrice;
         for (Material &value : this->getNecessaryMaterials())
         {
             totalPrice += value.getPrice();
@@ -121,7 +170,7 @@ public:
     ErrorBuilding()
     {
         // Just place holder values basically
-        this->basePrice = -1;
+        this->basePrice = -100;
         this->label = "";
     }
 };
@@ -132,9 +181,11 @@ public:
     SolarPanelBuilding()
     {
         // Added some random values, because no specifications were given
-        this->basePrice = 1;
+        this->basePrice = 100;
         this->label = "S";
         this->fullLabel = "Solar Panel";
+        this->ratedPower = 5;
+        this->energySource = SOLAR;
 
         this->necessaryMaterials.push_back(Metal());
         this->necessaryMaterials.push_back(Wood());
@@ -147,9 +198,11 @@ class WindPowerPlantBuilding : public Building
 public:
     WindPowerPlantBuilding()
     {
-        this->basePrice = 2;
+        this->basePrice = 200;
         this->label = "W";
         this->fullLabel = "Wind Power Plant";
+        this->ratedPower = 2000;
+        this->energySource = WIND;
 
         this->necessaryMaterials.push_back(Metal());
         this->necessaryMaterials.push_back(Metal());
@@ -162,9 +215,11 @@ class HydroelectricPowerPlants : public Building
 public:
     HydroelectricPowerPlants()
     {
-        this->basePrice = 4;
+        this->basePrice = 400;
         this->label = "H";
         this->fullLabel = "Hydroelectric Power Plant";
+        this->ratedPower = 10000;
+        this->energySource = HYDRO;
 
         this->necessaryMaterials.push_back(Metal());
         this->necessaryMaterials.push_back(Metal());
@@ -197,51 +252,122 @@ const char *injectionText =
 +-----------------+
         )""";
 
+// Decides if a change is allowed, it is asked for every change while the write lock is held
+class PlacementValidator
+{
+public:
+    virtual ~PlacementValidator() {}
+    // Gives back false and prints why if the cell x/y may not change from oldId to newId
+    virtual bool allows(int x, int y, BuildingId oldId, BuildingId newId, OutputSink &output) = 0;
+    // Called for every allowed change before the next one is checked, so changes of one batch see each other
+    virtual void onAccepted(int x, int y, BuildingId oldId, BuildingId newId) = 0;
+};
+
 class CapycitySim
 {
 private:
-    std::vector<std::vector<Building>> buildings;
+    int height;
+    int width;
+    // The current version of the grid, readers pin it with getSnapshot() and never need a lock
+    std::shared_ptr<const GridSnapshot> current;
+    // Only one writer may build the next snapshot at a time
+    std::mutex writeLock;
+    OutputSink *output;
     std::vector<Building> buildingTypes{SolarPanelBuilding(), WindPowerPlantBuilding(), HydroelectricPowerPlants()};
+    // The label of every BuildingId, so rendering doesn't need to create buildings
+    std::vector<std::string> buildingLabels;
+    // Everyone who keeps data that depends on the grid, they are told about every change
+    std::vector<GridListener *> listeners;
+    // Additional rules for placing buildings, nullptr if there are none
+    PlacementValidator *validator = nullptr;
 
     // Check if x or y are out of bounds
     bool inBounds(int x, int y)
     {
-        return (x <= this->buildings.size() - 1 && x >= 0 && y <= this->buildings[0].size() - 1 && y >= 0);
+        return (x < this->height && x >= 0 && y < this->width && y >= 0);
     };
 
+    void publish(std::shared_ptr<const GridSnapshot> snapshot)
+    {
+        std::atomic_store(&this->current, snapshot);
+    }
+
+    // Checks if the building with the given id may be put at x/y and prints why not, if it may the caller has to make the change
+    bool canSet(GridWriter &writer, int x, int y, int id, OutputSink &output)
+    {
+        BuildingId currentId = writer.get(x, y);
+        // Check if the building is already at this location
+        if (currentId == id)
+        {
+            // We print this with x + 1 and y + 1 because the user will see the board as 1 indexed
+            output << "[!] The building " << this->getBuildingFromId(id).getFullLabel() << " is already at " << (x + 1) << "x" << (y + 1) << "\n";
+            return false;
+        }
+
+        // Check if there is already a building
+        // We need to check if the building is empty first, because if we pass a EMPTY building as
+        // the parameter, we want to delete that building so we dont care about if there is a building or not
+        if (id != 0 && currentId != 0)
+        {
+            // We print this with x + 1 and y + 1 because the user will see the board as 1 indexed
+            output << "[!] There is already a building at " << (x + 1) << "x" << (y + 1) << "\n";
+            return false;
+        }
+
+        if (this->validator != nullptr)
+        {
+            if (!this->validator->allows(x, y, currentId, id, output))
+                return false;
+            this->validator->onAccepted(x, y, currentId, id);
+        }
+        return true;
+    }
+
+    // Must be called with the write lock held, after the changes were published
+    void notifyListeners(const std::vector<CellChange> &changes)
+    {
+        for (GridListener *listener : this->listeners)
+        {
+            for (const CellChange &change : changes)
+            {
+                listener->onCellChanged(change.x, change.y, change.oldId, change.newId);
+            }
+        }
+    }
+
     // Just a helper function to calculate the correct line format
-    void getLine(std::ostream &ostream, std::string postfix = "")
+    void getLine(OutputBuffer &output, std::string postfix = "")
     {
         // +-----------------------+
-        ostream << "+";
-        for (int i = 0; i < this->buildings[0].size() - 1; i++)
+        output += "+";
+        for (int i = 0; i < this->width - 1; i++)
         {
             // If the number is bigger than 9, we need more space
             if (i >= 10)
             {
-                ostream << "-----";
+                output += "-----";
             }
             else
             {
-                ostream << "----";
+                output += "----";
             }
         }
         // Again if the number is double digits we need more space
         std::string finalPart = "---+";
         // If its ten we need one less "-"
-        if (this->buildings[0].size() == 10)
+        if (this->width == 10)
         {
             finalPart = "----+";
         }
-        else if (this->buildings[0].size() > 10)
+        else if (this->width > 10)
         {
             finalPart = "-----+";
         }
 
-        ostream << finalPart << postfix << std::endl;
+        output += finalPart + postfix + "\n";
     }
 
-    void getBoardInfo(std::ostream &ostream)
+    void getBoardInfo(const GridSnapshot &snapshot, OutputBuffer &output)
     {
         /*
         Gets all the info in this format without the info signs on the left
@@ -269,18 +395,18 @@ private:
         */
 
         // +-----------------------+ x
-        this->getLine(ostream, " x");
+        this->getLine(output, " x");
 
         // | 1 | 2 | 3 | 4 | 5 | 6 |   y
-        ostream << "|";
-        for (int i = 0; i < this->buildings[0].size(); i++)
+        output += "|";
+        for (int i = 0; i < this->width; i++)
         {
-            ostream << " " << (i + 1) << " |";
+            output += " " + std::to_string(i + 1) + " |";
         }
-        ostream << "   y" << std::endl;
+        output += "   y\n";
 
         // +-----------------------------------+---+
-        this->getLine(ostream, "---+");
+        this->getLine(output, "---+");
         /*
         | 0   0   0   0   0   0 | 1 |
         |                       |---|
@@ -298,27 +424,27 @@ private:
         |                       |---|
         | 0   0   0   0   0   0 | 8 |
         */
-        for (int i = 0; i < this->buildings.size(); i++)
+        for (int i = 0; i < this->height; i++)
         {
-            ostream << "| ";
-            for (int j = 0; j < this->buildings[i].size() - 1; j++)
+            output += "| ";
+            for (int j = 0; j < this->width - 1; j++)
             {
                 // Need to increase spaces so we can fit the doubledigit numbers
                 int neededSpaces = (j > 7) ? 4 : 3;
                 std::string spacesString(neededSpaces, ' ');
-                ostream << this->buildings[i][j].getLabel() << spacesString;
+                output += this->buildingLabels[snapshot.get(i, j)] + spacesString;
             }
             /* Print the last element without the extra space
             | 0   0   0   0   0   0 | 1 |
                                    ^
                                    no extra space here
             */
-            ostream << this->buildings[i][buildings[i].size() - 1].getLabel() << "";
+            output += this->buildingLabels[snapshot.get(i, this->width - 1)];
 
             // If i is 10 or over, the formattng is broken, so we just "fix" it this way and
             // hope noone wants a buildingspace > 99
             std::string delim = i + 1 >= 10 ? "|" : " |";
-            ostream << " | " << (i + 1) << delim << std::endl;
+            output += " | " + std::to_string(i + 1) + delim + "\n";
 
             /* print the line between each row only if its not the last row
             | 0   0   0   0   0   0 | 8 |
@@ -327,24 +453,24 @@ private:
             We need (3 * i_singledigit + 4 * i_doubledigit) + (i - 1) spaces
             */
             int totalLength = 0;
-            if (this->buildings[i].size() > 9)
+            if (this->width > 9)
             {
                 // If there are double digit numbers, there will always be 9 single digits one and n - 9 double digit ones
-                int amountDoubleDigits = this->buildings[i].size() - 9;
-                totalLength = (3 * 9 + 4 * amountDoubleDigits) + (this->buildings[i].size() - 1);
+                int amountDoubleDigits = this->width - 9;
+                totalLength = (3 * 9 + 4 * amountDoubleDigits) + (this->width - 1);
             }
             else
             {
-                totalLength = 3 * this->buildings[i].size() + (this->buildings[i].size() - 1);
+                totalLength = 3 * this->width + (this->width - 1);
             }
             std::string spaces(totalLength, ' ');
             std::string spaceString = "|" + spaces + "|---|";
-            if (i != this->buildings.size() - 1)
-                ostream << spaceString << std::endl;
+            if (i != this->height - 1)
+                output += spaceString + "\n";
         }
 
         //+-----------------------+
-        this->getLine(ostream, "---+");
+        this->getLine(output, "---+");
     }
 
     // https://stackoverflow.com/a/3418285/8512776
@@ -362,12 +488,8 @@ private:
 
     std::string getCurrentInjectString(int i)
     {
-        // Split the string by \n
-        auto result = std::vector<std::string>{};
-        auto ss = std::stringstream{injectionText};
-
-        for (std::string line; std::getline(ss, line, '\n');)
-            result.push_back(line);
+        // The injection text never changes, so we only split it once
+        static const std::vector<std::string> result = splitLines(injectionText);
 
         // If there are no more lines to inject, return a "-1" to indicate that
         if (result.size() > i)
@@ -375,69 +497,57 @@ private:
         return "-1";
     }
 
-    std::vector<Building> getBuildings()
+    std::vector<Building> getBuildings(const GridSnapshot &snapshot)
     {
-        // Get all non empty buildings
+        // Get all non empty buildings, the occupancy bits of the tiles lead straight to them
         std::vector<Building> buildings;
-        for (int i = 0; i < this->buildings.size(); i++)
-        {
-            for (int j = 0; j < this->buildings[0].size(); j++)
-            {
-                if (this->buildings[i][j].getFullLabel() != EmptyBuilding().getFullLabel())
-                {
-                    buildings.push_back(this->buildings[i][j]);
-                }
-            }
-        }
+        snapshot.forEachBuilding([&](int, int, BuildingId id)
+                                 { buildings.push_back(this->getBuildingFromId(id)); });
         return buildings;
     }
 
-    std::string doubleToRoundedString(double d)
+    std::string centsToRoundedString(Cents cents)
     {
-        // Round a double so we can print it nicely
-        double roundedDouble = std::round(d * 100.0) / 100.0;
-        std::stringstream stream;
-        int precision = 2;
-        if (roundedDouble >= 100)
-        {
-            precision = 1;
-        }
-        stream << std::fixed << std::setprecision(precision) << roundedDouble;
-        std::string prefix = (d < 10) ? " " : "";
-        return prefix + stream.str();
+        // Two decimals, only one from 100 on so the boxes don't get wider
+        char digits[24];
+        size_t length = formatCents(digits, cents, cents >= 10000 ? 1 : 2);
+        std::string prefix = (cents < 1000) ? " " : "";
+        return prefix + std::string(digits, length);
     }
 
-    std::vector<std::tuple<std::string, std::string>> collectInfo()
+    std::vector<std::tuple<std::string, std::string>> collectInfo(const GridSnapshot &snapshot)
     {
 
         std::vector<std::tuple<std::string, std::string>> info;
 
-        std::vector<Building> placedBuildings = this->getBuildings();
         // Fill all the hashmaps with empty values
-        std::map<std::string, int> buildingsHashMap = {
+        std::map<std::string, long long> buildingsHashMap = {
             {SolarPanelBuilding().getLabel(), 0},
             {WindPowerPlantBuilding().getLabel(), 0},
             {HydroelectricPowerPlants().getLabel(), 0}};
 
-        std::map<std::string, int> materialsHashMap = {
+        std::map<std::string, long long> materialsHashMap = {
             {Wood().getName(), 0},
             {Metal().getName(), 0},
             {Plastic().getName(), 0}};
 
-        std::map<std::string, double> buildingsPriceHashMap = {
+        std::map<std::string, Cents> buildingsPriceHashMap = {
             {SolarPanelBuilding().getLabel(), 0},
             {WindPowerPlantBuilding().getLabel(), 0},
             {HydroelectricPowerPlants().getLabel(), 0}};
 
         // Add the building count, the material count and the price of the buildings
-        for (Building currentBuilding : placedBuildings)
+        // The snapshot already counted the buildings, so we only need to go over the types
+        for (size_t i = 0; i < this->buildingTypes.size(); i++)
         {
-            buildingsHashMap[currentBuilding.getLabel()] += 1;
+            Building &currentBuilding = this->buildingTypes[i];
+            long long count = snapshot.buildingCounts[i + 1];
+            buildingsHashMap[currentBuilding.getLabel()] += count;
 
-            buildingsPriceHashMap[currentBuilding.getLabel()] += currentBuilding.getTotalPrice();
+            buildingsPriceHashMap[currentBuilding.getLabel()] += count * currentBuilding.getTotalPrice();
             for (Material &material : currentBuilding.getNecessaryMaterials())
             {
-                materialsHashMap[material.getName()] += 1;
+                materialsHashMap[material.getName()] += count;
             }
         }
 
@@ -449,18 +559,18 @@ private:
             info.push_back(currentInfoTuple);
         }
 
-        double totalPrice = 0;
+        Cents totalPrice = 0;
         // Add all the building prices to the info vector
         for (auto const &buildingValue : buildingsPriceHashMap)
         {
             std::string materialLabel = buildingValue.first + "T";
-            std::string roundedPrice = this->doubleToRoundedString(buildingValue.second);
+            std::string roundedPrice = this->centsToRoundedString(buildingValue.second);
             std::tuple<std::string, std::string> currentInfoTuple = std::make_tuple(materialLabel, roundedPrice);
             totalPrice += buildingValue.second;
             info.push_back(currentInfoTuple);
         }
         // Also add the total price
-        std::string roundedPrice = this->doubleToRoundedString(totalPrice);
+        std::string roundedPrice = this->centsToRoundedString(totalPrice);
         std::tuple<std::string, std::string> totalPriceTuple = std::make_tuple("TT", roundedPrice);
         info.push_back(totalPriceTuple);
 
@@ -486,9 +596,9 @@ private:
         }
 
         // Yes this is ugly and lazy but its probably as much code as any other solution
-        std::tuple<std::string, std::string> hydroTuple = std::make_tuple("HP", this->doubleToRoundedString(HydroelectricPowerPlants().getTotalPrice()));
-        std::tuple<std::string, std::string> windTuple = std::make_tuple("WP", this->doubleToRoundedString(WindPowerPlantBuilding().getTotalPrice()));
-        std::tuple<std::string, std::string> solarTuple = std::make_tuple("SP", this->doubleToRoundedString(SolarPanelBuilding().getTotalPrice()));
+        std::tuple<std::string, std::string> hydroTuple = std::make_tuple("HP", this->centsToRoundedString(HydroelectricPowerPlants().getTotalPrice()));
+        std::tuple<std::string, std::string> windTuple = std::make_tuple("WP", this->centsToRoundedString(WindPowerPlantBuilding().getTotalPrice()));
+        std::tuple<std::string, std::string> solarTuple = std::make_tuple("SP", this->centsToRoundedString(SolarPanelBuilding().getTotalPrice()));
         info.push_back(hydroTuple);
         info.push_back(windTuple);
         info.push_back(solarTuple);
@@ -510,13 +620,8 @@ private:
 #endif
     }
 
-    void getPrettyInfo(std::ostream &ostream)
+    void getPrettyInfo(const OutputBuffer &board, std::vector<std::tuple<std::string, std::string>> &replaceVector, OutputBuffer &output)
     {
-        std::stringstream stringStream;
-
-        this->getBoardInfo(stringStream);
-
-        std::vector<std::tuple<std::string, std::string>> replaceVector = this->collectInfo();
         // If this string is found in the currentString we will start injection the info boxes
         int currentInjectCounter = 0;
         bool injected = false;
@@ -524,7 +629,8 @@ private:
         int spaceAmount = 5;
 
         std::string currentString;
-        while (std::getline(stringStream, currentString))
+        size_t lineStart = 0;
+        while (nextLine(board, lineStart, currentString))
         {
             // If we have already started injecting, don't try again
             if (injected || currentString.find(entryPoint) != std::string::npos)
@@ -535,231 +641,431 @@ private:
                 if (appendedInjectString == "-1")
                     appendedInjectString = "";
                 currentString += injectString + appendedInjectString;
-                for (std::tuple<std::string, std::string> replaceMe : replaceVector)
-                {
-                    std::string replaceLabel, replaceValue;
-                    std::tie(replaceLabel, replaceValue) = replaceMe;
-                    // If the value is only one char add a space in front of it as padding
-                    if (replaceValue.length() == 1)
-                    {
-                        replaceValue = " " + replaceValue;
-                    }
-                    this->replaceAll(currentString, "{" + replaceLabel + "}", replaceValue);
-                }
+                this->injectInfo(currentString, replaceVector);
                 currentInjectCounter++;
             }
-            ostream << currentString << std::endl;
+            output += currentString;
+            output += '\n';
         }
     }
 
-    void getCompactInfo(std::ostream &ostream)
+    void getCompactInfo(const OutputBuffer &board, std::vector<std::tuple<std::string, std::string>> &replaceVector, OutputBuffer &output)
     {
-        std::stringstream stringStream;
+        // The board is printed as is and the info boxes are put below it
+        output += board;
+        this->getSummaryInfo(replaceVector, output);
+    }
 
-        this->getBoardInfo(stringStream);
+    void getSummaryInfo(std::vector<std::tuple<std::string, std::string>> &replaceVector, OutputBuffer &output)
+    {
         int currentInjectCounter = 0;
-        std::vector<std::tuple<std::string, std::string>> replaceVector = this->collectInfo();
-
-        std::string currentString;
-        while (std::getline(stringStream, currentString))
-        {
-            ostream << currentString << std::endl;
-        }
-
         std::string currentReplaceLine = this->getCurrentInjectString(currentInjectCounter);
         while (currentReplaceLine != "-1")
         {
-            for (std::tuple<std::string, std::string> replaceMe : replaceVector)
-            {
-                std::string replaceLabel, replaceValue;
-                std::tie(replaceLabel, replaceValue) = replaceMe;
-
-                // If the value is only one char add a space in front of it as padding
-                if (replaceValue.length() == 1)
-                {
-                    replaceValue = " " + replaceValue;
-                }
-                this->replaceAll(currentReplaceLine, "{" + replaceLabel + "}", replaceValue);
-            }
-            ostream << currentReplaceLine << std::endl;
+            this->injectInfo(currentReplaceLine, replaceVector);
+            output += currentReplaceLine;
+            output += '\n';
             currentInjectCounter++;
             currentReplaceLine = this->getCurrentInjectString(currentInjectCounter);
         }
     }
 
-    int getLongestStringWidth(std::stringstream &sstream)
+    void injectInfo(std::string &line, std::vector<std::tuple<std::string, std::string>> &replaceVector)
     {
-        int longestWidth = 0;
-
-        std::string currentString;
-        while (std::getline(sstream, currentString))
+        // No need to search for every label if there is nothing to replace
+        if (line.find('{') == std::string::npos)
+            return;
+        for (std::tuple<std::string, std::string> &replaceMe : replaceVector)
         {
-            if (currentString.length() > longestWidth)
+            std::string replaceLabel, replaceValue;
+            std::tie(replaceLabel, replaceValue) = replaceMe;
+            // If the value is only one char add a space in front of it as padding
+            if (replaceValue.length() == 1)
             {
-                longestWidth = currentString.length();
+                replaceValue = " " + replaceValue;
             }
+            this->replaceAll(line, "{" + replaceLabel + "}", replaceValue);
         }
+    }
 
-        // Return to the original pos in the stream
-        sstream.clear();
-        sstream.seekg(0);
-        return longestWidth;
+    // Reads the line starting at lineStart into line and moves lineStart to the next one
+    static bool nextLine(std::string_view str, size_t &lineStart, std::string &line)
+    {
+        if (lineStart >= str.length())
+            return false;
+        size_t lineEnd = str.find('\n', lineStart);
+        if (lineEnd == std::string_view::npos)
+            lineEnd = str.length();
+        line.assign(str.data() + lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
+        return true;
     }
 
-    int getStringStreamHeight(std::stringstream &sstream)
+    static std::vector<std::string> splitLines(const std::string &str)
     {
-        int height = 0;
+        std::vector<std::string> lines;
+        size_t lineStart = 0;
+        for (std::string line; nextLine(str, lineStart, line);)
+            lines.push_back(line);
+        return lines;
+    }
 
-        std::string currentString;
-        while (std::getline(sstream, currentString))
+    int getLongestLineWidth(std::string_view str)
+    {
+        size_t longestWidth = 0;
+        size_t lineStart = 0;
+        while (lineStart < str.length())
         {
-            height++;
+            size_t lineEnd = str.find('\n', lineStart);
+            if (lineEnd == std::string_view::npos)
+                lineEnd = str.length();
+            if (lineEnd - lineStart > longestWidth)
+            {
+                longestWidth = lineEnd - lineStart;
+            }
+            lineStart = lineEnd + 1;
         }
+        return (int)longestWidth;
+    }
 
-        // Return to the original pos in the stream
-        sstream.clear();
-        sstream.seekg(0);
+    int getLineCount(std::string_view str)
+    {
+        // Every line ends with a \n except maybe the last one
+        int height = std::count(str.begin(), str.end(), '\n');
+        if (!str.empty() && str.back() != '\n')
+            height++;
         return height;
     }
 
-    int getLineCountOfString(const char *str)
+public:
+    CapycitySim(int h, int w, OutputSink &output = terminalOutput())
     {
-        // Split the string by \n
-        auto result = std::vector<std::string>{};
-        auto ss = std::stringstream{str};
+        this->output = &output;
+        this->height = h;
+        this->width = w;
 
-        for (std::string line; std::getline(ss, line, '\n');)
-            result.push_back(line);
+        // The index of a label is its BuildingId, 0 is the empty building
+        this->buildingLabels.push_back(EmptyBuilding().getLabel());
+        for (Building &buildingType : this->buildingTypes)
+        {
+            this->buildingLabels.push_back(buildingType.getLabel());
+        }
 
-        // Return how many lines there are
-        // There is probably a better way to do this but I'm don't know it
-        return result.size();
+        // Every cell starts out empty
+        this->publish(GridSnapshot::createEmpty(h, w, this->buildingTypes.size()));
     }
 
-    void printStringStream(std::stringstream &stringstream)
+    std::vector<Building> &getBuildingTypes() { return this->buildingTypes; }
+
+    OutputSink &getOutput() { return *this->output; }
+    void setOutput(OutputSink &output) { this->output = &output; }
+
+    int getHeight() { return this->height; }
+
+    // The size of the terminal in characters, 80x24 if the output doesn't go to a terminal
+    void getTerminalSize(int &columns, int &rows)
     {
-        // Loop over the string stream and print each line
-        std::string currentString;
-        while (std::getline(stringstream, currentString))
+        columns = 80;
+        rows = 24;
+#ifdef __linux__
+        struct winsize w;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == 0 && w.ws_col > 0 && w.ws_row > 0)
         {
-            std::cout << currentString << std::endl;
+            columns = w.ws_col;
+            rows = w.ws_row;
         }
+#elif _WIN32
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+        if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi))
+        {
+            columns = csbi.srWindow.Right - csbi.srWindow.Left + 1;
+            rows = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
+        }
+#endif
     }
+    int getWidth() { return this->width; }
 
-public:
-    CapycitySim(int h, int w)
+    /*
+    A new site that starts out with the grid of this one. Both share every tile until one of them changes it,
+    so forking costs the same for every size of site. Listeners and the validator stay with this site.
+    */
+    CapycitySim *fork()
     {
-        // Resize the buildings vector to the given h/w
-        this->buildings.resize(h);
+        CapycitySim *variant = new CapycitySim(this->height, this->width, *this->output);
+        variant->publish(this->getSnapshot());
+        return variant;
+    }
 
-        for (int i = 0; i < h; i++)
-        {
-            this->buildings[i].resize(w);
-        }
+    /*
+    Makes a snapshot of the same size the new grid, like one read from a file, without placing every building.
+    Nothing is checked and no listener or validator is told, so this is only for a site that has none yet.
+    Gives back false if the size doesn't match.
+    */
+    bool restore(std::shared_ptr<const GridSnapshot> snapshot)
+    {
+        if (snapshot->height != this->height || snapshot->width != this->width)
+            return false;
+        std::lock_guard<std::mutex> lock(this->writeLock);
+        this->publish(snapshot);
+        return true;
+    }
+
+    // Pins the current version of the grid, it stays valid and unchanged as long as it is held
+    std::shared_ptr<const GridSnapshot> getSnapshot() const { return std::atomic_load(&this->current); }
+    uint64_t getVersion() const { return this->getSnapshot()->version; }
+
+    // Listeners are called while the change is still locked, so they see the changes in order.
+    // Gives back the version the listener starts from, every change after it is reported
+    std::shared_ptr<const GridSnapshot> addListener(GridListener &listener)
+    {
+        std::lock_guard<std::mutex> lock(this->writeLock);
+        this->listeners.push_back(&listener);
+        return this->getSnapshot();
+    }
+    void removeListener(GridListener &listener)
+    {
+        std::lock_guard<std::mutex> lock(this->writeLock);
+        this->listeners.erase(std::remove(this->listeners.begin(), this->listeners.end(), &listener), this->listeners.end());
+    }
 
-        // Fill the array with the default value
-        for (int i = 0; i < this->buildings.size(); i++)
+    // Only one validator can be set, nullptr removes it. Gives back the version it starts from, like addListener
+    std::shared_ptr<const GridSnapshot> setValidator(PlacementValidator *validator)
+    {
+        std::lock_guard<std::mutex> lock(this->writeLock);
+        this->validator = validator;
+        return this->getSnapshot();
+    }
+
+    // Gives back the BuildingId of the building or -1 if it is not a known building type
+    int getBuildingId(Building &building)
+    {
+        if (building.getFullLabel() == EmptyBuilding().getFullLabel())
+            return 0;
+        for (size_t i = 0; i < this->buildingTypes.size(); i++)
         {
-            for (int j = 0; j < this->buildings[0].size(); j++)
-            {
-                this->buildings[i][j] = EmptyBuilding();
-            }
+            if (this->buildingTypes[i].getFullLabel() == building.getFullLabel())
+                return (int)i + 1;
         }
+        return -1;
     }
 
-    std::vector<Building> &getBuildingTypes() { return this->buildingTypes; }
+    Building getBuildingFromId(BuildingId id)
+    {
+        if (id == 0)
+            return EmptyBuilding();
+        return this->buildingTypes[id - 1];
+    }
 
-    Building getBuilding(int x, int y)
+    Building getBuilding(int x, int y) { return this->getBuilding(x, y, *this->output); }
+    Building getBuilding(int x, int y, OutputSink &output)
     {
         // Check if x or y are out of bounds
         if (!this->inBounds(x, y))
         {
-            std::cout << "[!] Invalid x or y" << std::endl;
+            output << "[!] Invalid x or y\n";
             return ErrorBuilding();
         }
-        return this->buildings[x][y];
+        return this->getBuildingFromId(this->getSnapshot()->get(x, y));
     }
 
-    void setBuilding(int x, int y, Building building)
+    void setBuilding(int x, int y, Building building) { this->setBuilding(x, y, building, *this->output); }
+    void setBuilding(int x, int y, Building building, OutputSink &output)
     {
         // Check if the x or y are out of bounds
         if (!this->inBounds(x, y))
         {
-            std::cout << "[!] Invalid x or y" << std::endl;
+            output << "[!] Invalid x or y\n";
             return;
         }
-        // Check if the building is already at this location
-        if (this->buildings[x][y].getFullLabel() == building.getFullLabel())
+        int id = this->getBuildingId(building);
+        if (id == -1)
         {
-            // We print this with x + 1 and y + 1 because the user will see the board as 1 indexed
-            std::cout << "[!] The building " << building.getFullLabel() << " is already at " << (x + 1) << "x" << (y + 1) << std::endl;
+            output << "[!] Not a valid building type\n";
             return;
         }
 
-        // Check if there is already a building
-        // We need to check if the building is empty first, because if we pass a EMPTY building as
-        // the parameter, we want to delete that building so we dont care about if there is a building or not
-        if (building.getFullLabel() != EmptyBuilding().getFullLabel() && this->buildings[x][y].getFullLabel() != EmptyBuilding().getFullLabel())
-        {
-            // We print this with x + 1 and y + 1 because the user will see the board as 1 indexed
-            std::cout << "[!] There is already a building at " << (x + 1) << "x" << (y + 1) << std::endl;
+        std::lock_guard<std::mutex> lock(this->writeLock);
+        // Readers that still hold the old snapshot keep seeing the old grid
+        GridWriter writer(*this->getSnapshot());
+        BuildingId currentId = writer.get(x, y);
+        if (!this->canSet(writer, x, y, id, output))
             return;
-        }
-
-        this->buildings[x][y] = building;
+        writer.set(x, y, id);
+        this->publish(writer.finish());
+        this->notifyListeners({CellChange{x, y, currentId, (BuildingId)id}});
 
         // Add 1 back to the x and y because we want to print the coordinates as normal humans would
         // If the building is a "empty" building, we are not placing a building we are deleting one
-        if (building.getLabel() != "0")
+        if (id != 0)
         {
-            std::cout << "[*] Placed building " << building.getFullLabel() << " at " << (y + 1) << "x" << (x + 1) << std::endl;
+            output << "[*] Placed building " << building.getFullLabel() << " at " << (y + 1) << "x" << (x + 1) << "\n";
         }
         else
         {
-            std::cout << "[*] Removed building from " << (y + 1) << "x" << (x + 1) << std::endl;
+            output << "[*] Removed building from " << (y + 1) << "x" << (x + 1) << "\n";
+        }
+    }
+
+    // Applies many changes at once and publishes them as one new version, gives back how many were applied
+    int setBuildings(const std::vector<Placement> &placements) { return this->setBuildings(placements, *this->output); }
+    int setBuildings(const std::vector<Placement> &placements, OutputSink &output) { return this->setBuildings(placements, output, false); }
+
+    // With allOrNothing nothing is changed as soon as a single change is not allowed, then it gives back 0
+    int setBuildings(const std::vector<Placement> &placements, OutputSink &output, bool allOrNothing)
+    {
+        std::lock_guard<std::mutex> lock(this->writeLock);
+        GridWriter writer(*this->getSnapshot());
+        std::vector<CellChange> changes;
+        for (const Placement &placement : placements)
+        {
+            bool allowed = false;
+            if (!this->inBounds(placement.x, placement.y))
+                output << "[!] Invalid x or y\n";
+            else if (placement.id > this->buildingTypes.size())
+                output << "[!] Not a valid building type\n";
+            else
+                allowed = this->canSet(writer, placement.x, placement.y, placement.id, output);
+            if (allowed)
+            {
+                changes.push_back(CellChange{placement.x, placement.y, writer.get(placement.x, placement.y), placement.id});
+                writer.set(placement.x, placement.y, placement.id);
+            }
+            else if (allOrNothing)
+            {
+                // The validator already counts the accepted changes, undo them from the last to the first
+                for (size_t i = changes.size(); this->validator != nullptr && i > 0; i--)
+                    this->validator->onAccepted(changes[i - 1].x, changes[i - 1].y, changes[i - 1].newId, changes[i - 1].oldId);
+                return 0;
+            }
         }
+        if (changes.empty())
+            return 0;
+        this->publish(writer.finish());
+        this->notifyListeners(changes);
+        output << "[*] Changed " << changes.size() << " cells\n";
+        return changes.size();
     }
 
-    void printAllBuildingTypes()
+    void printAllBuildingTypes() { this->printAllBuildingTypes(*this->output); }
+    void printAllBuildingTypes(OutputSink &output)
     {
         // Print all the possible buildings (EMPTY excluded)
-        std::cout << "[*] Possible Buildings:" << std::endl;
+        output << "[*] Possible Buildings:\n";
         for (int i = 0; i < this->buildingTypes.size(); i++)
         {
-            std::cout << " " << i << ": " << buildingTypes[i].getFullLabel() << std::endl;
+            output << " " << i << ": " << buildingTypes[i].getFullLabel() << "\n";
         }
     }
 
-    void printInfo()
+    void printInfo() { this->printInfo(*this->output, this->getWindowSize()); }
+    void printInfo(OutputSink &output) { this->printInfo(output, this->getWindowSize()); }
+    void printInfo(OutputSink &output, int windowSize)
     {
-        int windowSize = this->getWindowSize();
-        std::stringstream prettyInfoStream;
-        this->getPrettyInfo(prettyInfoStream);
-        std::stringstream compactInfoStream;
-        this->getCompactInfo(compactInfoStream);
-        int longestPrettyStringWidth = this->getLongestStringWidth(prettyInfoStream);
-        int longestCompactStringWidth = this->getLongestStringWidth(compactInfoStream);
+        // The board has room for two digits per coordinate, bigger sites are only shown by the overview and the export
+        if (this->height > 99 || this->width > 99)
+        {
+            output << "[!] The building space is too big to print, please use the overview or the export\n";
+            return;
+        }
+
+        // The render buffers are kept around so their memory can be reused for the next frame
+        static thread_local OutputBuffer boardBuffer, prettyBuffer, compactBuffer;
+        boardBuffer.clear();
+        prettyBuffer.clear();
+        compactBuffer.clear();
+
+        // Everything is rendered from the same version, even if someone changes the grid meanwhile
+        std::shared_ptr<const GridSnapshot> snapshot = this->getSnapshot();
+        this->getBoardInfo(*snapshot, boardBuffer);
+        std::vector<std::tuple<std::string, std::string>> replaceVector = this->collectInfo(*snapshot);
+        this->getPrettyInfo(boardBuffer, replaceVector, prettyBuffer);
+        this->getCompactInfo(boardBuffer, replaceVector, compactBuffer);
+        int longestPrettyStringWidth = this->getLongestLineWidth(prettyBuffer);
+        int longestCompactStringWidth = this->getLongestLineWidth(compactBuffer);
 
         // For now when both the output variants are too large we just dont print
         if (longestPrettyStringWidth > windowSize && longestCompactStringWidth > windowSize)
         {
-            std::cout << "[!] The output is too large to display correctly, please shrink your building space" << std::endl;
+            output << "[!] The output is too large to display correctly, please shrink your building space\n";
             return;
         }
 
-        std::cout << this->getStringStreamHeight(prettyInfoStream) << " " << this->getLineCountOfString(injectionText) << std::endl;
+        int prettyHeight = this->getLineCount(prettyBuffer);
+        int injectionHeight = this->getLineCount(injectionText);
+        output << prettyHeight << " " << injectionHeight << "\n";
 
         // If the longest line of the pretty info is longer than the window size, print the compact info
         // Also if the height of the pretty info is longer than the height of the injection text, print the compact info
-        if ((longestPrettyStringWidth > windowSize) || (this->getStringStreamHeight(prettyInfoStream) < this->getLineCountOfString(injectionText)))
+        if ((longestPrettyStringWidth > windowSize) || (prettyHeight < injectionHeight))
         {
-            this->printStringStream(compactInfoStream);
+            output << compactBuffer;
         }
         else
         {
-            this->printStringStream(prettyInfoStream);
+            output << prettyBuffer;
         }
     }
+
+    void printSummary() { this->printSummary(*this->output); }
+    void printSummary(OutputSink &output)
+    {
+        // Only the info boxes, without the board
+        std::vector<std::tuple<std::string, std::string>> replaceVector = this->collectInfo(*this->getSnapshot());
+        this->getSummaryInfo(replaceVector, output.getBuffer());
+    }
 };
 
-#endif
\ No newline at end of file
+// Writes an amount of memory with the unit that fits it best
+inline OutputSink &writeBytes(OutputSink &output, long long bytes)
+{
+    const char *units[] = {"B", "KB", "MB", "GB"};
+    double value = bytes;
+    int unit = 0;
+    while (unit < 3 && (value >= 1024 || value <= -1024))
+    {
+        value /= 1024;
+        unit++;
+    }
+    return output.writeFixed(value, unit == 0 ? 0 : 1) << " " << units[unit];
+}
+
+// The counted memory of every area and what the whole process uses, as far as the system tells us
+void printMemoryUsage(OutputSink &output)
+{
+    output << "[*] Memory:\n";
+    long long total = 0, totalPeak = 0;
+    for (int area = 0; area < MEMORY_AREA_COUNT; area++)
+    {
+        MemoryUsage usage = MemoryAccount::get((MEMORY_AREA)area).getUsage();
+        total += usage.bytes;
+        totalPeak += usage.peakBytes;
+        output << " " << memoryAreaNames[area] << ": ";
+        writeBytes(output, usage.bytes) << " in " << usage.liveAllocations << " blocks, peak ";
+        writeBytes(output, usage.peakBytes) << ", " << usage.allocations << " allocations\n";
+    }
+    output << " Counted: ";
+    // The peaks of the areas were not all at the same time, so their sum is an upper bound
+    writeBytes(output, total) << ", peak at most ";
+    writeBytes(output, totalPeak) << "\n";
+#ifdef __linux__
+    // VmRSS is what the process has in memory right now, VmHWM the most it ever had
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    long long resident = -1, residentPeak = -1;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 6, "VmRSS:") == 0)
+            resident = std::atoll(line.c_str() + 6) * 1024;
+        else if (line.compare(0, 6, "VmHWM:") == 0)
+            residentPeak = std::atoll(line.c_str() + 6) * 1024;
+    }
+    if (resident >= 0 && residentPeak >= 0)
+    {
+        output << " Process: ";
+        writeBytes(output, resident) << ", peak ";
+        writeBytes(output, residentPeak) << "\n";
+    }
+#endif
+}
+
+#endif
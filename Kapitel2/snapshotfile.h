@@ -0,0 +1,383 @@
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <cstdint>
+#include <algorithm>
+#include "grid.h"
+#include "outputsink.h"
+#include "parallel.h"
+
+#ifndef SNAPSHOTFILE_H
+#define SNAPSHOTFILE_H
+
+// FNV-1a, good enough to notice a torn write or a damaged file
+inline uint32_t fnvChecksum(const char *data, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+A snapshot file that stores every tile with buildings compressed on its own, behind an index of the tiles.
+Empty tiles are not stored at all. A tile is stored as run lengths if that is smaller, so a tile
+full of one building type takes 4 bytes, otherwise its 4096 cells are stored as they are.
+Because every tile can be found and decompressed on its own, loading a whole file decompresses all
+tiles in parallel and looking at a part of a site only reads the tiles of that part from the disk.
+
+The file is:  "CAPYTILE" | sequence (8) | height (4) | width (4) | tile count (4)
+              | tile count * (tileX (4) | tileY (4) | offset (8) | length (4) | checksum (4)) | checksum (4) | tiles
+The offset counts from the start of the file, the checksum behind the index covers everything in front of it.
+A tile is:    0 | 4096 ids   or   1 | runs of (id (1) | length - 1 (2)), row by row
+All numbers are little endian.
+*/
+class SnapshotFile
+{
+private:
+    struct TileEntry
+    {
+        uint32_t tileX;
+        uint32_t tileY;
+        uint64_t offset;
+        uint32_t length;
+        uint32_t checksum;
+    };
+
+    static const int HEADER_SIZE = 28;
+    static const int ENTRY_SIZE = 24;
+    static const int CELL_COUNT = GridTile::SIZE * GridTile::SIZE;
+
+    std::string path;
+    uint64_t sequence = 0;
+    int height = 0;
+    int width = 0;
+    std::vector<TileEntry> entries;
+    // The index of the entry of every tile, -1 for a tile without buildings
+    std::vector<int> entryOfTile;
+    std::ifstream file;
+    // Only one tile can be read from the file at a time
+    std::mutex fileLock;
+
+    static void putNumber(std::string &buffer, uint64_t value, int bytes)
+    {
+        for (int i = 0; i < bytes; i++)
+            buffer += (char)((value >> (8 * i)) & 0xff);
+    }
+
+    static uint64_t getNumber(const char *data, int bytes)
+    {
+        uint64_t value = 0;
+        for (int i = 0; i < bytes; i++)
+            value |= (uint64_t)(unsigned char)data[i] << (8 * i);
+        return value;
+    }
+
+    static int getTileColumnCount(int width) { return (width + GridTile::SIZE - 1) / GridTile::SIZE; }
+
+    static void encodeTile(const GridTile &tile, std::string &buffer)
+    {
+        // Count the runs first, only if they are smaller than the cells themselves they are used
+        size_t runCount = 1;
+        for (int i = 1; i < CELL_COUNT; i++)
+        {
+            if (tile.cells[i] != tile.cells[i - 1])
+                runCount++;
+        }
+        if (runCount * 3 >= CELL_COUNT)
+        {
+            buffer += (char)0;
+            buffer.append((const char *)tile.cells, CELL_COUNT);
+            return;
+        }
+        buffer += (char)1;
+        int start = 0;
+        for (int i = 1; i <= CELL_COUNT; i++)
+        {
+            if (i < CELL_COUNT && tile.cells[i] == tile.cells[start])
+                continue;
+            buffer += (char)tile.cells[start];
+            putNumber(buffer, i - start - 1, 2);
+            start = i;
+        }
+    }
+
+    /*
+    Decompresses the tile and counts its buildings into counts, gives back false if it is damaged:
+    the runs don't add up, an id is not a building type or a cell outside of the grid has a building
+    */
+    static bool decodeTile(const char *data, size_t length, int tileX, int tileY, int height, int width, int buildingTypeCount, GridTile &tile, std::vector<long long> &counts)
+    {
+        if (length == 0)
+            return false;
+        if (data[0] == 0)
+        {
+            if (length != 1 + CELL_COUNT)
+                return false;
+            std::copy(data + 1, data + 1 + CELL_COUNT, (char *)tile.cells);
+        }
+        else if (data[0] == 1 && (length - 1) % 3 == 0)
+        {
+            int cell = 0;
+            for (size_t position = 1; position < length; position += 3)
+            {
+                int run = getNumber(data + position + 1, 2) + 1;
+                if (cell + run > CELL_COUNT)
+                    return false;
+                std::fill(tile.cells + cell, tile.cells + cell + run, (BuildingId)data[position]);
+                cell += run;
+            }
+            if (cell != CELL_COUNT)
+                return false;
+        }
+        else
+        {
+            return false;
+        }
+
+        // set() fills in the occupancy bits and the checksum, so the cells are put in one by one
+        int rows = height - tileX * GridTile::SIZE;
+        int columns = width - tileY * GridTile::SIZE;
+        for (int x = 0; x < GridTile::SIZE; x++)
+        {
+            for (int y = 0; y < GridTile::SIZE; y++)
+            {
+                BuildingId id = tile.cells[x * GridTile::SIZE + y];
+                if (id == 0)
+                    continue;
+                if (id > buildingTypeCount || x >= rows || y >= columns)
+                    return false;
+                tile.cells[x * GridTile::SIZE + y] = 0;
+                tile.set(x, y, id);
+                counts[id]++;
+            }
+        }
+        return true;
+    }
+
+    // Reads the header and the index, gives back false if they are damaged
+    static bool parseIndex(const char *data, size_t size, uint64_t &sequence, int &height, int &width, std::vector<TileEntry> &entries)
+    {
+        if (size < HEADER_SIZE + 4 || std::string(data, 8) != "CAPYTILE")
+            return false;
+        sequence = getNumber(data + 8, 8);
+        uint64_t fileHeight = getNumber(data + 16, 4);
+        uint64_t fileWidth = getNumber(data + 20, 4);
+        uint64_t count = getNumber(data + 24, 4);
+        if (fileHeight > INT32_MAX || fileWidth > INT32_MAX || size < HEADER_SIZE + count * ENTRY_SIZE + 4)
+            return false;
+        size_t indexEnd = HEADER_SIZE + count * ENTRY_SIZE;
+        if (getNumber(data + indexEnd, 4) != fnvChecksum(data, indexEnd))
+            return false;
+        height = fileHeight;
+        width = fileWidth;
+        int tileRows = (height + GridTile::SIZE - 1) / GridTile::SIZE;
+        entries.clear();
+        for (uint64_t i = 0; i < count; i++)
+        {
+            const char *entry = data + HEADER_SIZE + i * ENTRY_SIZE;
+            TileEntry tile{(uint32_t)getNumber(entry, 4), (uint32_t)getNumber(entry + 4, 4), getNumber(entry + 8, 8), (uint32_t)getNumber(entry + 16, 4), (uint32_t)getNumber(entry + 20, 4)};
+            if (tile.tileX >= (uint32_t)tileRows || tile.tileY >= (uint32_t)getTileColumnCount(width))
+                return false;
+            // The tiles are written row by row, so a tile can't show up twice
+            if (!entries.empty() && (tile.tileX < entries.back().tileX || (tile.tileX == entries.back().tileX && tile.tileY <= entries.back().tileY)))
+                return false;
+            entries.push_back(tile);
+        }
+        return true;
+    }
+
+    // Puts the tiles into a copy of an empty grid, every row of tiles that gets a tile is copied once
+    static std::shared_ptr<const GridSnapshot> assemble(int height, int width, int buildingTypeCount, const std::vector<TileEntry> &entries, std::vector<std::shared_ptr<GridTile>> &tiles, const std::vector<long long> &counts)
+    {
+        std::shared_ptr<GridSnapshot> snapshot = makeCounted<GridSnapshot, MEMORY_GRID>(*GridSnapshot::createEmpty(height, width, buildingTypeCount));
+        std::vector<bool> ownRows(snapshot->getTileRowCount(), false);
+        std::vector<std::shared_ptr<GridTileRow>> rows(snapshot->getTileRowCount());
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            if (tiles[i] == nullptr)
+                continue;
+            int tileX = entries[i].tileX;
+            if (!ownRows[tileX])
+            {
+                rows[tileX] = makeCounted<GridTileRow, MEMORY_GRID>(*snapshot->tileRows[tileX]);
+                snapshot->tileRows[tileX] = rows[tileX];
+                ownRows[tileX] = true;
+            }
+            rows[tileX]->tiles[entries[i].tileY] = tiles[i];
+        }
+        for (int id = 1; id <= buildingTypeCount; id++)
+        {
+            snapshot->buildingCounts[id] = counts[id];
+            snapshot->buildingCounts[0] -= counts[id];
+        }
+        return snapshot;
+    }
+
+public:
+    static bool isTiled(const std::string &contents) { return contents.compare(0, 8, "CAPYTILE") == 0; }
+
+    // Compresses every tile with buildings (in parallel) and appends the whole file to the buffer
+    static void encode(const GridSnapshot &snapshot, uint64_t sequence, std::string &buffer)
+    {
+        std::vector<TileEntry> entries;
+        for (int tileX = 0; tileX < snapshot.getTileRowCount(); tileX++)
+        {
+            for (int tileY = 0; tileY < snapshot.getTileColumnCount(); tileY++)
+            {
+                if (snapshot.getTile(tileX, tileY).occupiedRows != 0)
+                    entries.push_back(TileEntry{(uint32_t)tileX, (uint32_t)tileY, 0, 0, 0});
+            }
+        }
+        std::vector<std::string> compressed(entries.size());
+        parallelFor(entries.size(), [&](size_t begin, size_t end)
+                    {
+            for (size_t i = begin; i < end; i++)
+                encodeTile(snapshot.getTile(entries[i].tileX, entries[i].tileY), compressed[i]); }, 64);
+
+        size_t start = buffer.size();
+        uint64_t offset = HEADER_SIZE + entries.size() * ENTRY_SIZE + 4;
+        buffer += "CAPYTILE";
+        putNumber(buffer, sequence, 8);
+        putNumber(buffer, snapshot.height, 4);
+        putNumber(buffer, snapshot.width, 4);
+        putNumber(buffer, entries.size(), 4);
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            putNumber(buffer, entries[i].tileX, 4);
+            putNumber(buffer, entries[i].tileY, 4);
+            putNumber(buffer, offset, 8);
+            putNumber(buffer, compressed[i].size(), 4);
+            putNumber(buffer, fnvChecksum(compressed[i].data(), compressed[i].size()), 4);
+            offset += compressed[i].size();
+        }
+        putNumber(buffer, fnvChecksum(buffer.data() + start, buffer.size() - start), 4);
+        buffer.reserve(start + offset);
+        for (std::string &tile : compressed)
+            buffer += tile;
+    }
+
+    // Decompresses a whole file that is already in memory, all tiles in parallel, nullptr if it is damaged
+    static std::shared_ptr<const GridSnapshot> decode(const std::string &contents, int buildingTypeCount, uint64_t &sequence)
+    {
+        int height, width;
+        std::vector<TileEntry> entries;
+        if (!parseIndex(contents.data(), contents.size(), sequence, height, width, entries))
+            return nullptr;
+
+        std::vector<std::shared_ptr<GridTile>> tiles(entries.size());
+        std::vector<long long> counts(buildingTypeCount + 1, 0);
+        std::mutex countsLock;
+        bool damaged = false;
+        parallelFor(entries.size(), [&](size_t begin, size_t end)
+                    {
+            // Every thread counts on its own and adds its counts up once at the end
+            std::vector<long long> ownCounts(buildingTypeCount + 1, 0);
+            bool ownDamaged = false;
+            for (size_t i = begin; i < end && !ownDamaged; i++)
+            {
+                const TileEntry &entry = entries[i];
+                const char *data = contents.data() + entry.offset;
+                if (entry.offset + entry.length > contents.size() || fnvChecksum(data, entry.length) != entry.checksum)
+                {
+                    ownDamaged = true;
+                    break;
+                }
+                tiles[i] = makeCounted<GridTile, MEMORY_GRID>();
+                ownDamaged = !decodeTile(data, entry.length, entry.tileX, entry.tileY, height, width, buildingTypeCount, *tiles[i], ownCounts);
+            }
+            std::lock_guard<std::mutex> guard(countsLock);
+            damaged = damaged || ownDamaged;
+            for (int id = 0; id <= buildingTypeCount; id++)
+                counts[id] += ownCounts[id]; }, 64);
+        if (damaged)
+            return nullptr;
+        return assemble(height, width, buildingTypeCount, entries, tiles, counts);
+    }
+
+    // Only reads the header and the index, the tiles are read when they are needed
+    bool open(const std::string &path, OutputSink &output)
+    {
+        this->path = path;
+        this->file = std::ifstream(path, std::ios::binary);
+        if (!this->file)
+        {
+            output << "[!] Could not open " << path << "\n";
+            return false;
+        }
+        this->file.seekg(0, std::ios::end);
+        uint64_t fileSize = this->file.tellg();
+        this->file.seekg(0);
+        char header[HEADER_SIZE];
+        std::string index;
+        // A damaged tile count must not make us read (or allocate) more than the file has
+        if (this->file.read(header, HEADER_SIZE) && HEADER_SIZE + getNumber(header + 24, 4) * ENTRY_SIZE + 4 <= fileSize)
+        {
+            index.assign(header, HEADER_SIZE);
+            index.resize(HEADER_SIZE + getNumber(header + 24, 4) * ENTRY_SIZE + 4);
+            this->file.read(&index[HEADER_SIZE], index.size() - HEADER_SIZE);
+        }
+        if (!this->file || !parseIndex(index.data(), index.size(), this->sequence, this->height, this->width, this->entries))
+        {
+            output << "[!] " << path << " is damaged or not a tiled snapshot\n";
+            return false;
+        }
+        int tileColumns = getTileColumnCount(this->width);
+        this->entryOfTile.assign((size_t)((this->height + GridTile::SIZE - 1) / GridTile::SIZE) * tileColumns, -1);
+        for (size_t i = 0; i < this->entries.size(); i++)
+            this->entryOfTile[(size_t)this->entries[i].tileX * tileColumns + this->entries[i].tileY] = i;
+        return true;
+    }
+
+    int getHeight() { return this->height; }
+    int getWidth() { return this->width; }
+
+    /*
+    A grid as big as the whole file, but only the tiles that overlap the cells from minX/minY to maxX/maxY
+    are read and decompressed, every other tile is empty. The building counts only cover the loaded tiles.
+    Gives back nullptr if one of the tiles is damaged.
+    */
+    std::shared_ptr<const GridSnapshot> loadRegion(int minX, int minY, int maxX, int maxY, int buildingTypeCount, OutputSink &output)
+    {
+        minX = std::max(minX, 0);
+        minY = std::max(minY, 0);
+        maxX = std::min(maxX, this->height - 1);
+        maxY = std::min(maxY, this->width - 1);
+        std::vector<TileEntry> entries;
+        for (int tileX = minX / GridTile::SIZE; minX <= maxX && tileX <= maxX / GridTile::SIZE; tileX++)
+        {
+            for (int tileY = minY / GridTile::SIZE; minY <= maxY && tileY <= maxY / GridTile::SIZE; tileY++)
+            {
+                int entry = this->entryOfTile[(size_t)tileX * getTileColumnCount(this->width) + tileY];
+                if (entry != -1)
+                    entries.push_back(this->entries[entry]);
+            }
+        }
+
+        std::vector<std::shared_ptr<GridTile>> tiles(entries.size());
+        std::vector<long long> counts(buildingTypeCount + 1, 0);
+        std::string data;
+        std::lock_guard<std::mutex> guard(this->fileLock);
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            data.resize(entries[i].length);
+            this->file.clear();
+            this->file.seekg(entries[i].offset);
+            tiles[i] = makeCounted<GridTile, MEMORY_GRID>();
+            if (!this->file.read(&data[0], data.size()) || fnvChecksum(data.data(), data.size()) != entries[i].checksum ||
+                !decodeTile(data.data(), data.size(), entries[i].tileX, entries[i].tileY, this->height, this->width, buildingTypeCount, *tiles[i], counts))
+            {
+                output << "[!] " << this->path << " is damaged\n";
+                return nullptr;
+            }
+        }
+        return assemble(this->height, this->width, buildingTypeCount, entries, tiles, counts);
+    }
+};
+
+#endif
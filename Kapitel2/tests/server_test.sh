@@ -0,0 +1,49 @@
+#!/bin/bash
+# Starts the server and checks that numbers too big for an int are refused without taking it down
+# Usage: tests/server_test.sh [port], run from anywhere on linux
+cd "$(dirname "$0")/.." || exit 1
+PORT=${1:-7791}
+BINARY=$(mktemp)
+trap 'kill $SERVER 2>/dev/null; rm -f "$BINARY"' EXIT
+
+g++ -std=c++17 -O2 -pthread simulationstool.cpp -o "$BINARY" || exit 1
+"$BINARY" --server tcp:$PORT 20x20 > /dev/null 2>&1 &
+SERVER=$!
+
+# Sends the lines and gives back every answer, the server closes the connection after quit
+send()
+{
+    exec 3<> /dev/tcp/127.0.0.1/$PORT || return 1
+    printf '%s\nquit\n' "$@" >&3
+    cat <&3
+    exec 3<&-
+}
+
+for i in $(seq 50); do
+    (exec 3<> /dev/tcp/127.0.0.1/$PORT) 2> /dev/null && break
+    sleep 0.1
+done
+
+FAILED=0
+check()
+{
+    local answer
+    answer=$(send "$1")
+    if [[ "$answer" != *"$2"* ]]; then
+        echo "FAIL: '$1' answered '$answer' instead of '$2'"
+        FAILED=1
+    fi
+}
+
+check "place 99999999999x1 0" "[!] Invalid coordinates"
+check "place 1x99999999999 0" "[!] Invalid coordinates"
+check "place 1x1 99999999999999999999999" "[!] Not a valid building type"
+check "print 99999999999" "."
+if ! kill -0 $SERVER 2> /dev/null; then
+    echo "FAIL: the server died"
+    exit 1
+fi
+check "place 1x1 0" "[*] Placed building"
+
+[ $FAILED -eq 0 ] && echo "OK"
+exit $FAILED
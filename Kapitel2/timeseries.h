@@ -0,0 +1,689 @@
+#include <vector>
+#include <string>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include "simulationstool.h"
+#include "energy.h"
+#include "clusters.h"
+#include "snapshotfile.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifndef TIMESERIES_H
+#define TIMESERIES_H
+
+// Small numbers take one byte, 7 bits per byte and the high bit says that more bytes follow
+inline void putVarint(std::string &buffer, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        buffer += (char)(value | 0x80);
+        value >>= 7;
+    }
+    buffer += (char)value;
+}
+
+// Gives back false if the number doesn't end before end
+inline bool getVarint(const char *&next, const char *end, uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && next < end; shift += 7)
+    {
+        unsigned char byte = *next++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+// Maps 0, -1, 1, -2, ... to 0, 1, 2, 3, ... so small negative numbers stay small varints
+inline uint64_t zigzagEncode(long long value) { return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63); }
+inline long long zigzagDecode(uint64_t value) { return (long long)(value >> 1) ^ -(long long)(value & 1); }
+
+/*
+The output of every building (or every cluster) in every hour of an energy simulation, stored column by column.
+The hours are cut into groups of a day (fewer hours on huge sites, so the buffers stay small) and every group
+has one chunk per energy source. A chunk holds the series of all buildings of its source for those hours.
+Buildings that produce exactly the same in every hour (all panels without shading do) share one series
+of a dictionary, and a series is stored as the difference to the hour before, which is a small number most
+of the time. Values are whole Wh.
+
+File:   "CAPYSERI" | chunks | footer | footer offset (8) | "CAPYSERI"
+Chunk:  series:  series count | per series: buildings that use it | first value | differences
+        index:   runs of (series | how many buildings in a row use it), in the order of the fleet,
+                 left out if it is the same as in the chunk before of the same source
+Footer: hours | per source: entity count, per entity x | y | chunk count
+        | per chunk: source | first hour | hours | offset | series bytes | index bytes | series checksum | index checksum
+        | checksum of the footer (4)
+Every number is a varint, the values and differences are zigzag encoded. The footer offset is little endian.
+Totals only need the series part of the chunks of one source, so a query never touches the rest of the file.
+*/
+class TimeSeriesWriter : public EnergyStepListener
+{
+private:
+    struct Group
+    {
+        size_t firstHour = 0;
+        size_t hours = 0;
+        // Wh of every entity in every hour of the group, hour * entities + entity, one vector per source
+        std::vector<long long> values[3];
+    };
+
+    struct Chunk
+    {
+        int source;
+        uint64_t firstHour;
+        uint64_t hours;
+        uint64_t offset;
+        uint64_t seriesBytes;
+        uint64_t indexBytes;
+        uint32_t seriesChecksum;
+        uint32_t indexChecksum;
+    };
+
+    std::unique_ptr<FileOutputSink> file;
+    size_t groupHours = 24;
+    // The entity (building or cluster) of every building of the fleet and where the entities are
+    std::vector<uint32_t> entityOf[3];
+    std::vector<int> entityX[3], entityY[3];
+    size_t hourCount = 0;
+    Group current;
+
+    // Everything below is guarded by the lock
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<Group> queue;
+    // Groups that were written, their buffers are used again
+    std::vector<Group> spare;
+    bool stopping = false;
+    std::thread writer;
+
+    // Only used by the writer thread while it runs
+    std::vector<Chunk> chunks;
+    uint64_t written = 0;
+    std::string series, index;
+    // The last index that was written for every source
+    std::string previousIndex[3];
+    std::vector<uint32_t> table, seriesOf;
+    // The values, hash and how many entities use it of every distinct series of a chunk
+    std::vector<long long> dictionary;
+    std::vector<uint64_t> hashes, uses;
+
+    // Hands the current group to the writer thread, waits if it is already two groups behind
+    void handOver()
+    {
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->changed.wait(guard, [&]
+                           { return this->queue.size() < 2; });
+        this->queue.push_back(std::move(this->current));
+        this->current = Group();
+        if (!this->spare.empty())
+        {
+            this->current = std::move(this->spare.back());
+            this->spare.pop_back();
+        }
+        this->current.hours = 0;
+        this->changed.notify_all();
+    }
+
+    void writeChunk(int source, const Group &group)
+    {
+        size_t count = this->entityX[source].size();
+        size_t hours = group.hours;
+        const long long *values = group.values[source].data();
+
+        /*
+        The dictionary is a hash table of the distinct series, which are kept one after the other.
+        It grows with the number of distinct series, usually there are only a few and all of it
+        stays in the cache while the buffer is read once, entity by entity.
+        */
+        const uint32_t emptySlot = UINT32_MAX;
+        size_t capacity = 16;
+        this->table.assign(capacity, emptySlot);
+        this->seriesOf.resize(count);
+        this->dictionary.clear();
+        this->hashes.clear();
+        this->uses.clear();
+        std::vector<long long> column(hours);
+        for (size_t entity = 0; entity < count; entity++)
+        {
+            // Every hour has its own odd multiplier, the multiplications don't wait for each other
+            uint64_t hash = 0;
+            for (size_t hour = 0; hour < hours; hour++)
+            {
+                column[hour] = values[hour * count + entity];
+                hash += (uint64_t)column[hour] * (0x9e3779b97f4a7c15ULL + 2 * hour);
+            }
+            hash = (hash ^ (hash >> 31)) * 0xbf58476d1ce4e5b9ULL;
+            hash ^= hash >> 29;
+            size_t slot = hash & (capacity - 1);
+            while (true)
+            {
+                uint32_t known = this->table[slot];
+                if (known == emptySlot)
+                {
+                    this->seriesOf[entity] = this->uses.size();
+                    this->dictionary.insert(this->dictionary.end(), column.begin(), column.end());
+                    this->hashes.push_back(hash);
+                    this->uses.push_back(1);
+                    if (this->uses.size() * 2 <= capacity)
+                    {
+                        this->table[slot] = this->uses.size() - 1;
+                        break;
+                    }
+                    // Half full, every series moves to a table twice the size
+                    capacity *= 2;
+                    this->table.assign(capacity, emptySlot);
+                    for (uint32_t number = 0; number < this->uses.size(); number++)
+                    {
+                        size_t free = this->hashes[number] & (capacity - 1);
+                        while (this->table[free] != emptySlot)
+                            free = (free + 1) & (capacity - 1);
+                        this->table[free] = number;
+                    }
+                    break;
+                }
+                if (this->hashes[known] == hash && std::equal(column.begin(), column.end(), this->dictionary.begin() + known * hours))
+                {
+                    this->seriesOf[entity] = known;
+                    this->uses[known]++;
+                    break;
+                }
+                slot = (slot + 1) & (capacity - 1);
+            }
+        }
+
+        this->series.clear();
+        putVarint(this->series, this->uses.size());
+        for (size_t i = 0; i < this->uses.size(); i++)
+        {
+            putVarint(this->series, this->uses[i]);
+            long long previous = 0;
+            for (size_t hour = 0; hour < hours; hour++)
+            {
+                long long value = this->dictionary[i * hours + hour];
+                putVarint(this->series, zigzagEncode(value - previous));
+                previous = value;
+            }
+        }
+
+        this->index.clear();
+        for (size_t entity = 0; entity < count;)
+        {
+            size_t end = entity + 1;
+            while (end < count && this->seriesOf[end] == this->seriesOf[entity])
+                end++;
+            putVarint(this->index, this->seriesOf[entity]);
+            putVarint(this->index, end - entity);
+            entity = end;
+        }
+
+        // Which series a building uses hardly ever changes from one day to the next
+        if (this->index == this->previousIndex[source])
+            this->index.clear();
+        else
+            this->previousIndex[source] = this->index;
+
+        this->chunks.push_back(Chunk{source, group.firstHour, group.hours, this->written, this->series.size(), this->index.size(),
+                                     fnvChecksum(this->series.data(), this->series.size()), fnvChecksum(this->index.data(), this->index.size())});
+        *this->file << this->series << this->index;
+        this->written += this->series.size() + this->index.size();
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> guard(this->lock);
+        while (true)
+        {
+            this->changed.wait(guard, [&]
+                               { return this->stopping || !this->queue.empty(); });
+            if (this->queue.empty())
+                return;
+            Group group = std::move(this->queue.front());
+            this->queue.pop_front();
+            guard.unlock();
+            for (int source = 0; source < 3; source++)
+                this->writeChunk(source, group);
+            guard.lock();
+            this->spare.push_back(std::move(group));
+            this->changed.notify_all();
+        }
+    }
+
+public:
+    ~TimeSeriesWriter() { this->close(); }
+
+    /*
+    Starts a file for the fleet, one series per building, or per cluster if clusters is given.
+    The writer then has to be given to EnergySimulation::run and closed afterwards.
+    */
+    bool open(const std::string &path, const EnergyFleet &fleet, ClusterIndex *clusters, OutputSink &output)
+    {
+        this->file.reset(new FileOutputSink(path));
+        if (!this->file->isOpen())
+        {
+            output << "[!] Could not open " << path << "\n";
+            return false;
+        }
+        *this->file << "CAPYSERI";
+        this->written = 8;
+
+        const std::vector<int> *xs[3] = {&fleet.solar.x, &fleet.wind.x, &fleet.hydro.x};
+        const std::vector<int> *ys[3] = {&fleet.solar.y, &fleet.wind.y, &fleet.hydro.y};
+        size_t largest = 1;
+        for (int source = 0; source < 3; source++)
+        {
+            // The entity of every cluster of this source, the first building of a cluster stands for all of it
+            std::unordered_map<int, uint32_t> clusterEntities;
+            for (size_t i = 0; i < xs[source]->size(); i++)
+            {
+                int x = (*xs[source])[i], y = (*ys[source])[i];
+                uint32_t entity = this->entityX[source].size();
+                if (clusters != nullptr)
+                {
+                    auto inserted = clusterEntities.emplace(clusters->getClusterIdAt(x, y), entity);
+                    if (!inserted.second)
+                    {
+                        this->entityOf[source].push_back(inserted.first->second);
+                        continue;
+                    }
+                }
+                this->entityOf[source].push_back(entity);
+                this->entityX[source].push_back(x);
+                this->entityY[source].push_back(y);
+            }
+            largest = std::max(largest, this->entityX[source].size());
+        }
+        // At most 128 MB per source and group on a huge site, every group is in memory up to three times
+        this->groupHours = std::max((size_t)1, std::min((size_t)24, ((size_t)16 << 20) / largest));
+        this->writer = std::thread(&TimeSeriesWriter::run, this);
+        return true;
+    }
+
+    void onStep(size_t hour, const EnergyFleet &, const float *solar, const float *wind, const float *hydro) override
+    {
+        if (this->current.hours == 0)
+        {
+            this->current.firstHour = hour;
+            for (int source = 0; source < 3; source++)
+                this->current.values[source].resize(this->entityX[source].size() * this->groupHours);
+        }
+        size_t slot = hour - this->current.firstHour;
+        const float *outputs[3] = {solar, wind, hydro};
+        for (int source = 0; source < 3; source++)
+        {
+            const uint32_t *entities = this->entityOf[source].data();
+            const float *output = outputs[source];
+            long long *row = this->current.values[source].data() + slot * this->entityX[source].size();
+            std::fill(row, row + this->entityX[source].size(), 0);
+            // The output is never negative, so adding a half and cutting off rounds to whole Wh
+            for (size_t i = 0; i < this->entityOf[source].size(); i++)
+                row[entities[i]] += (long long)(output[i] * 1000.0 + 0.5);
+        }
+        this->current.hours = slot + 1;
+        this->hourCount = std::max(this->hourCount, hour + 1);
+        if (this->current.hours == this->groupHours)
+            this->handOver();
+    }
+
+    // Writes what is left and the footer
+    void close()
+    {
+        if (!this->writer.joinable())
+            return;
+        if (this->current.hours > 0)
+            this->handOver();
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->stopping = true;
+        }
+        this->changed.notify_all();
+        this->writer.join();
+
+        std::string footer;
+        putVarint(footer, this->hourCount);
+        for (int source = 0; source < 3; source++)
+        {
+            putVarint(footer, this->entityX[source].size());
+            for (size_t entity = 0; entity < this->entityX[source].size(); entity++)
+            {
+                putVarint(footer, this->entityX[source][entity]);
+                putVarint(footer, this->entityY[source][entity]);
+            }
+        }
+        putVarint(footer, this->chunks.size());
+        for (Chunk &chunk : this->chunks)
+        {
+            putVarint(footer, chunk.source);
+            putVarint(footer, chunk.firstHour);
+            putVarint(footer, chunk.hours);
+            putVarint(footer, chunk.offset);
+            putVarint(footer, chunk.seriesBytes);
+            putVarint(footer, chunk.indexBytes);
+            putVarint(footer, chunk.seriesChecksum);
+            putVarint(footer, chunk.indexChecksum);
+        }
+        uint32_t checksum = fnvChecksum(footer.data(), footer.size());
+        for (int i = 0; i < 4; i++)
+            footer += (char)((checksum >> (8 * i)) & 0xff);
+        for (int i = 0; i < 8; i++)
+            footer += (char)((this->written >> (8 * i)) & 0xff);
+        footer += "CAPYSERI";
+        *this->file << footer;
+        this->file.reset();
+    }
+
+    size_t getHourCount() { return this->hourCount; }
+    size_t getSeriesCount() { return this->entityX[0].size() + this->entityX[1].size() + this->entityX[2].size(); }
+};
+
+/*
+Reads a file of a TimeSeriesWriter. The file is mapped into memory, so a query only reads the pages
+of the chunks it needs from the disk. Every query gives back false if the file turns out to be damaged.
+*/
+class TimeSeriesFile
+{
+private:
+    struct Chunk
+    {
+        uint64_t source;
+        uint64_t firstHour;
+        uint64_t hours;
+        uint64_t offset;
+        uint64_t seriesBytes;
+        uint64_t indexBytes;
+        uint64_t seriesChecksum;
+        uint64_t indexChecksum;
+    };
+
+    const char *data = nullptr;
+    size_t size = 0;
+#ifdef __linux__
+    void *mapping = nullptr;
+#else
+    std::string contents;
+#endif
+    uint64_t hourCount = 0;
+    std::vector<int> entityX[3], entityY[3];
+    std::vector<Chunk> chunks;
+
+    bool parseFooter()
+    {
+        if (this->size < 8 + 4 + 8 + 8 || std::string(this->data, 8) != "CAPYSERI" || std::string(this->data + this->size - 8, 8) != "CAPYSERI")
+            return false;
+        uint64_t footerOffset = 0;
+        for (int i = 0; i < 8; i++)
+            footerOffset |= (uint64_t)(unsigned char)this->data[this->size - 16 + i] << (8 * i);
+        if (footerOffset < 8 || footerOffset > this->size - 20)
+            return false;
+        const char *next = this->data + footerOffset;
+        const char *end = this->data + this->size - 20;
+        uint32_t storedChecksum = 0;
+        for (int i = 0; i < 4; i++)
+            storedChecksum |= (uint32_t)(unsigned char)end[i] << (8 * i);
+        if (storedChecksum != fnvChecksum(next, end - next))
+            return false;
+
+        uint64_t count, x, y;
+        if (!getVarint(next, end, this->hourCount))
+            return false;
+        for (int source = 0; source < 3; source++)
+        {
+            if (!getVarint(next, end, count))
+                return false;
+            for (uint64_t entity = 0; entity < count; entity++)
+            {
+                if (!getVarint(next, end, x) || !getVarint(next, end, y))
+                    return false;
+                this->entityX[source].push_back(x);
+                this->entityY[source].push_back(y);
+            }
+        }
+        if (!getVarint(next, end, count))
+            return false;
+        for (uint64_t i = 0; i < count; i++)
+        {
+            Chunk chunk;
+            if (!getVarint(next, end, chunk.source) || !getVarint(next, end, chunk.firstHour) || !getVarint(next, end, chunk.hours) ||
+                !getVarint(next, end, chunk.offset) || !getVarint(next, end, chunk.seriesBytes) || !getVarint(next, end, chunk.indexBytes) ||
+                !getVarint(next, end, chunk.seriesChecksum) || !getVarint(next, end, chunk.indexChecksum))
+                return false;
+            if (chunk.source > 2 || chunk.offset > footerOffset || chunk.seriesBytes > footerOffset - chunk.offset ||
+                chunk.indexBytes > footerOffset - chunk.offset - chunk.seriesBytes || chunk.firstHour > this->hourCount || chunk.hours > this->hourCount - chunk.firstHour)
+                return false;
+            this->chunks.push_back(chunk);
+        }
+        return true;
+    }
+
+    /*
+    Calls function(series, uses, values) for every series of the chunk, values are the Wh of every hour.
+    Gives back false if the chunk is damaged.
+    */
+    template <typename F>
+    bool forEachSeries(const Chunk &chunk, std::vector<long long> &values, F function)
+    {
+        const char *next = this->data + chunk.offset;
+        const char *end = next + chunk.seriesBytes;
+        if (fnvChecksum(next, chunk.seriesBytes) != chunk.seriesChecksum)
+            return false;
+        uint64_t seriesCount, uses, delta;
+        if (!getVarint(next, end, seriesCount))
+            return false;
+        values.resize(chunk.hours);
+        for (uint64_t series = 0; series < seriesCount; series++)
+        {
+            if (!getVarint(next, end, uses))
+                return false;
+            long long previous = 0;
+            for (uint64_t hour = 0; hour < chunk.hours; hour++)
+            {
+                if (!getVarint(next, end, delta))
+                    return false;
+                previous += zigzagDecode(delta);
+                values[hour] = previous;
+            }
+            function(series, uses, values);
+        }
+        return true;
+    }
+
+public:
+    ~TimeSeriesFile() { this->close(); }
+
+    bool open(const std::string &path, OutputSink &output)
+    {
+        this->close();
+#ifdef __linux__
+        int file = ::open(path.c_str(), O_RDONLY);
+        struct stat status;
+        if (file == -1 || fstat(file, &status) != 0)
+        {
+            if (file != -1)
+                ::close(file);
+            output << "[!] Could not open " << path << "\n";
+            return false;
+        }
+        this->size = status.st_size;
+        void *mapping = this->size == 0 ? MAP_FAILED : mmap(nullptr, this->size, PROT_READ, MAP_PRIVATE, file, 0);
+        // The mapping stays valid after the file is closed
+        ::close(file);
+        if (mapping == MAP_FAILED)
+        {
+            this->size = 0;
+            output << "[!] " << path << " is damaged\n";
+            return false;
+        }
+        this->mapping = mapping;
+        this->data = (const char *)mapping;
+#else
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            output << "[!] Could not open " << path << "\n";
+            return false;
+        }
+        this->contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        this->data = this->contents.data();
+        this->size = this->contents.size();
+#endif
+        if (!this->parseFooter())
+        {
+            output << "[!] " << path << " is damaged\n";
+            this->close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+#ifdef __linux__
+        if (this->mapping != nullptr)
+            munmap(this->mapping, this->size);
+        this->mapping = nullptr;
+#else
+        this->contents.clear();
+#endif
+        this->data = nullptr;
+        this->size = 0;
+        this->hourCount = 0;
+        this->chunks.clear();
+        for (int source = 0; source < 3; source++)
+        {
+            this->entityX[source].clear();
+            this->entityY[source].clear();
+        }
+    }
+
+    size_t getHourCount() { return this->hourCount; }
+    size_t getSeriesCount(ENERGY_SOURCE source) { return this->entityX[source - SOLAR].size(); }
+
+    // kWh of all buildings of the source together in every hour, only reads the series of that source
+    bool getHourlyTotals(ENERGY_SOURCE source, std::vector<double> &totals)
+    {
+        totals.assign(this->hourCount, 0);
+        std::vector<long long> values;
+        for (const Chunk &chunk : this->chunks)
+        {
+            if (chunk.source != (uint64_t)(source - SOLAR))
+                continue;
+            bool valid = this->forEachSeries(chunk, values, [&](uint64_t, uint64_t uses, const std::vector<long long> &values)
+                                             {
+                for (uint64_t hour = 0; hour < chunk.hours; hour++)
+                    totals[chunk.firstHour + hour] += values[hour] * (double)uses / 1000; });
+            if (!valid)
+                return false;
+        }
+        return true;
+    }
+
+    // Adds up every 24 hours of the hourly totals, the last day may be shorter
+    static void sumDays(const std::vector<double> &hourly, std::vector<double> &totals)
+    {
+        totals.assign((hourly.size() + 23) / 24, 0);
+        for (size_t hour = 0; hour < hourly.size(); hour++)
+            totals[hour / 24] += hourly[hour];
+    }
+
+    // kWh of all buildings of the source together on every day
+    bool getDailyTotals(ENERGY_SOURCE source, std::vector<double> &totals)
+    {
+        std::vector<double> hourly;
+        if (!this->getHourlyTotals(source, hourly))
+            return false;
+        sumDays(hourly, totals);
+        return true;
+    }
+
+    // kWh of one building (or cluster) in every hour, the entities are in the order of the fleet
+    bool getSeries(ENERGY_SOURCE source, size_t entity, std::vector<double> &series)
+    {
+        series.assign(this->hourCount, 0);
+        if (entity >= this->getSeriesCount(source))
+            return false;
+        std::vector<long long> values;
+        const char *index = nullptr;
+        uint64_t indexBytes = 0;
+        for (const Chunk &chunk : this->chunks)
+        {
+            if (chunk.source != (uint64_t)(source - SOLAR))
+                continue;
+            // A chunk without an index uses the one of the chunk before
+            if (chunk.indexBytes > 0)
+            {
+                index = this->data + chunk.offset + chunk.seriesBytes;
+                indexBytes = chunk.indexBytes;
+                if (fnvChecksum(index, indexBytes) != chunk.indexChecksum)
+                    return false;
+            }
+            // Find the series of the entity in the runs of the index
+            const char *next = index;
+            const char *end = index + indexBytes;
+            uint64_t wanted = 0, seriesIndex, run, covered = 0;
+            while (covered <= entity)
+            {
+                if (!getVarint(next, end, seriesIndex) || !getVarint(next, end, run))
+                    return false;
+                covered += run;
+                wanted = seriesIndex;
+            }
+            bool valid = this->forEachSeries(chunk, values, [&](uint64_t number, uint64_t, const std::vector<long long> &values)
+                                             {
+                if (number != wanted)
+                    return;
+                for (uint64_t hour = 0; hour < chunk.hours; hour++)
+                    series[chunk.firstHour + hour] = values[hour] / 1000.0; });
+            if (!valid)
+                return false;
+        }
+        return true;
+    }
+};
+
+// The totals, the peak hour and the best day per source, read straight from the saved series
+void printTimeSeriesReport(OutputSink &output, TimeSeriesFile &file)
+{
+    const char *names[] = {"Solar Panel", "Wind Power Plant", "Hydroelectric Power Plant"};
+    ENERGY_SOURCE sources[] = {SOLAR, WIND, HYDRO};
+
+    output << "[*] Saved energy production over " << file.getHourCount() << " hours:\n";
+    for (int i = 0; i < 3; i++)
+    {
+        std::vector<double> hourly, daily;
+        if (!file.getHourlyTotals(sources[i], hourly))
+        {
+            output << "[!] The series of " << names[i] << " are damaged\n";
+            continue;
+        }
+        // The days come from the hours we already have, so every chunk is only decoded once
+        TimeSeriesFile::sumDays(hourly, daily);
+        double energy = EnergyResult::sum(hourly);
+        output << " " << names[i] << " (" << file.getSeriesCount(sources[i]) << " series): ";
+        output.writeFixed(energy / 1000, 1) << " MWh";
+        if (energy > 0)
+        {
+            size_t peak = EnergyResult::peakHour(hourly);
+            size_t bestDay = EnergyResult::peakHour(daily);
+            output << ", peak ";
+            output.writeFixed(hourly[peak], 1) << " kW in hour " << peak << ", best day " << bestDay << " with ";
+            output.writeFixed(daily[bestDay] / 1000, 1) << " MWh";
+        }
+        output << "\n";
+    }
+}
+
+#endif
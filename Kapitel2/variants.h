@@ -0,0 +1,181 @@
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "simulationstool.h"
+
+#ifndef VARIANTS_H
+#define VARIANTS_H
+
+/*
+Named what-if versions of a site ("plan A", "plan B"). Every variant is a fork of the site, so it shares
+all tiles with it and only takes memory for the tiles that were changed in the variant.
+A variant can be promoted back, then the main site gets every cell that is different in the variant.
+*/
+class SiteVariants
+{
+private:
+    std::map<std::string, std::unique_ptr<CapycitySim>> variants;
+
+    static std::string pad(const std::string &text, size_t width)
+    {
+        return text.size() >= width ? text + " " : text + std::string(width - text.size(), ' ');
+    }
+
+    static std::string centsToString(Cents cents)
+    {
+        char digits[24];
+        return std::string(digits, formatCents(digits, cents)) + "$";
+    }
+
+public:
+    // Gives back nullptr if there already is a variant with that name
+    CapycitySim *fork(const std::string &name, CapycitySim &site)
+    {
+        if (name.empty() || this->variants.count(name) != 0)
+            return nullptr;
+        CapycitySim *variant = site.fork();
+        this->variants[name] = std::unique_ptr<CapycitySim>(variant);
+        return variant;
+    }
+
+    // nullptr if there is no variant with that name
+    CapycitySim *get(const std::string &name)
+    {
+        auto found = this->variants.find(name);
+        return found == this->variants.end() ? nullptr : found->second.get();
+    }
+
+    bool remove(const std::string &name) { return this->variants.erase(name) != 0; }
+
+    std::vector<std::string> getNames()
+    {
+        std::vector<std::string> names;
+        for (auto &variant : this->variants)
+            names.push_back(variant.first);
+        return names;
+    }
+
+    /*
+    Changes the site so it looks like the variant and gives back how many cells changed.
+    The changes go through setBuildings, so the rules of the site are checked like for any other change,
+    they have to be attached to the site. Every building that has to go is removed before the new ones
+    are placed, so a cell can change its type. If the rules refuse a single change nothing is changed,
+    so no building is removed without its replacement.
+    */
+    int promote(const std::string &name, CapycitySim &site, OutputSink &output)
+    {
+        CapycitySim *variant = this->get(name);
+        if (variant == nullptr)
+        {
+            output << "[!] There is no variant " << name << "\n";
+            return 0;
+        }
+        std::vector<Placement> removals, additions;
+        site.getSnapshot()->forEachDifference(*variant->getSnapshot(), [&](int x, int y, BuildingId oldId, BuildingId newId)
+                                              {
+            if (oldId != 0)
+                removals.push_back(Placement{x, y, 0});
+            if (newId != 0)
+                additions.push_back(Placement{x, y, newId}); });
+        if (removals.empty() && additions.empty())
+        {
+            output << "[*] The variant " << name << " is the same as the site\n";
+            return 0;
+        }
+        removals.insert(removals.end(), additions.begin(), additions.end());
+        int changed = site.setBuildings(removals, output, true);
+        if (changed == 0)
+        {
+            output << "[!] The variant " << name << " was not promoted, the site stays as it is\n";
+            return 0;
+        }
+        output << "[*] Promoted " << name << "\n";
+        return changed;
+    }
+
+    // Prints the buildings, costs and materials of the site and every variant next to each other
+    void printComparison(OutputSink &output, CapycitySim &site)
+    {
+        const size_t columnWidth = 14;
+        std::vector<std::string> names{"Site"};
+        std::vector<std::shared_ptr<const GridSnapshot>> snapshots{site.getSnapshot()};
+        for (auto &variant : this->variants)
+        {
+            names.push_back(variant.first);
+            snapshots.push_back(variant.second->getSnapshot());
+        }
+
+        std::vector<Building> &buildingTypes = site.getBuildingTypes();
+        // The first column has to fit the longest building name
+        size_t labelWidth = columnWidth;
+        for (Building &buildingType : buildingTypes)
+            labelWidth = std::max(labelWidth, buildingType.getFullLabel().size() + 1);
+        std::string line = pad("", labelWidth);
+        for (std::string &name : names)
+            line += pad(name, columnWidth);
+        output << "[*] Variants:\n"
+               << line << "\n";
+
+        for (size_t id = 1; id <= buildingTypes.size(); id++)
+        {
+            line = pad(buildingTypes[id - 1].getFullLabel(), labelWidth);
+            for (auto &snapshot : snapshots)
+                line += pad(std::to_string(snapshot->buildingCounts[id]), columnWidth);
+            output << line << "\n";
+        }
+
+        // The materials in the order they first show up in the recipes
+        std::vector<std::string> materialNames;
+        for (Building &buildingType : buildingTypes)
+        {
+            for (Material &material : buildingType.getNecessaryMaterials())
+            {
+                if (std::find(materialNames.begin(), materialNames.end(), material.getName()) == materialNames.end())
+                    materialNames.push_back(material.getName());
+            }
+        }
+        for (std::string &materialName : materialNames)
+        {
+            line = pad(materialName, labelWidth);
+            for (auto &snapshot : snapshots)
+            {
+                long long amount = 0;
+                for (size_t id = 1; id <= buildingTypes.size(); id++)
+                {
+                    for (Material &material : buildingTypes[id - 1].getNecessaryMaterials())
+                    {
+                        if (material.getName() == materialName)
+                            amount += snapshot->buildingCounts[id];
+                    }
+                }
+                line += pad(std::to_string(amount), columnWidth);
+            }
+            output << line << "\n";
+        }
+
+        line = pad("Cost", labelWidth);
+        for (auto &snapshot : snapshots)
+        {
+            Cents cost = 0;
+            for (size_t id = 1; id <= buildingTypes.size(); id++)
+                cost += snapshot->buildingCounts[id] * buildingTypes[id - 1].getTotalPrice();
+            line += pad(centsToString(cost), columnWidth);
+        }
+        output << line << "\n";
+
+        // Only the tiles that are not shared with the site have to be compared
+        line = pad("Changed cells", labelWidth);
+        for (auto &snapshot : snapshots)
+        {
+            long long changed = 0;
+            snapshots[0]->forEachDifference(*snapshot, [&](int, int, BuildingId, BuildingId)
+                                            { changed++; });
+            line += pad(std::to_string(changed), columnWidth);
+        }
+        output << line << "\n";
+    }
+};
+
+#endif